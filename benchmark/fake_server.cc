@@ -0,0 +1,207 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "benchmark/fake_server.h"
+
+#include <chrono>
+#include <cmath>
+
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
+using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::CheckError;
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::CheckResponse;
+using ::google::api::servicecontrol::v1::QuotaError;
+using ::google::api::servicecontrol::v1::ReportRequest;
+using ::google::api::servicecontrol::v1::ReportResponse;
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+FakeServer::FakeServer(const FakeServerOptions& options)
+    : options_(options),
+      next_sequence_(0),
+      completing_(0),
+      stopping_(false),
+      random_(1),
+      latency_ms_(std::log(std::max(options.median_latency_ms, 1e-9)),
+                  options.latency_sigma),
+      checks_(0),
+      quotas_(0),
+      reports_(0),
+      report_operations_(0) {
+  for (int i = 0; i < std::max(options.num_threads, 1); ++i) {
+    threads_.emplace_back(&FakeServer::Run, this);
+  }
+}
+
+FakeServer::~FakeServer() {
+  {
+    MutexLock lock(mutex_);
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+TransportCheckFunc FakeServer::GetCheckTransport() {
+  return [this](const CheckRequest& request, CheckResponse* response,
+                TransportDoneFunc on_done) {
+    ++checks_;
+    std::string operation_id = request.operation().operation_id();
+    bool denied = Denied(request.operation().consumer_id());
+    Schedule([operation_id, denied, response, on_done](const Status& status) {
+      if (status.ok()) {
+        response->set_operation_id(operation_id);
+        if (denied) {
+          CheckError* error = response->add_check_errors();
+          error->set_code(CheckError::PERMISSION_DENIED);
+        } else {
+          response->mutable_check_info()
+              ->mutable_consumer_info()
+              ->set_project_number(123456);
+        }
+      }
+      on_done(status);
+    });
+  };
+}
+
+TransportQuotaFunc FakeServer::GetQuotaTransport() {
+  return [this](const AllocateQuotaRequest& request,
+                AllocateQuotaResponse* response, TransportDoneFunc on_done) {
+    ++quotas_;
+    const auto& operation = request.allocate_operation();
+    int64_t tokens = 0;
+    for (const auto& metric_value_set : operation.quota_metrics()) {
+      for (const auto& metric_value : metric_value_set.metric_values()) {
+        tokens += metric_value.int64_value();
+      }
+    }
+    std::string operation_id = operation.operation_id();
+    bool exhausted = !AllocateTokens(operation.consumer_id(), tokens);
+    Schedule(
+        [operation_id, exhausted, response, on_done](const Status& status) {
+          if (status.ok()) {
+            response->set_operation_id(operation_id);
+            if (exhausted) {
+              QuotaError* error = response->add_allocate_errors();
+              error->set_code(QuotaError::RESOURCE_EXHAUSTED);
+            }
+          }
+          on_done(status);
+        });
+  };
+}
+
+TransportReportFunc FakeServer::GetReportTransport() {
+  return [this](const ReportRequest& request, ReportResponse* response,
+                TransportDoneFunc on_done) {
+    ++reports_;
+    report_operations_ += request.operations_size();
+    Schedule([on_done](const Status& status) { on_done(status); });
+  };
+}
+
+void FakeServer::Drain() {
+  MutexLock lock(mutex_);
+  drained_.wait(lock, [this] { return pending_.empty() && completing_ == 0; });
+}
+
+void FakeServer::Schedule(std::function<void(const Status&)> respond) {
+  {
+    MutexLock lock(mutex_);
+    Status status = OkStatus();
+    if (Uniform() < options_.error_rate) {
+      status = Status(StatusCode::kUnavailable, "Injected error");
+    }
+    int64_t latency_ns = 0;
+    if (options_.median_latency_ms > 0) {
+      latency_ns = static_cast<int64_t>(latency_ms_(random_) * 1e6);
+    }
+    pending_.push(PendingCall{NowNanos() + latency_ns, next_sequence_++,
+                              [respond, status]() { respond(status); }});
+  }
+  wakeup_.notify_one();
+}
+
+double FakeServer::Uniform() {
+  return std::uniform_real_distribution<double>(0, 1)(random_);
+}
+
+bool FakeServer::Denied(const std::string& consumer_id) const {
+  // The same consumers are always denied.
+  return std::hash<std::string>()(consumer_id) % 10000 <
+         options_.deny_rate * 10000;
+}
+
+bool FakeServer::AllocateTokens(const std::string& consumer_id,
+                                int64_t tokens) {
+  if (options_.quota_per_second <= 0) return true;
+  int64_t second = NowNanos() / 1000000000;
+  MutexLock lock(mutex_);
+  auto& allocated = allocated_[consumer_id];
+  if (allocated.first != second) {
+    allocated = std::make_pair(second, 0);
+  }
+  if (allocated.second + tokens > options_.quota_per_second) return false;
+  allocated.second += tokens;
+  return true;
+}
+
+void FakeServer::Run() {
+  MutexLock lock(mutex_);
+  while (true) {
+    if (pending_.empty()) {
+      if (stopping_) return;
+      wakeup_.wait(lock);
+      continue;
+    }
+    // Pending calls are completed right away once stopping.
+    int64_t now = NowNanos();
+    if (!stopping_ && pending_.top().due_time > now) {
+      wakeup_.wait_for(lock,
+                       std::chrono::nanoseconds(pending_.top().due_time - now));
+      continue;
+    }
+    std::function<void()> complete = pending_.top().complete;
+    pending_.pop();
+    ++completing_;
+    lock.unlock();
+    complete();
+    lock.lock();
+    --completing_;
+    if (pending_.empty() && completing_ == 0) {
+      drained_.notify_all();
+    }
+  }
+}
+
+}  // namespace service_control_client
+}  // namespace google
@@ -0,0 +1,158 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// An in-process fake of the Service Control server, for load tests.
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_BENCHMARK_FAKE_SERVER_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_BENCHMARK_FAKE_SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "include/service_control_client.h"
+#include "utils/google_macros.h"
+#include "utils/thread.h"
+
+namespace google {
+namespace service_control_client {
+
+// Options controlling the fake server behavior.
+struct FakeServerOptions {
+  FakeServerOptions()
+      : median_latency_ms(5),
+        latency_sigma(0.5),
+        error_rate(0),
+        deny_rate(0),
+        quota_per_second(0),
+        num_threads(4) {}
+
+  // The latency of the calls is log-normally distributed, with the given
+  // median and the given standard deviation of its logarithm. The latency is
+  // 0 if median_latency_ms <= 0.
+  double median_latency_ms;
+  double latency_sigma;
+
+  // The fraction of the calls failing with an UNAVAILABLE status.
+  double error_rate;
+
+  // The fraction of the consumers whose Check calls are denied.
+  double deny_rate;
+
+  // The quota tokens each consumer can allocate per second. AllocateQuota
+  // calls over it are answered with a RESOURCE_EXHAUSTED error. Unlimited if
+  // <= 0.
+  int64_t quota_per_second;
+
+  // The number of threads completing the calls.
+  int num_threads;
+};
+
+// Serves the Check, AllocateQuota and Report calls of the transports it
+// returns. Calls are completed by a pool of threads once their sampled
+// latency has elapsed, instead of a thread per call. Thread safe.
+class FakeServer {
+ public:
+  explicit FakeServer(const FakeServerOptions& options);
+
+  // Completes the pending calls right away.
+  ~FakeServer();
+
+  // Transports sending their calls to this server. They must not be used
+  // after this server is destroyed.
+  TransportCheckFunc GetCheckTransport();
+  TransportQuotaFunc GetQuotaTransport();
+  TransportReportFunc GetReportTransport();
+
+  // Waits until all the calls received so far are completed.
+  void Drain();
+
+  // The number of calls received.
+  int64_t checks() const { return checks_; }
+  int64_t quotas() const { return quotas_; }
+  int64_t reports() const { return reports_; }
+  // The number of operations received in Report calls.
+  int64_t report_operations() const { return report_operations_; }
+
+ private:
+  // A call to complete at due_time, in steady clock nanoseconds.
+  struct PendingCall {
+    int64_t due_time;
+    int64_t sequence;
+    std::function<void()> complete;
+
+    bool operator>(const PendingCall& other) const {
+      return due_time > other.due_time ||
+             (due_time == other.due_time && sequence > other.sequence);
+    }
+  };
+
+  // Schedules the completion of a new call once its sampled latency has
+  // elapsed. respond is called with the sampled status of the call, and
+  // fills in the response if it is OK.
+  void Schedule(
+      std::function<void(const ::google::protobuf::util::Status&)> respond);
+
+  // Samples a uniform value in [0, 1). Requires mutex_.
+  double Uniform();
+
+  // Returns whether the given consumer is denied.
+  bool Denied(const std::string& consumer_id) const;
+
+  // Allocates tokens of the consumer in the current second. Returns false if
+  // they exceed quota_per_second.
+  bool AllocateTokens(const std::string& consumer_id, int64_t tokens);
+
+  // Completes the calls when they are due.
+  void Run();
+
+  const FakeServerOptions options_;
+
+  Mutex mutex_;
+  std::condition_variable wakeup_;
+  std::condition_variable drained_;
+  std::priority_queue<PendingCall, std::vector<PendingCall>,
+                      std::greater<PendingCall>>
+      pending_;
+  int64_t next_sequence_;
+  // The number of calls being completed outside of pending_.
+  int completing_;
+  bool stopping_;
+  std::mt19937_64 random_;
+  std::lognormal_distribution<double> latency_ms_;
+  // Per consumer, the second of the last allocation and the tokens allocated
+  // in it.
+  std::unordered_map<std::string, std::pair<int64_t, int64_t>> allocated_;
+
+  std::vector<Thread> threads_;
+
+  std::atomic<int64_t> checks_;
+  std::atomic<int64_t> quotas_;
+  std::atomic<int64_t> reports_;
+  std::atomic<int64_t> report_operations_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(FakeServer);
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_BENCHMARK_FAKE_SERVER_H_
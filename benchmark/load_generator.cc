@@ -0,0 +1,403 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// A load generator driving ServiceControlClientImpl from many threads against
+// an in-process FakeServer, to size deployments offline.
+//
+// Each thread simulates API calls of consumers picked at random: a Check()
+// call, an optional Quota() call and a Report() call per API call, through
+// the blocking client API. The latency percentiles of each kind of call, and
+// the RPC reduction ratio (client calls / server calls) are printed at the
+// end. Run with, e.g.:
+//
+//   bazel run -c opt //benchmark:load_generator -- --threads=32
+//       --seconds=30 --consumers=10000 --latency_ms=20 --quota=1
+//
+// Flags are given as --name=value; see kFlags for the list.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/fake_server.h"
+#include "include/service_control_client.h"
+
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
+using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::CheckRequest;
+using ::google::api::servicecontrol::v1::CheckResponse;
+using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::Operation;
+using ::google::api::servicecontrol::v1::ReportRequest;
+using ::google::api::servicecontrol::v1::ReportResponse;
+using ::google::protobuf::util::Status;
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+const char kServiceName[] = "library.googleapis.com";
+const char kServiceConfigId[] = "2016-09-19r0";
+
+// The flags with their default values.
+const std::map<std::string, double> kFlags = {
+    // Load.
+    {"threads", 16},
+    {"seconds", 10},
+    {"consumers", 1000},
+    {"quota", 0},
+    // Fake server, see FakeServerOptions.
+    {"latency_ms", 5},
+    {"latency_sigma", 0.5},
+    {"error_rate", 0},
+    {"deny_rate", 0},
+    {"quota_per_second", 0},
+    {"server_threads", 4},
+    // Client.
+    {"check_entries", 10000},
+    {"check_flush_ms", 500},
+    {"check_expiration_ms", 1000},
+    {"check_shards", 1},
+    {"quota_entries", 10000},
+    {"quota_refresh_ms", 1000},
+    {"report_entries", 10000},
+    {"report_flush_ms", 1000},
+    {"report_shards", 1},
+};
+
+// Parses the --name=value flags over their default values. Returns false on
+// unknown flags.
+bool ParseFlags(int argc, char** argv, std::map<std::string, double>* flags) {
+  *flags = kFlags;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* equal = std::strchr(arg, '=');
+    if (std::strncmp(arg, "--", 2) != 0 || equal == nullptr ||
+        flags->find(std::string(arg + 2, equal)) == flags->end()) {
+      std::fprintf(stderr, "Unknown flag: %s\n", arg);
+      return false;
+    }
+    (*flags)[std::string(arg + 2, equal)] = std::atof(equal + 1);
+  }
+  return true;
+}
+
+// Records latencies in buckets of 1/16th of a power of two nanoseconds, so
+// percentiles are within about 6% of the recorded values. Not thread safe.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : counts_(64 * kSubBuckets), count_(0) {}
+
+  void Record(int64_t nanos) {
+    ++counts_[Bucket(std::max<int64_t>(nanos, 1))];
+    ++count_;
+  }
+
+  void Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+  }
+
+  int64_t count() const { return count_; }
+
+  // Returns the lower bound of the bucket holding the given percentile, in
+  // nanoseconds.
+  int64_t Percentile(double percentile) const {
+    int64_t rank = static_cast<int64_t>(std::ceil(count_ * percentile / 100));
+    int64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank && seen > 0) return LowerBound(i);
+    }
+    return 0;
+  }
+
+ private:
+  static const int kSubBucketBits = 4;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+
+  static size_t Bucket(int64_t nanos) {
+    int exponent = 63 - __builtin_clzll(nanos);
+    if (exponent < kSubBucketBits) return nanos;
+    int64_t sub_bucket = (nanos >> (exponent - kSubBucketBits)) - kSubBuckets;
+    return (exponent - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+  }
+
+  static int64_t LowerBound(size_t bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+    int64_t sub_bucket = bucket % kSubBuckets + kSubBuckets;
+    return sub_bucket << (exponent - kSubBucketBits);
+  }
+
+  std::vector<int64_t> counts_;
+  int64_t count_;
+};
+
+// The results of one load thread.
+struct ThreadResult {
+  ThreadResult() : check_denials(0), quota_denials(0), errors(0) {}
+
+  LatencyHistogram check_latency;
+  LatencyHistogram quota_latency;
+  LatencyHistogram report_latency;
+  int64_t check_denials;
+  int64_t quota_denials;
+  int64_t errors;
+};
+
+// The requests of one consumer.
+struct ConsumerRequests {
+  CheckRequest check;
+  AllocateQuotaRequest quota;
+  ReportRequest report;
+};
+
+ConsumerRequests CreateRequests(int consumer) {
+  ConsumerRequests requests;
+  std::string consumer_id = "project:" + std::to_string(consumer);
+
+  Operation* operation = requests.check.mutable_operation();
+  requests.check.set_service_name(kServiceName);
+  requests.check.set_service_config_id(kServiceConfigId);
+  operation->set_operation_id("operation-" + std::to_string(consumer));
+  operation->set_operation_name(
+      "google.example.library.v1.LibraryService.ListShelves");
+  operation->set_consumer_id(consumer_id);
+  (*operation->mutable_labels())["servicecontrol.googleapis.com/caller_ip"] =
+      "10.0.0.1";
+
+  requests.quota.set_service_name(kServiceName);
+  requests.quota.set_service_config_id(kServiceConfigId);
+  auto* quota_operation = requests.quota.mutable_allocate_operation();
+  quota_operation->set_operation_id("operation-" + std::to_string(consumer));
+  quota_operation->set_method_name(
+      "google.example.library.v1.LibraryService.ListShelves");
+  quota_operation->set_consumer_id(consumer_id);
+  auto* quota_metric = quota_operation->add_quota_metrics();
+  quota_metric->set_metric_name("library.googleapis.com/read_requests");
+  quota_metric->add_metric_values()->set_int64_value(1);
+
+  requests.report.set_service_name(kServiceName);
+  requests.report.set_service_config_id(kServiceConfigId);
+  Operation* report_operation = requests.report.add_operations();
+  *report_operation = *operation;
+  auto* metric_value_set = report_operation->add_metric_value_sets();
+  metric_value_set->set_metric_name(
+      "serviceruntime.googleapis.com/api/producer/request_count");
+  MetricValue* metric_value = metric_value_set->add_metric_values();
+  (*metric_value->mutable_labels())["/response_code"] = "200";
+  metric_value->set_int64_value(1);
+  return requests;
+}
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A periodic timer on its own thread. Stop() waits for a running timer_func
+// to return.
+class LoadTimer : public PeriodicTimer {
+ public:
+  LoadTimer(int interval_ms, std::function<void()> timer_func)
+      : stopped_(false),
+        thread_([this, interval_ms, timer_func]() {
+          MutexLock lock(mutex_);
+          while (!stopped_) {
+            stop_.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            if (!stopped_) {
+              lock.unlock();
+              timer_func();
+              lock.lock();
+            }
+          }
+        }) {}
+
+  ~LoadTimer() { Stop(); }
+
+  void Stop() override {
+    {
+      MutexLock lock(mutex_);
+      if (stopped_) return;
+      stopped_ = true;
+    }
+    stop_.notify_all();
+    thread_.join();
+  }
+
+ private:
+  Mutex mutex_;
+  std::condition_variable stop_;
+  bool stopped_;
+  Thread thread_;
+};
+
+void PrintLatency(const char* name, const LatencyHistogram& latency,
+                  int64_t rpcs) {
+  std::printf("%-7s %10lld %10.1f %10.1f %10.1f %10lld %10.2f\n", name,
+              static_cast<long long>(latency.count()),
+              latency.Percentile(50) / 1e3, latency.Percentile(99) / 1e3,
+              latency.Percentile(99.9) / 1e3, static_cast<long long>(rpcs),
+              rpcs > 0 ? static_cast<double>(latency.count()) / rpcs : 0.0);
+}
+
+int Run(const std::map<std::string, double>& flags) {
+  auto flag = [&flags](const char* name) { return flags.at(name); };
+
+  FakeServerOptions server_options;
+  server_options.median_latency_ms = flag("latency_ms");
+  server_options.latency_sigma = flag("latency_sigma");
+  server_options.error_rate = flag("error_rate");
+  server_options.deny_rate = flag("deny_rate");
+  server_options.quota_per_second = flag("quota_per_second");
+  server_options.num_threads = flag("server_threads");
+  FakeServer server(server_options);
+
+  ServiceControlClientOptions options(
+      CheckAggregationOptions(flag("check_entries"), flag("check_flush_ms"),
+                              flag("check_expiration_ms"),
+                              flag("check_shards")),
+      QuotaAggregationOptions(flag("quota_entries"), flag("quota_refresh_ms")),
+      ReportAggregationOptions(flag("report_entries"), flag("report_flush_ms"),
+                               flag("report_shards")));
+  options.check_transport = server.GetCheckTransport();
+  options.quota_transport = server.GetQuotaTransport();
+  options.report_transport = server.GetReportTransport();
+  // Owned by the client.
+  LoadTimer* timer = nullptr;
+  options.periodic_timer = [&timer](int interval_ms,
+                                    std::function<void()> timer_func) {
+    timer = new LoadTimer(interval_ms, timer_func);
+    return std::unique_ptr<PeriodicTimer>(timer);
+  };
+  std::unique_ptr<ServiceControlClient> client =
+      CreateServiceControlClient(kServiceName, kServiceConfigId, options);
+
+  const int num_consumers = std::max<int>(flag("consumers"), 1);
+  std::vector<ConsumerRequests> requests;
+  requests.reserve(num_consumers);
+  for (int i = 0; i < num_consumers; ++i) {
+    requests.push_back(CreateRequests(i));
+  }
+
+  const int num_threads = std::max<int>(flag("threads"), 1);
+  const bool quota = flag("quota") != 0;
+  const int64_t end_time = NowNanos() + flag("seconds") * 1e9;
+  std::vector<ThreadResult> results(num_threads);
+  std::vector<Thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      ThreadResult& result = results[t];
+      std::mt19937_64 random(t);
+      std::uniform_int_distribution<int> consumers(0, num_consumers - 1);
+      CheckResponse check_response;
+      AllocateQuotaResponse quota_response;
+      ReportResponse report_response;
+      while (NowNanos() < end_time) {
+        const ConsumerRequests& consumer = requests[consumers(random)];
+
+        int64_t start = NowNanos();
+        Status status = client->Check(consumer.check, &check_response);
+        result.check_latency.Record(NowNanos() - start);
+        if (!status.ok()) ++result.errors;
+        if (check_response.check_errors_size() > 0) {
+          ++result.check_denials;
+          continue;
+        }
+
+        if (quota) {
+          start = NowNanos();
+          status = client->Quota(consumer.quota, &quota_response);
+          result.quota_latency.Record(NowNanos() - start);
+          if (!status.ok()) ++result.errors;
+          if (quota_response.allocate_errors_size() > 0) {
+            ++result.quota_denials;
+            continue;
+          }
+        }
+
+        start = NowNanos();
+        status = client->Report(consumer.report, &report_response);
+        result.report_latency.Record(NowNanos() - start);
+        if (!status.ok()) ++result.errors;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // The flush callbacks of in-flight calls may use the client, so they are
+  // completed before it is destroyed. The timer is stopped first, as a flush
+  // in progress may still start calls.
+  if (timer) {
+    timer->Stop();
+  }
+  server.Drain();
+  Statistics statistics;
+  (void)client->GetStatistics(&statistics);
+  client.reset();
+  server.Drain();
+
+  ThreadResult total;
+  for (const auto& result : results) {
+    total.check_latency.Merge(result.check_latency);
+    total.quota_latency.Merge(result.quota_latency);
+    total.report_latency.Merge(result.report_latency);
+    total.check_denials += result.check_denials;
+    total.quota_denials += result.quota_denials;
+    total.errors += result.errors;
+  }
+
+  std::printf("%-7s %10s %10s %10s %10s %10s %10s\n", "call", "count",
+              "p50(us)", "p99(us)", "p999(us)", "rpcs", "reduction");
+  PrintLatency("Check", total.check_latency, server.checks());
+  if (quota) {
+    PrintLatency("Quota", total.quota_latency, server.quotas());
+  }
+  PrintLatency("Report", total.report_latency, server.reports());
+  std::printf(
+      "\ncheck denials: %lld, quota denials: %lld, errors: %lld\n"
+      "report operations sent: %lld, coalesced checks: %llu\n",
+      static_cast<long long>(total.check_denials),
+      static_cast<long long>(total.quota_denials),
+      static_cast<long long>(total.errors),
+      static_cast<long long>(server.report_operations()),
+      static_cast<unsigned long long>(statistics.coalesced_checks));
+  return 0;
+}
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
+
+int main(int argc, char** argv) {
+  std::map<std::string, double> flags;
+  if (!google::service_control_client::ParseFlags(argc, argv, &flags)) {
+    return 1;
+  }
+  return google::service_control_client::Run(flags);
+}
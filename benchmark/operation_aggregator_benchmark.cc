@@ -0,0 +1,82 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Microbenchmarks for OperationAggregator, which aggregates the operations of
+// the report cache and the quota of the check cache.
+//
+// BM_MergeOperation merges operations with the same signature into one
+// aggregator, and BM_ToOperationProto materializes the aggregated operation
+// as done when it is flushed. Both are run for a growing number of metrics,
+// with int64 values (buckets:0) or distribution values with the given number
+// of buckets.
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark/operation_builder.h"
+#include "src/operation_aggregator.h"
+
+using ::google::api::servicecontrol::v1::Operation;
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+// The number of distinct operations merged in turn.
+const int kNumOperations = 16;
+
+OperationShape GetShape(const benchmark::State& state) {
+  return OperationShape{10 /*labels*/, static_cast<int>(state.range(0)),
+                        static_cast<int>(state.range(1))};
+}
+
+void BM_MergeOperation(benchmark::State& state) {
+  std::vector<Operation> operations;
+  for (int i = 0; i < kNumOperations; ++i) {
+    operations.push_back(CreateOperation(GetShape(state), 0, i));
+  }
+  OperationAggregator aggregator(operations[0], nullptr);
+  int i = 0;
+  for (auto _ : state) {
+    aggregator.MergeOperation(operations[i++ % kNumOperations]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ToOperationProto(benchmark::State& state) {
+  OperationAggregator aggregator(CreateOperation(GetShape(state), 0), nullptr);
+  for (int i = 1; i < kNumOperations; ++i) {
+    aggregator.MergeOperation(CreateOperation(GetShape(state), 0, i));
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(aggregator.ToOperationProto());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Arguments are {number of metrics, number of buckets}.
+void MetricArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"metrics", "buckets"});
+  b->ArgsProduct({{1, 4, 16}, {0, 8, 64}});
+}
+
+BENCHMARK(BM_MergeOperation)->Apply(MetricArgs);
+BENCHMARK(BM_ToOperationProto)->Apply(MetricArgs);
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
+
+BENCHMARK_MAIN();
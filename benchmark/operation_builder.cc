@@ -0,0 +1,73 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "benchmark/operation_builder.h"
+
+#include <string>
+
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::MetricValueSet;
+using ::google::api::servicecontrol::v1::Operation;
+
+namespace google {
+namespace service_control_client {
+
+Operation CreateOperation(const OperationShape& shape, int consumer,
+                          int seed) {
+  Operation operation;
+  operation.set_operation_id("operation-" + std::to_string(seed));
+  operation.set_operation_name(
+      "google.example.library.v1.LibraryService.ListShelves");
+  operation.set_consumer_id("project:" + std::to_string(consumer));
+  operation.mutable_start_time()->set_seconds(1000 + seed);
+  operation.mutable_end_time()->set_seconds(1001 + seed);
+  auto* labels = operation.mutable_labels();
+  for (int i = 0; i < shape.num_labels; ++i) {
+    (*labels)["servicecontrol.googleapis.com/label_" + std::to_string(i)] =
+        "some-label-value-" + std::to_string(i * 7919);
+  }
+
+  for (int i = 0; i < shape.num_metrics; ++i) {
+    MetricValueSet* metric_value_set = operation.add_metric_value_sets();
+    metric_value_set->set_metric_name(
+        "serviceruntime.googleapis.com/api/producer/metric_" +
+        std::to_string(i));
+    MetricValue* metric_value = metric_value_set->add_metric_values();
+    (*metric_value->mutable_labels())["/response_code"] = "200";
+    (*metric_value->mutable_labels())["/protocol"] = "http";
+    if (shape.num_buckets == 0) {
+      metric_value->set_int64_value(1 + seed % 10);
+      continue;
+    }
+    Distribution* distribution = metric_value->mutable_distribution_value();
+    auto* buckets = distribution->mutable_exponential_buckets();
+    buckets->set_num_finite_buckets(shape.num_buckets - 2);
+    buckets->set_growth_factor(2);
+    buckets->set_scale(1);
+    double value = 1 + seed % 100;
+    distribution->set_count(1);
+    distribution->set_mean(value);
+    distribution->set_minimum(value);
+    distribution->set_maximum(value);
+    for (int j = 0; j < shape.num_buckets; ++j) {
+      distribution->add_bucket_counts(j == seed % shape.num_buckets ? 1 : 0);
+    }
+  }
+  return operation;
+}
+
+}  // namespace service_control_client
+}  // namespace google
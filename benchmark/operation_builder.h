@@ -0,0 +1,46 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Builds the operations used by the aggregator benchmarks.
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_BENCHMARK_OPERATION_BUILDER_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_BENCHMARK_OPERATION_BUILDER_H_
+
+#include "google/api/servicecontrol/v1/operation.pb.h"
+
+namespace google {
+namespace service_control_client {
+
+// The shape of a benchmark operation.
+struct OperationShape {
+  // Number of labels of the operation, as typically set by API proxies.
+  int num_labels;
+  // Number of metric value sets, each with one labeled metric value.
+  int num_metrics;
+  // Number of buckets of the distribution metric values. Metric values are
+  // int64 values if 0.
+  int num_buckets;
+};
+
+// Returns an operation of the given shape for the given consumer. Operations
+// of different consumers have different signatures. The values are varied
+// with seed, which does not change the signatures.
+::google::api::servicecontrol::v1::Operation CreateOperation(
+    const OperationShape& shape, int consumer, int seed = 0);
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_BENCHMARK_OPERATION_BUILDER_H_
@@ -0,0 +1,93 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Microbenchmarks for the ReportAggregatorImpl::Report() path.
+//
+// BM_Report reports operations of kNumConsumers consumers, each thread on
+// its own consumers, into an aggregator shared by all threads. The operations
+// carry the given number of labels and metrics, with int64 values
+// (buckets:0) or distribution values with the given number of buckets. The
+// cache is split into kNumShards shards and is never flushed during the
+// benchmark, so every call merges into a cached operation.
+
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark/operation_builder.h"
+#include "src/aggregator_interface.h"
+
+using ::google::api::servicecontrol::v1::ReportRequest;
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+const char kServiceName[] = "library.googleapis.com";
+const char kServiceConfigId[] = "2016-09-19r0";
+
+const int kNumConsumers = 64;
+const int kNumShards = 16;
+
+// The aggregator shared by the threads of a benchmark run.
+ReportAggregator* aggregator = nullptr;
+
+void BM_Report(benchmark::State& state) {
+  if (state.thread_index == 0) {
+    // The flush interval is long enough that nothing is flushed during the
+    // benchmark.
+    ReportAggregationOptions options(10000 /*entries*/,
+                                     3600000 /*flush_interval_ms*/,
+                                     kNumShards);
+    aggregator = CreateReportAggregator(
+                     kServiceName, kServiceConfigId, options,
+                     std::shared_ptr<MetricKindMap>(new MetricKindMap))
+                     .release();
+    aggregator->SetFlushCallback([](const ReportRequest& request) {});
+  }
+
+  OperationShape shape{static_cast<int>(state.range(0)),
+                       static_cast<int>(state.range(1)),
+                       static_cast<int>(state.range(2))};
+  std::vector<ReportRequest> requests(kNumConsumers);
+  for (int i = 0; i < kNumConsumers; ++i) {
+    requests[i].set_service_name(kServiceName);
+    requests[i].set_service_config_id(kServiceConfigId);
+    *requests[i].add_operations() = CreateOperation(
+        shape, state.thread_index * kNumConsumers + i, i);
+  }
+
+  int i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(aggregator->Report(requests[i++ % kNumConsumers]));
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index == 0) {
+    delete aggregator;
+    aggregator = nullptr;
+  }
+}
+BENCHMARK(BM_Report)
+    ->ArgNames({"labels", "metrics", "buckets"})
+    ->ArgsProduct({{10, 30}, {1, 4}, {0, 16}})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
+
+BENCHMARK_MAIN();
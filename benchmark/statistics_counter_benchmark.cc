@@ -0,0 +1,75 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+// Microbenchmarks for the statistics counters of ServiceControlClientImpl.
+//
+// Every Check(), AllocateQuota() and Report() call bumps a few of the
+// client's statistics counters. BM_AtomicCounters bumps them the way the
+// client used to, as adjacent std::atomic_int_fast64_t that all the calling
+// threads share. BM_ShardedCounters bumps ShardedCounters instead. Both run
+// from 1 to 64 threads.
+
+#include <atomic>
+
+#include "benchmark/benchmark.h"
+#include "utils/sharded_counter.h"
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+// The counters bumped by one Check() call that is sent to the server.
+template <class Counter>
+struct CheckCounters {
+  Counter total_called_checks;
+  Counter send_checks_in_flight;
+  Counter send_checks_by_flush;
+  Counter coalesced_checks;
+};
+
+void BM_AtomicCounters(benchmark::State& state) {
+  static CheckCounters<std::atomic_int_fast64_t> counters;
+  for (auto _ : state) {
+    ++counters.total_called_checks;
+    ++counters.send_checks_in_flight;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AtomicCounters)->ThreadRange(1, 64)->UseRealTime();
+
+void BM_ShardedCounters(benchmark::State& state) {
+  static CheckCounters<ShardedCounter> counters;
+  for (auto _ : state) {
+    counters.total_called_checks.Increment();
+    counters.send_checks_in_flight.Increment();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ShardedCounters)->ThreadRange(1, 64)->UseRealTime();
+
+// Reading is the slow side of a ShardedCounter: it sums all the slots.
+void BM_ShardedCounterValue(benchmark::State& state) {
+  ShardedCounter counter;
+  counter.Increment();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(counter.Value());
+  }
+}
+BENCHMARK(BM_ShardedCounterValue);
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
+
+BENCHMARK_MAIN();
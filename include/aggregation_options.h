@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef GOOGLE_SERVICE_CONTROL_CLIENT_AGGREGATOR_OPTIONS_H_
 #define GOOGLE_SERVICE_CONTROL_CLIENT_AGGREGATOR_OPTIONS_H_
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <unordered_map>
 #include "google/api/metric.pb.h"
@@ -30,9 +32,23 @@ typedef std::unordered_map<std::string,
                            ::google::api::MetricDescriptor::MetricKind>
     MetricKindMap;
 
+// Hash functions that can be used to generate the request signatures which
+// are used as cache keys.
+enum class SignatureHashType {
+  // MD5 digest. The default, compatible with earlier versions.
+  kMd5,
+  // 128-bit MurmurHash3. Not cryptographic, but several times faster than MD5.
+  // Signatures are only used as in-process cache keys, so this is safe unless
+  // request labels come from untrusted callers able to craft collisions.
+  kMurmur3,
+};
+
 struct QuotaAggregationOptions {
   QuotaAggregationOptions() : num_entries(10000), refresh_interval_ms(1000),
-      expiration_interval_ms(600000){}
+      expiration_interval_ms(600000),
+      signature_hash(SignatureHashType::kMd5),
+      tiny_lfu_admission(false),
+      max_bytes(0) {}
 
   // Constructor.
   // cache_entries is the maximum number of cache entries that can be kept in
@@ -41,10 +57,16 @@ struct QuotaAggregationOptions {
   // request needs to send to remote server again.
   // expiration_interval_ms should be at lease 10 times bigger
   // than the rate limit service's refill time window.
-  QuotaAggregationOptions(int cache_entries, int refresh_interval_ms,
-                          int expiration_interval_ms = 600000)
+  // signature_hash is the hash function used to generate cache keys.
+  QuotaAggregationOptions(
+      int cache_entries, int refresh_interval_ms,
+      int expiration_interval_ms = 600000,
+      SignatureHashType signature_hash = SignatureHashType::kMd5)
       : num_entries(cache_entries), refresh_interval_ms(refresh_interval_ms),
-        expiration_interval_ms(expiration_interval_ms) {}
+        expiration_interval_ms(expiration_interval_ms),
+        signature_hash(signature_hash),
+        tiny_lfu_admission(false),
+        max_bytes(0) {}
 
   // Maximum number of cache entries kept in the aggregation cache.
   // Set to 0 will disable caching and aggregation.
@@ -57,13 +79,38 @@ struct QuotaAggregationOptions {
   // The expiration interval in milliseconds. Cached element will be dropped
   // when the last refresh time is older than expiration_interval_ms
   int expiration_interval_ms;
+
+  // The hash function used to generate request signatures.
+  SignatureHashType signature_hash;
+
+  // If true, a new request is only added to a full cache if it was used more
+  // often recently than the entry it would evict, as estimated by a TinyLFU
+  // frequency sketch. Otherwise it is sent to the server without being
+  // cached. Protects the cached entries from scans of one-off requests.
+  bool tiny_lfu_admission;
+
+  // If > 0, the cache is bounded by the approximate bytes used by its entries
+  // instead of by num_entries, which then only enables the cache.
+  int64_t max_bytes;
 };
 
 // Options controlling check aggregation behavior.
 struct CheckAggregationOptions {
   // Default constructor.
   CheckAggregationOptions()
-      : num_entries(10000), flush_interval_ms(500), expiration_ms(1000) {}
+      : num_entries(10000),
+        flush_interval_ms(500),
+        expiration_ms(1000),
+        num_shards(1),
+        signature_hash(SignatureHashType::kMd5),
+        lock_free_hits(false),
+        max_check_waiters(0),
+        stale_while_revalidate_ms(0),
+        hot_entry_refresh_qps(0),
+        negative_entries(0),
+        negative_expiration_ms(1000),
+        tiny_lfu_admission(false),
+        max_bytes(0) {}
 
   // Constructor.
   // cache_entries is the maximum number of cache entries that can be kept in
@@ -73,12 +120,27 @@ struct CheckAggregationOptions {
   // response_expiration_ms is the maximum milliseconds before a cached check
   // response is invalidated. We make sure that it is at least
   // flush_cache_entry_interval_ms + 1.
-  CheckAggregationOptions(int cache_entries, int flush_cache_entry_interval_ms,
-                          int response_expiration_ms)
+  // cache_shards is the number of independently locked shards the cache is
+  // split into.
+  // signature_hash is the hash function used to generate cache keys.
+  CheckAggregationOptions(
+      int cache_entries, int flush_cache_entry_interval_ms,
+      int response_expiration_ms, int cache_shards = 1,
+      SignatureHashType signature_hash = SignatureHashType::kMd5)
       : num_entries(cache_entries),
         flush_interval_ms(flush_cache_entry_interval_ms),
         expiration_ms(std::max(flush_cache_entry_interval_ms + 1,
-                               response_expiration_ms)) {}
+                               response_expiration_ms)),
+        num_shards(cache_shards),
+        signature_hash(signature_hash),
+        lock_free_hits(false),
+        max_check_waiters(0),
+        stale_while_revalidate_ms(0),
+        hot_entry_refresh_qps(0),
+        negative_entries(0),
+        negative_expiration_ms(1000),
+        tiny_lfu_admission(false),
+        max_bytes(0) {}
 
   // Maximum number of cache entries kept in the aggregation cache.
   // Set to 0 will disable caching and aggregation.
@@ -92,12 +154,81 @@ struct CheckAggregationOptions {
   // deletion is triggered by a timer. This value must be larger than
   // flush_interval_ms.
   const int expiration_ms;
+
+  // Number of shards the cache is split into. Each shard has its own lock and
+  // holds num_entries / num_shards entries, so concurrent Check() calls for
+  // different requests do not contend on a single lock. Values <= 1 use one
+  // shard, which keeps a strict LRU order across all entries.
+  const int num_shards;
+
+  // The hash function used to generate request signatures.
+  const SignatureHashType signature_hash;
+
+  // If true, Check() serves hits on a cached response without taking the
+  // shard lock: entries are looked up in an immutable snapshot of the shard,
+  // requested tokens are summed in per-entry atomic counters, and the LRU
+  // order is only updated approximately, at Flush(), for entries hit since the
+  // previous Flush(). Entries added or removed since the last Flush() are
+  // checked under the shard lock until Flush() publishes a new snapshot of
+  // the shard and frees the removed entries, so this suits workloads where
+  // most checks hit long-lived entries. Can be set after construction.
+  bool lock_free_hits;
+
+  // If positive, concurrent cache misses of the same check request are
+  // coalesced: the first one is sent to the server, and up to
+  // max_check_waiters of the others wait for its response instead of sending
+  // their own. Only cacheable requests, of LOW importance, are coalesced. Set
+  // to 0 will disable coalescing.
+  int max_check_waiters;
+
+  // If positive, a cached passing response is kept up to expiration_ms +
+  // stale_while_revalidate_ms after it was received, even if its entry is
+  // idle. Once it is due for a refresh, Check() still returns it, and the
+  // aggregated request is sent by the flush callback to refresh it in the
+  // background, so no Check() call waits for the server. Denied responses
+  // are refreshed as before. Set to 0 will disable it.
+  int stale_while_revalidate_ms;
+
+  // If positive, Flush() refreshes the passing responses of the entries
+  // checked at least hot_entry_refresh_qps times per second shortly before
+  // they are due for a refresh: their aggregated requests are sent by the
+  // flush callback, so Check() calls on them do not wait for the server.
+  // Flush() is then scheduled every flush_interval_ms / 4. Set to 0 will
+  // disable it.
+  int hot_entry_refresh_qps;
+
+  // If positive, denied responses, with check errors, are kept in a separate
+  // cache of up to negative_entries entries, split into the same shards.
+  // Denials are only admitted to this cache, so they never evict passing
+  // responses; a denial of a request with a cached passing response replaces
+  // it. Cached denials are returned until negative_expiration_ms after they
+  // were received, then the request is sent to the server again; the oldest
+  // denials are evicted first. Set to 0 will keep denials in the main cache.
+  int negative_entries;
+  int negative_expiration_ms;
+
+  // If true, a response is only added to a full cache shard if its request
+  // was checked more often recently than the entry it would evict, as
+  // estimated by a TinyLFU frequency sketch per shard. Protects the cached
+  // entries from scans of one-off requests.
+  bool tiny_lfu_admission;
+
+  // If > 0, the cache is bounded by the approximate bytes used by its entries,
+  // each holding a check response and its aggregated requests, instead of by
+  // num_entries, which then only enables the cache. The shards split
+  // max_bytes evenly. The negative cache is still bounded by negative_entries.
+  int64_t max_bytes;
 };
 
 // Options controlling report aggregation behavior.
 struct ReportAggregationOptions {
   // Default constructor.
-  ReportAggregationOptions() : num_entries(10000), flush_interval_ms(1000) {}
+  ReportAggregationOptions()
+      : num_entries(10000),
+        flush_interval_ms(1000),
+        num_shards(1),
+        signature_hash(SignatureHashType::kMd5),
+        max_bytes(0) {}
 
   // Constructor.
   // cache_entries is the maximum number of cache entries that can be kept in
@@ -105,9 +236,19 @@ struct ReportAggregationOptions {
   // flush_cache_entry_interval_ms is the maximum milliseconds before aggregated
   // report requests are flushed to the server. The cache entry is deleted after
   // the flush.
-  ReportAggregationOptions(int cache_entries, int flush_cache_entry_interval_ms)
+  // cache_shards is the number of independently locked shards the cache is
+  // split into.
+  // signature_hash is the hash function used to generate operation and metric
+  // value signatures.
+  ReportAggregationOptions(
+      int cache_entries, int flush_cache_entry_interval_ms,
+      int cache_shards = 1,
+      SignatureHashType signature_hash = SignatureHashType::kMd5)
       : num_entries(cache_entries),
-        flush_interval_ms(flush_cache_entry_interval_ms) {}
+        flush_interval_ms(flush_cache_entry_interval_ms),
+        num_shards(cache_shards),
+        signature_hash(signature_hash),
+        max_bytes(0) {}
 
   // Maximum number of cache entries kept in the aggregation cache.
   // Set to 0 will disable caching and aggregation.
@@ -116,6 +257,22 @@ struct ReportAggregationOptions {
   // Maximum milliseconds before aggregated report requests are flushed to the
   // server. The flush is triggered by a timer.
   const int flush_interval_ms;
+
+  // Number of shards the cache is split into. Each shard has its own lock,
+  // its own age-based eviction and holds num_entries / num_shards entries.
+  // Operations of one Report() call are merged under a single lock acquisition
+  // per shard, and Flush() drains one shard at a time so request threads
+  // working on other shards are not blocked. Values <= 1 use one shard.
+  const int num_shards;
+
+  // The hash function used to generate operation and metric value signatures.
+  const SignatureHashType signature_hash;
+
+  // If > 0, the cache is bounded by the approximate bytes used by the
+  // aggregated operations, including their log entries, instead of by
+  // num_entries, which then only enables the cache. The shards split
+  // max_bytes evenly. Operations evicted to make room are flushed out.
+  int64_t max_bytes;
 };
 
 }  // namespace service_control_client
@@ -19,7 +19,9 @@ limitations under the License.
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "google/api/servicecontrol/v1/distribution.pb.h"
 #include "google/api/servicecontrol/v1/quota_controller.pb.h"
 #include "google/api/servicecontrol/v1/service_controller.pb.h"
 #include "google/protobuf/stubs/status.h"
@@ -78,7 +80,7 @@ using PeriodicTimerCreateFunc = std::function<std::unique_ptr<PeriodicTimer>(
 // Defines the options to create an instance of ServiceControlClient interface.
 struct ServiceControlClientOptions {
   // Default constructor with default values.
-  ServiceControlClientOptions() {}
+  ServiceControlClientOptions() : record_latencies(false) {}
 
   // Constructor with specified option values.
   ServiceControlClientOptions(const CheckAggregationOptions& check_options,
@@ -86,7 +88,8 @@ struct ServiceControlClientOptions {
                               const ReportAggregationOptions& report_options)
       : check_options(check_options),
         quota_options(quota_options),
-        report_options(report_options) {}
+        report_options(report_options),
+        record_latencies(false) {}
 
   // Check aggregation options.
   CheckAggregationOptions check_options;
@@ -115,6 +118,39 @@ struct ServiceControlClientOptions {
   // expired items. If not provided, the library will create a thread
   // based periodic timer.
   PeriodicTimerCreateFunc periodic_timer;
+
+  // Whether to record the latency distributions returned by
+  // GetDetailedStatistics(). Recording them reads the clock around cache
+  // lookups, transport calls and flushes, and around contended cache locks.
+  bool record_latencies;
+};
+
+// The statistics of the cache of an aggregator. Counters are totals since
+// the client was created.
+struct CacheStatistics {
+  // Calls served by the cache. For reports, operations aggregated into a
+  // cached operation.
+  uint64_t hits;
+  // Calls not found in the cache, which were sent to the server. For reports,
+  // operations cached on their own.
+  uint64_t misses;
+  // Requests sent to refresh a cached passing response, when it was due for
+  // a refresh or hot. Not used by reports.
+  uint64_t refreshes;
+  // Check only. Requests sent to refresh a cached denial.
+  uint64_t negative_refreshes;
+  // Aggregated requests flushed out of removed cache entries. For reports,
+  // the flushed operations.
+  uint64_t flushes;
+  // Entries removed to make room for new ones.
+  uint64_t evictions;
+  // Entries removed once expired.
+  uint64_t expirations;
+  // The current number of entries.
+  uint64_t entries;
+  // The current size of the entries in bytes, if the cache is bounded by
+  // max_bytes. Entries are not measured otherwise, and it is 0.
+  uint64_t bytes;
 };
 
 // The statistics recorded by library.
@@ -132,6 +168,9 @@ struct Statistics {
   uint64_t send_checks_by_flush;
   // Check sends to remote sever during Check() calls.
   uint64_t send_checks_in_flight;
+  // Check() calls completed with the response of an in-flight check of the
+  // same request, instead of sending their own.
+  uint64_t coalesced_checks;
 
   // Total number of Report() calls received.
   uint64_t total_called_reports;
@@ -145,6 +184,36 @@ struct Statistics {
   // send_report_operations / total_called_reports  will reflect report
   // aggregation rate.  send_report_operations may not reflect aggregation rate.
   uint64_t send_report_operations;
+
+  // The statistics of the check, quota and report caches.
+  CacheStatistics check_cache;
+  CacheStatistics quota_cache;
+  CacheStatistics report_cache;
+};
+
+// The latency distributions of one API recorded by library, in microseconds,
+// with exponential buckets starting at 1/64 microsecond so that cache hits
+// are told apart. Batch calls are only recorded in transport, flush and
+// lock_wait.
+struct LatencyStatistics {
+  // Calls served by the cache: checks and quotas answered from it, and
+  // reports aggregated into it. From the call until the cache is done.
+  ::google::api::servicecontrol::v1::Distribution cache_hit;
+  // Requests sent to the server, from the transport call until its on_done
+  // is called.
+  ::google::api::servicecontrol::v1::Distribution transport;
+  // Flushes of the cache by the periodic timer.
+  ::google::api::servicecontrol::v1::Distribution flush;
+  // Waits for contended cache locks. Uncontended locks are not recorded.
+  ::google::api::servicecontrol::v1::Distribution lock_wait;
+};
+
+// The detailed statistics recorded by library. They are empty unless
+// ServiceControlClientOptions::record_latencies is set.
+struct DetailedStatistics {
+  LatencyStatistics check;
+  LatencyStatistics quota;
+  LatencyStatistics report;
 };
 
 // Service control client interface. It is thread safe.
@@ -305,6 +374,66 @@ class ServiceControlClient {
       ::google::api::servicecontrol::v1::CheckResponse* check_response,
       DoneCallback on_check_done, TransportCheckFunc check_transport) = 0;
 
+  // The same async check calls, taking over the check request. On a cache
+  // miss, the request is moved rather than copied to be kept until the
+  // transport is done. The sync call never copies the request.
+  virtual void Check(
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done) = 0;
+
+  virtual void Check(
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport) = 0;
+
+  // The same check calls, returning the check response as an immutable
+  // shared object instead of filling in a caller owned one. A cached response
+  // is shared with the cache rather than copied, and a response received from
+  // the server is shared with the cache in the same way.
+  //
+  // check_response must be alive until on_check_done is called.
+  virtual void Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done) = 0;
+
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response) = 0;
+
+  virtual void Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport) = 0;
+
+  // Checks a batch of requests in one call, e.g. the API key and the project
+  // of one incoming request. Cache hits are resolved in one pass over the
+  // cache, and only the misses are sent to the server, each with its own
+  // transport call. check_responses is resized to the number of requests,
+  // and filled in the same way as the shared response check calls.
+  // This is async call. on_check_done is called once, when all the checks are
+  // finished, with the first failure if any. check_responses must be alive
+  // until then.
+  virtual void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses,
+      DoneCallback on_check_done) = 0;
+
+  // The sync batch check call.
+  virtual ::google::protobuf::util::Status CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses) = 0;
+
   // An async quota call.
   virtual void Quota(
       const ::google::api::servicecontrol::v1::AllocateQuotaRequest&
@@ -328,6 +457,19 @@ class ServiceControlClient {
       ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
       DoneCallback on_quota_done, TransportQuotaFunc quota_transport) = 0;
 
+  // The same async quota calls, taking over the quota request, which is
+  // moved rather than copied on a cache miss. The sync call never copies the
+  // request.
+  virtual void Quota(
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done) = 0;
+
+  virtual void Quota(
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done, TransportQuotaFunc quota_transport) = 0;
+
   // Reports operations to the Controller service for billing, logging,
   // monitoring, etc.
   // High importance operations are sent directly to the server without any
@@ -362,9 +504,29 @@ class ServiceControlClient {
       ::google::api::servicecontrol::v1::ReportResponse* report_response,
       DoneCallback on_report_done, TransportReportFunc report_transport) = 0;
 
+  // Reports a batch of requests in one call. Operations of the whole batch
+  // are aggregated together, taking each cache lock once instead of once per
+  // request. Requests which can not be cached are sent to the server, each
+  // with its own transport call.
+  // This is async call. on_report_done is called once, when all the requests
+  // are finished, with the first failure if any.
+  virtual void ReportBatch(
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          report_requests,
+      DoneCallback on_report_done) = 0;
+
+  // The sync batch report call.
+  virtual ::google::protobuf::util::Status ReportBatch(
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          report_requests) = 0;
+
   // Get statistics.
   virtual ::google::protobuf::util::Status GetStatistics(
       Statistics* stat) const = 0;
+
+  // Get the latency distributions.
+  virtual ::google::protobuf::util::Status GetDetailedStatistics(
+      DetailedStatistics* stat) const = 0;
 };
 
 // Creates a ServiceControlClient object.
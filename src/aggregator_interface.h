@@ -20,15 +20,20 @@ limitations under the License.
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "google/api/servicecontrol/v1/quota_controller.pb.h"
 #include "google/api/servicecontrol/v1/service_controller.pb.h"
 #include "google/protobuf/stubs/status.h"
 #include "include/aggregation_options.h"
+#include "include/service_control_client.h"
+#include "src/signature.h"
 
 namespace google {
 namespace service_control_client {
 
+class LatencyRecorder;
+
 // Aggregate Service_Control Report requests.
 // This interface is thread safe.
 class ReportAggregator {
@@ -37,8 +42,9 @@ class ReportAggregator {
   // If the callback function is blocked, the called member function, such as
   // Report(), will be blocked too. It is recommended that the callback function
   // should be fast and non blocking.
+  // The flushed request is passed as an rvalue: the callback may move it.
   using FlushCallback = std::function<void(
-      const ::google::api::servicecontrol::v1::ReportRequest&)>;
+      ::google::api::servicecontrol::v1::ReportRequest&&)>;
 
   virtual ~ReportAggregator() {}
 
@@ -49,10 +55,23 @@ class ReportAggregator {
   // It will cause dead-lock.
   virtual void SetFlushCallback(FlushCallback callback) = 0;
 
+  // Sets the recorder of the time spent waiting for contended cache locks, or
+  // null not to record it. Must be called before the aggregator is used.
+  virtual void SetLockWaitRecorder(
+      std::shared_ptr<LatencyRecorder> recorder) = 0;
+
   // Adds a report request to cache
   virtual ::google::protobuf::util::Status Report(
       const ::google::api::servicecontrol::v1::ReportRequest& request) = 0;
 
+  // Adds a batch of report requests to cache. Operations of the whole batch
+  // are grouped before any lock is taken, so each cache shard is locked once
+  // per call. statuses[i] is set to what Report(requests[i]) would return.
+  virtual void ReportBatch(
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          requests,
+      std::vector<::google::protobuf::util::Status>* statuses) = 0;
+
   // When the next Flush() should be called.
   // Returns in ms from now, or -1 for never
   virtual int GetNextFlushInterval() = 0;
@@ -65,14 +84,18 @@ class ReportAggregator {
   // Usually called at destructor.
   virtual ::google::protobuf::util::Status FlushAll() = 0;
 
+  // Gets the statistics of the cache.
+  virtual void GetStatistics(CacheStatistics* stat) = 0;
+
  protected:
   ReportAggregator() {}
 };
 
 class QuotaAggregator {
  public:
+  // The flushed request is passed as an rvalue: the callback may move it.
   using FlushCallback = std::function<void(
-      const ::google::api::servicecontrol::v1::AllocateQuotaRequest&)>;
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&&)>;
   virtual ~QuotaAggregator(){};
 
   // Sets the flush callback function.
@@ -82,6 +105,11 @@ class QuotaAggregator {
   // It will cause dead-lock.
   virtual void SetFlushCallback(FlushCallback callback) = 0;
 
+  // Sets the recorder of the time spent waiting for contended cache locks, or
+  // null not to record it. Must be called before the aggregator is used.
+  virtual void SetLockWaitRecorder(
+      std::shared_ptr<LatencyRecorder> recorder) = 0;
+
   // If the quota could not be handled by the cache, returns NOT_FOUND,
   // caller has to send the request to service control.
   // Otherwise, returns OK and cached response.
@@ -107,6 +135,9 @@ class QuotaAggregator {
   // Usually called at destructor.
   virtual ::google::protobuf::util::Status FlushAll() = 0;
 
+  // Gets the statistics of the cache.
+  virtual void GetStatistics(CacheStatistics* stat) = 0;
+
  protected:
   QuotaAggregator() {}
 };
@@ -119,8 +150,9 @@ class CheckAggregator {
   // If the callback function is blocked, the called member function, such as
   // Check(), will be blocked too. It is recommended that the callback function
   // should be fast and non blocking.
+  // The flushed request is passed as an rvalue: the callback may move it.
   using FlushCallback = std::function<void(
-      const ::google::api::servicecontrol::v1::CheckRequest&)>;
+      ::google::api::servicecontrol::v1::CheckRequest&&)>;
 
   virtual ~CheckAggregator() {}
 
@@ -131,6 +163,11 @@ class CheckAggregator {
   // It will cause dead-lock.
   virtual void SetFlushCallback(FlushCallback callback) = 0;
 
+  // Sets the recorder of the time spent waiting for contended cache locks, or
+  // null not to record it. Must be called before the aggregator is used.
+  virtual void SetLockWaitRecorder(
+      std::shared_ptr<LatencyRecorder> recorder) = 0;
+
   // If the check could not be handled by the cache, returns NOT_FOUND,
   // caller has to send the request to service control.
   // Otherwise, returns OK and cached response.
@@ -138,11 +175,66 @@ class CheckAggregator {
       const ::google::api::servicecontrol::v1::CheckRequest& request,
       ::google::api::servicecontrol::v1::CheckResponse* response) = 0;
 
+  // Same as above, but returns the cached response itself, shared with the
+  // cache, instead of a copy.
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          response) = 0;
+
+  // Same as the above two, with the signature of the request already
+  // generated by the caller with CheckAggregationOptions::signature_hash, so
+  // that the request is not hashed again. The signature is only used for
+  // requests of LOW importance.
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const Signature& signature,
+      ::google::api::servicecontrol::v1::CheckResponse* response) = 0;
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const Signature& signature,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          response) = 0;
+
+  // Checks a batch of requests in one pass, locking each cache shard once.
+  // statuses[i] and responses[i] are set to what Check(requests[i]) would
+  // return.
+  virtual void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>* responses,
+      std::vector<::google::protobuf::util::Status>* statuses) = 0;
+
+  // Same as above, with signatures[i] the signature of requests[i], as for
+  // Check().
+  virtual void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          requests,
+      const std::vector<Signature>& signatures,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>* responses,
+      std::vector<::google::protobuf::util::Status>* statuses) = 0;
+
   // Caches a response from a remote Service Controller Check call.
   virtual ::google::protobuf::util::Status CacheResponse(
       const ::google::api::servicecontrol::v1::CheckRequest& request,
       const ::google::api::servicecontrol::v1::CheckResponse& response) = 0;
 
+  // Same as above, but shares the response with the cache instead of copying
+  // it. The response must not be modified afterwards.
+  virtual ::google::protobuf::util::Status CacheResponse(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>
+          response) = 0;
+
+  // Sets the response of a request sent by the flush callback to its cache
+  // entry. Unlike CacheResponse(), it does nothing if the entry is not cached
+  // anymore.
+  virtual ::google::protobuf::util::Status RefreshResponse(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const ::google::api::servicecontrol::v1::CheckResponse& response) = 0;
+
   // When the next Flush() should be called.
   // Returns in ms from now, or -1 for never
   virtual int GetNextFlushInterval() = 0;
@@ -155,6 +247,9 @@ class CheckAggregator {
   // Usually called at destructor.
   virtual ::google::protobuf::util::Status FlushAll() = 0;
 
+  // Gets the statistics of the cache.
+  virtual void GetStatistics(CacheStatistics* stat) = 0;
+
  protected:
   CheckAggregator() {}
 };
@@ -16,6 +16,10 @@ limitations under the License.
 #ifndef GOOGLE_SERVICE_CONTROL_CLIENT_CACHE_REMOVED_ITEMS_HANDLER_H
 #define GOOGLE_SERVICE_CONTROL_CLIENT_CACHE_REMOVED_ITEMS_HANDLER_H
 
+#include <memory>
+#include <vector>
+
+#include "google/protobuf/arena.h"
 #include "src/aggregator_interface.h"
 #include "utils/simple_lru_cache.h"
 #include "utils/simple_lru_cache_inl.h"
@@ -46,6 +50,15 @@ namespace service_control_client {
 // cache_mutex_ lock has to be in between of the instantiation of StackBuffer
 // and the instantiation ofSwapper. All cache operations (which may evict cache
 // items) need to be wrapped by this code pattern.
+//
+// A sharded cache, where each shard has its own lock, can not share the single
+// stack_buffer_ pointer since two threads may hold two different shard locks
+// at the same time. Each shard keeps its own StackBuffer pointer instead:
+//    CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+//    MutexLock lock(shard->mutex);
+//    CheckCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
+//        &shard->stack_buffer, &stack_buffer);
+// and its cache deleter calls AddRemovedItem(shard->stack_buffer, item).
 template <class RequestType>
 class CacheRemovedItemsHandler {
  public:
@@ -54,8 +67,10 @@ class CacheRemovedItemsHandler {
   virtual ~CacheRemovedItemsHandler() {}
 
  protected:
-  // The callback function to flush out cache items.
-  using InternalFlushCallback = std::function<void(const RequestType&)>;
+  class StackBuffer;
+
+  // The callback function to flush out cache items. Items are moved out.
+  using InternalFlushCallback = std::function<void(RequestType&&)>;
 
   // Sets the flush callback function.
   void InternalSetFlushCallback(InternalFlushCallback callback) {
@@ -63,9 +78,15 @@ class CacheRemovedItemsHandler {
     flush_callback_ = callback;
   }
 
-  void AddRemovedItem(const RequestType& item) {
-    if (stack_buffer_) {
-      stack_buffer_->Add(item);
+  void AddRemovedItem(RequestType&& item) {
+    AddRemovedItem(stack_buffer_, std::move(item));
+  }
+
+  // Adds the item to the given stack buffer. Used by sharded caches which
+  // keep one stack buffer pointer per shard.
+  static void AddRemovedItem(StackBuffer* stack_buffer, RequestType&& item) {
+    if (stack_buffer) {
+      stack_buffer->Add(std::move(item));
     }
   }
 
@@ -85,37 +106,64 @@ class CacheRemovedItemsHandler {
     StackBuffer(CacheRemovedItemsHandler* handler) : handler_(handler) {}
 
     virtual ~StackBuffer() {
-      for (const auto& request : items_) {
-        handler_->FlushOut(request);
+      for (RequestType* request : items_) {
+        handler_->FlushOut(std::move(*request));
       }
     }
 
-    void Add(const RequestType& item) {
-      if (items_.empty() ||
-          !handler_->MergeItem(item, &items_[items_.size() - 1])) {
-        items_.push_back(item);
+    void Add(const RequestType& item) { Add(RequestType(item)); }
+
+    void Add(RequestType&& item) {
+      if (items_.empty() || !handler_->MergeItem(item, items_.back())) {
+        // Moving into an arena message would copy it, so items added by
+        // value stay on the heap.
+        heap_items_.emplace_back(new RequestType(std::move(item)));
+        items_.push_back(heap_items_.back().get());
       }
     }
 
+    // Appends an empty item allocated on the arena of this batch, to be
+    // filled in place. The arena is freed at once after the batch is flushed.
+    RequestType* AddNew() {
+      if (!arena_) {
+        arena_.reset(new ::google::protobuf::Arena);
+      }
+      items_.push_back(
+          ::google::protobuf::Arena::CreateMessage<RequestType>(arena_.get()));
+      return items_.back();
+    }
+
+    // Returns the last item, or NULL if there is none. It may still be
+    // amended until the batch is flushed.
+    RequestType* last_item() { return items_.empty() ? NULL : items_.back(); }
+
     // Class Swapper is used to swap stack_buffer_ variable in the
     // CacheRemovedItemsHandle class. It should be used within cache_mutex lock.
     class Swapper final {
      public:
       Swapper(CacheRemovedItemsHandler* handler, StackBuffer* buffer)
-          : handler_(handler) {
-        handler_->stack_buffer_ = buffer;
+          : Swapper(&handler->stack_buffer_, buffer) {}
+
+      // Swaps the given stack buffer pointer, e.g. the one of a cache shard.
+      Swapper(StackBuffer** slot, StackBuffer* buffer) : slot_(slot) {
+        *slot_ = buffer;
       }
 
-      virtual ~Swapper() { handler_->stack_buffer_ = NULL; }
+      virtual ~Swapper() { *slot_ = NULL; }
 
      private:
-      CacheRemovedItemsHandler* handler_;
+      StackBuffer** slot_;
     };
 
    private:
     CacheRemovedItemsHandler* handler_;
-    // A vector to cache store removed items.
-    std::vector<RequestType> items_;
+    // The removed items, in the order they are flushed out.
+    std::vector<RequestType*> items_;
+    // Owns the items added by value.
+    std::vector<std::unique_ptr<RequestType>> heap_items_;
+    // Owns the items added by AddNew(). Only created when needed, as most
+    // batches of the check path are empty.
+    std::unique_ptr<::google::protobuf::Arena> arena_;
   };
 
  private:
@@ -129,10 +177,10 @@ class CacheRemovedItemsHandler {
   // stored. It should only be set and reset by StackBuffer::Swapper.
   StackBuffer* stack_buffer_;
 
-  void FlushOut(const RequestType& request) {
+  void FlushOut(RequestType&& request) {
     MutexLock lock(callback_mutex_);
     if (flush_callback_) {
-      flush_callback_(request);
+      flush_callback_(std::move(request));
     }
   }
 };
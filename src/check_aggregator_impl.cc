@@ -15,30 +15,211 @@ limitations under the License.
 
 #include "src/check_aggregator_impl.h"
 #include "src/signature.h"
+#include "utils/stl_util.h"
+
+#include <limits>
 
 #include "google/protobuf/stubs/logging.h"
 
 using std::string;
 using ::google::api::MetricDescriptor;
+using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::MetricValueSet;
 using ::google::api::servicecontrol::v1::Operation;
 using ::google::api::servicecontrol::v1::CheckRequest;
 using ::google::api::servicecontrol::v1::CheckResponse;
 using ::google::protobuf::util::OkStatus;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::StatusCode;
+using ::google::protobuf::Timestamp;
 using ::google::service_control_client::SimpleCycleTimer;
 
 namespace google {
 namespace service_control_client {
+namespace {
+
+const int64_t kNanosPerSecond = 1000000000;
+
+// Timestamps are kept in atomic counters as nanoseconds.
+int64_t TimestampToNanos(const Timestamp& timestamp) {
+  return timestamp.seconds() * kNanosPerSecond + timestamp.nanos();
+}
+
+Timestamp NanosToTimestamp(int64_t nanos) {
+  Timestamp timestamp;
+  timestamp.set_seconds(nanos / kNanosPerSecond);
+  timestamp.set_nanos(nanos % kNanosPerSecond);
+  return timestamp;
+}
+
+// Lowers the counter to value, if it is larger.
+void AtomicMin(std::atomic<int64_t>* counter, int64_t value) {
+  int64_t current = counter->load(std::memory_order_relaxed);
+  while (value < current &&
+         !counter->compare_exchange_weak(current, value,
+                                         std::memory_order_relaxed)) {
+  }
+}
+
+// Raises the counter to value, if it is smaller.
+void AtomicMax(std::atomic<int64_t>* counter, int64_t value) {
+  int64_t current = counter->load(std::memory_order_relaxed);
+  while (value > current &&
+         !counter->compare_exchange_weak(current, value,
+                                         std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+CheckAggregatorImpl::CacheElem::CacheElem(SharedCheckResponse response,
+                                          const int64_t time,
+                                          const int quota_scale)
+    : check_response_(new SharedCheckResponse(std::move(response))),
+      last_check_time_(time),
+      response_time_(time),
+      quota_scale_(quota_scale),
+      is_flushing_(false),
+      referenced_(false),
+      removed_(false),
+      hits_(0),
+      response_space_used_(0),
+      token_space_used_(0),
+      token_requests_(0),
+      token_start_time_(std::numeric_limits<int64_t>::max()),
+      token_end_time_(std::numeric_limits<int64_t>::min()) {}
 
 void CheckAggregatorImpl::CacheElem::Aggregate(
-    const CheckRequest& request, const MetricKindMap* metric_kinds) {
+    const CheckRequest& request, const MetricKindMap* metric_kinds,
+    SignatureHashType hash_type) {
+  AggregateOperation(request.operation(), metric_kinds, hash_type);
+}
+
+void CheckAggregatorImpl::CacheElem::AggregateOperation(
+    const Operation& operation, const MetricKindMap* metric_kinds,
+    SignatureHashType hash_type) {
   if (operation_aggregator_ == NULL) {
     operation_aggregator_.reset(
-        new OperationAggregator(request.operation(), metric_kinds));
+        new OperationAggregator(operation, metric_kinds, hash_type));
   } else {
-    operation_aggregator_->MergeOperation(request.operation());
+    operation_aggregator_->MergeOperation(operation);
+  }
+}
+
+void CheckAggregatorImpl::CacheElem::EnableTokenCounters(
+    const Operation& operation, const MetricKindMap* metric_kinds) {
+  std::unique_ptr<Operation> token_template(new Operation(operation));
+  token_template->clear_start_time();
+  token_template->clear_end_time();
+  token_template->clear_log_entries();
+  int num_token_counters = 0;
+  for (int i = 0; i < token_template->metric_value_sets_size(); ++i) {
+    MetricValueSet* metric_value_set =
+        token_template->mutable_metric_value_sets(i);
+    if (metric_kinds &&
+        FindWithDefault(*metric_kinds, metric_value_set->metric_name(),
+                        MetricDescriptor::DELTA) != MetricDescriptor::DELTA) {
+      return;
+    }
+    for (int j = 0; j < i; ++j) {
+      // The signature only keeps the last value set of a metric name.
+      if (token_template->metric_value_sets(j).metric_name() ==
+          metric_value_set->metric_name()) {
+        return;
+      }
+    }
+    for (MetricValue& metric_value :
+         *metric_value_set->mutable_metric_values()) {
+      if (metric_value.value_case() != MetricValue::kInt64Value) return;
+      metric_value.clear_start_time();
+      metric_value.clear_end_time();
+      ++num_token_counters;
+    }
+  }
+
+  token_counters_.reset(new std::atomic<int64_t>[num_token_counters]);
+  for (int i = 0; i < num_token_counters; ++i) {
+    token_counters_[i].store(0);
+  }
+  token_template_ = std::move(token_template);
+  token_space_used_ = token_template_->SpaceUsedLong() +
+                      num_token_counters * sizeof(token_counters_[0]);
+}
+
+size_t CheckAggregatorImpl::CacheElem::SpaceUsed() const {
+  size_t size = sizeof(CacheElem) + response_space_used_ + token_space_used_;
+  if (operation_aggregator_) {
+    size += operation_aggregator_->SpaceUsed();
   }
+  return size;
+}
+
+bool CheckAggregatorImpl::CacheElem::AddTokens(const CheckRequest& request) {
+  if (token_template_ == NULL) return false;
+  const Operation& operation = request.operation();
+  if (operation.log_entries_size() > 0 ||
+      operation.metric_value_sets_size() !=
+          token_template_->metric_value_sets_size()) {
+    return false;
+  }
+  // Metric values with times of their own are merged by OperationAggregator.
+  for (int i = 0; i < operation.metric_value_sets_size(); ++i) {
+    const MetricValueSet& metric_value_set = operation.metric_value_sets(i);
+    const MetricValueSet& template_set = token_template_->metric_value_sets(i);
+    if (metric_value_set.metric_name() != template_set.metric_name() ||
+        metric_value_set.metric_values_size() !=
+            template_set.metric_values_size()) {
+      return false;
+    }
+    for (const MetricValue& metric_value : metric_value_set.metric_values()) {
+      if (metric_value.value_case() != MetricValue::kInt64Value ||
+          metric_value.has_start_time() || metric_value.has_end_time()) {
+        return false;
+      }
+    }
+  }
+
+  int counter = 0;
+  for (const MetricValueSet& metric_value_set : operation.metric_value_sets()) {
+    for (const MetricValue& metric_value : metric_value_set.metric_values()) {
+      token_counters_[counter++].fetch_add(metric_value.int64_value(),
+                                           std::memory_order_relaxed);
+    }
+  }
+  if (operation.has_start_time()) {
+    AtomicMin(&token_start_time_, TimestampToNanos(operation.start_time()));
+  }
+  if (operation.has_end_time()) {
+    AtomicMax(&token_end_time_, TimestampToNanos(operation.end_time()));
+  }
+  token_requests_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void CheckAggregatorImpl::CacheElem::MergeTokens(
+    const MetricKindMap* metric_kinds, SignatureHashType hash_type) {
+  if (token_requests_.exchange(0) == 0) return;
+
+  Operation operation(*token_template_);
+  int counter = 0;
+  for (MetricValueSet& metric_value_set :
+       *operation.mutable_metric_value_sets()) {
+    for (MetricValue& metric_value :
+         *metric_value_set.mutable_metric_values()) {
+      metric_value.set_int64_value(token_counters_[counter++].exchange(0));
+    }
+  }
+  int64_t start_time =
+      token_start_time_.exchange(std::numeric_limits<int64_t>::max());
+  if (start_time != std::numeric_limits<int64_t>::max()) {
+    *operation.mutable_start_time() = NanosToTimestamp(start_time);
+  }
+  int64_t end_time =
+      token_end_time_.exchange(std::numeric_limits<int64_t>::min());
+  if (end_time != std::numeric_limits<int64_t>::min()) {
+    *operation.mutable_end_time() = NanosToTimestamp(end_time);
+  }
+  AggregateOperation(operation, metric_kinds, hash_type);
 }
 
 CheckRequest CheckAggregatorImpl::CacheElem::ReturnCheckRequestAndClear(
@@ -48,7 +229,7 @@ CheckRequest CheckAggregatorImpl::CacheElem::ReturnCheckRequestAndClear(
   request.set_service_config_id(service_config_id);
 
   if (operation_aggregator_ != NULL) {
-    *(request.mutable_operation()) = operation_aggregator_->ToOperationProto();
+    operation_aggregator_->MoveToOperationProto(request.mutable_operation());
     operation_aggregator_ = NULL;
   }
   return request;
@@ -65,15 +246,68 @@ CheckAggregatorImpl::CheckAggregatorImpl(
   // Converts flush_interval_ms to Cycle used by SimpleCycleTimer.
   flush_interval_in_cycle_ =
       options_.flush_interval_ms * SimpleCycleTimer::Frequency() / 1000;
+  stale_limit_in_cycle_ = 0;
+  hot_refresh_interval_ms_ = std::max(options_.flush_interval_ms / 4, 1);
+  hot_refresh_interval_in_cycle_ =
+      static_cast<int64_t>(hot_refresh_interval_ms_) *
+      SimpleCycleTimer::Frequency() / 1000;
+  int max_idle_ms = options.expiration_ms;
+  if (options.stale_while_revalidate_ms > 0) {
+    max_idle_ms += options.stale_while_revalidate_ms;
+    stale_limit_in_cycle_ =
+        static_cast<int64_t>(max_idle_ms) * SimpleCycleTimer::Frequency() /
+        1000;
+  }
 
   if (options.num_entries > 0) {
-    cache_.reset(new CheckCache(
-        options.num_entries, std::bind(&CheckAggregatorImpl::OnCacheEntryDelete,
-                                       this, std::placeholders::_1)));
-    cache_->SetMaxIdleSeconds(options.expiration_ms / 1000.0);
+    int num_shards =
+        std::min(std::max(options.num_shards, 1), options.num_entries);
+    // Rounds up so the total capacity is at least num_entries.
+    int shard_entries = (options.num_entries + num_shards - 1) / num_shards;
+    int64_t shard_units = shard_entries;
+    if (options.max_bytes > 0) {
+      shard_units = (options.max_bytes + num_shards - 1) / num_shards;
+    }
+    int negative_shard_entries =
+        (options.negative_entries + num_shards - 1) / num_shards;
+    for (int i = 0; i < num_shards; ++i) {
+      CacheShard* shard = new CacheShard;
+      shard->cache.reset(new CheckCache(
+          shard_units, std::bind(&CheckAggregatorImpl::OnCacheEntryDelete,
+                                   this, shard, std::placeholders::_1)));
+      shard->cache->SetMaxIdleSeconds(max_idle_ms / 1000.0);
+      if (options.tiny_lfu_admission) {
+        shard->sketch.reset(new FrequencySketch(shard_entries));
+      }
+      if (negative_shard_entries > 0) {
+        shard->negative_cache.reset(new NegativeCache(negative_shard_entries));
+        shard->negative_cache->SetAgeBasedEviction(
+            options.negative_expiration_ms / 1000.0);
+      }
+      if (options.lock_free_hits) {
+        shard->snapshot.store(new HitTable);
+      }
+      shards_.emplace_back(shard);
+    }
   }
 }
 
+CheckAggregatorImpl::ShardLock::ShardLock(CheckAggregatorImpl* aggregator,
+                                          CacheShard* shard,
+                                          StackBuffer* stack_buffer)
+    : shard_(shard),
+      lock_(LockAndRecordWait(&shard->mutex,
+                              aggregator->lock_wait_recorder_.get())) {
+  shard_->stack_buffer = stack_buffer;
+}
+
+CheckAggregatorImpl::ShardLock::~ShardLock() { shard_->stack_buffer = NULL; }
+
+CheckAggregatorImpl::CacheShard* CheckAggregatorImpl::GetShard(
+    const Signature& signature) {
+  return shards_[GetSignatureShard(signature, shards_.size())].get();
+}
+
 CheckAggregatorImpl::~CheckAggregatorImpl() {
   // FlushAll() will remove all cache items. For each removed item, it will call
   // flush_callback.  At destructor, it is better not to call the callback.
@@ -86,9 +320,142 @@ void CheckAggregatorImpl::SetFlushCallback(FlushCallback callback) {
   InternalSetFlushCallback(callback);
 }
 
+void CheckAggregatorImpl::SetLockWaitRecorder(
+    std::shared_ptr<LatencyRecorder> recorder) {
+  lock_wait_recorder_ = recorder;
+}
+
+Status CheckAggregatorImpl::Check(const CheckRequest& request,
+                                  CheckResponse* response) {
+  SharedCheckResponse cached_response;
+  Status status = Check(request, &cached_response);
+  if (status.ok()) {
+    // Copies the response after the shard lock has been released.
+    *response = *cached_response;
+  }
+  return status;
+}
+
 // Add a check request to cache
 Status CheckAggregatorImpl::Check(const CheckRequest& request,
+                                  SharedCheckResponse* response) {
+  Status status = CheckCacheable(request);
+  if (!status.ok()) {
+    return status;
+  }
+  return CheckSigned(
+      request, GenerateCheckRequestSignature(request, options_.signature_hash),
+      response);
+}
+
+Status CheckAggregatorImpl::Check(const CheckRequest& request,
+                                  const Signature& signature,
                                   CheckResponse* response) {
+  SharedCheckResponse cached_response;
+  Status status = Check(request, signature, &cached_response);
+  if (status.ok()) {
+    *response = *cached_response;
+  }
+  return status;
+}
+
+Status CheckAggregatorImpl::Check(const CheckRequest& request,
+                                  const Signature& signature,
+                                  SharedCheckResponse* response) {
+  Status status = CheckCacheable(request);
+  if (!status.ok()) {
+    return status;
+  }
+  return CheckSigned(request, signature, response);
+}
+
+Status CheckAggregatorImpl::CheckSigned(const CheckRequest& request,
+                                        const Signature& request_signature,
+                                        SharedCheckResponse* response) {
+  CacheShard* shard = GetShard(request_signature);
+
+  if (options_.lock_free_hits) {
+    Status status = OkStatus();
+    if (CheckLockFree(shard, request_signature, request, response, &status)) {
+      return status;
+    }
+  }
+
+  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+  ShardLock lock(this, shard, &stack_buffer);
+  return CheckLocked(shard, request_signature, request, response);
+}
+
+void CheckAggregatorImpl::CheckBatch(
+    const std::vector<CheckRequest>& requests,
+    std::vector<SharedCheckResponse>* responses,
+    std::vector<Status>* statuses) {
+  CheckBatchSigned(requests, nullptr, responses, statuses);
+}
+
+void CheckAggregatorImpl::CheckBatch(
+    const std::vector<CheckRequest>& requests,
+    const std::vector<Signature>& signatures,
+    std::vector<SharedCheckResponse>* responses,
+    std::vector<Status>* statuses) {
+  CheckBatchSigned(requests, &signatures, responses, statuses);
+}
+
+void CheckAggregatorImpl::CheckBatchSigned(
+    const std::vector<CheckRequest>& requests,
+    const std::vector<Signature>* signatures,
+    std::vector<SharedCheckResponse>* responses,
+    std::vector<Status>* statuses) {
+  responses->assign(requests.size(), nullptr);
+  statuses->assign(requests.size(), OkStatus());
+
+  // Signatures are computed and lock-free hits are served before taking any
+  // lock. The remaining checks are grouped by shard so each shard is locked
+  // once per call.
+  struct ShardCheck {
+    size_t shard;
+    Signature signature;
+    size_t index;
+  };
+  std::vector<ShardCheck> shard_checks;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    Status& status = (*statuses)[i];
+    status = CheckCacheable(requests[i]);
+    if (!status.ok()) continue;
+
+    Signature signature =
+        signatures ? (*signatures)[i]
+                   : GenerateCheckRequestSignature(requests[i],
+                                                   options_.signature_hash);
+    size_t shard = GetSignatureShard(signature, shards_.size());
+    if (options_.lock_free_hits &&
+        CheckLockFree(shards_[shard].get(), signature, requests[i],
+                      &(*responses)[i], &status)) {
+      continue;
+    }
+    shard_checks.push_back({shard, signature, i});
+  }
+  std::stable_sort(shard_checks.begin(), shard_checks.end(),
+                   [](const ShardCheck& a, const ShardCheck& b) {
+                     return a.shard < b.shard;
+                   });
+
+  // Removed items are flushed out after all shard locks are released.
+  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+  auto it = shard_checks.begin();
+  while (it != shard_checks.end()) {
+    CacheShard* shard = shards_[it->shard].get();
+    ShardLock lock(this, shard, &stack_buffer);
+    const size_t shard_index = it->shard;
+    for (; it != shard_checks.end() && it->shard == shard_index; ++it) {
+      (*statuses)[it->index] =
+          CheckLocked(shard, it->signature, requests[it->index],
+                      &(*responses)[it->index]);
+    }
+  }
+}
+
+Status CheckAggregatorImpl::CheckCacheable(const CheckRequest& request) {
   if (request.service_name() != service_name_) {
     return Status(StatusCode::kInvalidArgument,
                   (string("Invalid service name: ") + request.service_name() +
@@ -97,25 +464,34 @@ Status CheckAggregatorImpl::Check(const CheckRequest& request,
   if (!request.has_operation()) {
     return Status(StatusCode::kInvalidArgument, "operation field is required.");
   }
-  if (request.operation().importance() != Operation::LOW || !cache_) {
+  if (request.operation().importance() != Operation::LOW || shards_.empty()) {
     // By returning NO_FOUND, caller will send request to server.
     return Status(StatusCode::kNotFound, "");
   }
+  return OkStatus();
+}
 
-  string request_signature = GenerateCheckRequestSignature(request);
-
-  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  CheckCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                              &stack_buffer);
-
-  CheckCache::ScopedLookup lookup(cache_.get(), request_signature);
+Status CheckAggregatorImpl::CheckLocked(CacheShard* shard,
+                                        const Signature& request_signature,
+                                        const CheckRequest& request,
+                                        SharedCheckResponse* response) {
+  CheckCache::ScopedLookup lookup(shard->cache.get(), request_signature);
   if (!lookup.Found()) {
+    if (shard->negative_cache) {
+      return CheckNegative(shard, request_signature, response);
+    }
+    misses_.Increment();
     // By returning NO_FOUND, caller will send request to server.
     return Status(StatusCode::kNotFound, "");
   }
 
   CacheElem* elem = lookup.value();
+  if (options_.hot_entry_refresh_qps > 0) {
+    elem->add_hit();
+  }
+  if (shard->sketch) {
+    shard->sketch->Increment(request_signature.hash());
+  }
 
   // If the cached check response has check errors, then we assume the new
   // request should fail as well and return the cached check response.
@@ -127,34 +503,47 @@ Status CheckAggregatorImpl::Check(const CheckRequest& request,
   // updating the quota info to be the same as requested. The requested tokens
   // are aggregated until flushed.
   // More details can be found in design doc go/simple-chemist-client.
-  if (elem->check_response().check_errors_size() > 0) {
-    if (ShouldFlush(*elem)) {
+  if (elem->check_response()->check_errors_size() > 0) {
+    // Setting last check to now to block more check requests to Chemist.
+    if (StartFlush(elem)) {
+      negative_refreshes_.Increment();
       // Pretend that we did not find, so we can force it into a check request
       // to the server.
       //
-      // Setting last check to now to block more check requests to Chemist.
-      elem->set_last_check_time(SimpleCycleTimer::Now());
       // By returning NO_FOUND, caller will send request to server.
       return Status(StatusCode::kNotFound, "");
     } else {
       // Use cached response.
+      hits_.Increment();
       *response = elem->check_response();
       return OkStatus();
     }
   } else {
-    elem->Aggregate(request, metric_kinds_.get());
+    elem->Aggregate(request, metric_kinds_.get(), options_.signature_hash);
+    if (options_.max_bytes > 0) {
+      shard->cache->UpdateSize(request_signature, elem, elem->SpaceUsed());
+    }
 
-    if (ShouldFlush(*elem)) {
+    // Setting last check to now to block more check requests to Chemist.
+    if (StartFlush(elem)) {
       if (elem->is_flushing()) {
         GOOGLE_LOG(WARNING) << "Last refresh request was not completed yet.";
       }
       elem->set_is_flushing(true);
-      // Setting last check to now to block more check requests to Chemist.
-      elem->set_last_check_time(SimpleCycleTimer::Now());
-      // By returning NO_FOUND, caller will send request to server.
-      return Status(StatusCode::kNotFound, "");
+      refreshes_.Increment();
+      if (!CanServeStale(*elem)) {
+        // By returning NO_FOUND, caller will send request to server.
+        return Status(StatusCode::kNotFound, "");
+      }
+      // Returns the cached response, and sends the aggregated request,
+      // including this one, to refresh it. The tokens in the token counters
+      // of lock-free mode are left for a later flush.
+      AddRemovedItem(shard->stack_buffer,
+                     elem->ReturnCheckRequestAndClear(service_name_,
+                                                      service_config_id_));
     }
 
+    hits_.Increment();
     *response = elem->check_response();
   }
   // TODO(qiwzhang): supports quota
@@ -163,6 +552,77 @@ Status CheckAggregatorImpl::Check(const CheckRequest& request,
   return OkStatus();
 }
 
+bool CheckAggregatorImpl::CheckLockFree(CacheShard* shard,
+                                        const Signature& signature,
+                                        const CheckRequest& request,
+                                        SharedCheckResponse* response,
+                                        Status* status) {
+  ReadCopyUpdate::ReadSection read_section(&rcu_);
+  const HitTable* snapshot = shard->snapshot.load(std::memory_order_acquire);
+  auto it = snapshot->find(signature);
+  if (it == snapshot->end()) {
+    // The entry may have been added since the snapshot was published.
+    if (shard->snapshot_stale.load(std::memory_order_acquire)) return false;
+    if (shard->negative_cache) {
+      *status = CheckNegative(shard, signature, response);
+      return true;
+    }
+    misses_.Increment();
+    // By returning NO_FOUND, caller will send request to server.
+    *status = Status(StatusCode::kNotFound, "");
+    return true;
+  }
+  CacheElem* elem = it->second;
+  if (elem->removed()) return false;
+
+  // Same as the locked path in Check(), except that the tokens are summed in
+  // the token counters and the LRU order is updated at the next Flush().
+  const SharedCheckResponse& check_response = elem->check_response();
+  if (check_response->check_errors_size() == 0) {
+    // A background refresh is started on the locked path.
+    if (stale_limit_in_cycle_ > 0 && ShouldFlush(*elem)) return false;
+    if (!elem->AddTokens(request)) return false;
+  }
+  elem->set_referenced();
+  if (options_.hot_entry_refresh_qps > 0) {
+    elem->add_hit();
+  }
+
+  if (StartFlush(elem)) {
+    if (check_response->check_errors_size() == 0) {
+      if (elem->is_flushing()) {
+        GOOGLE_LOG(WARNING) << "Last refresh request was not completed yet.";
+      }
+      elem->set_is_flushing(true);
+      refreshes_.Increment();
+    } else {
+      negative_refreshes_.Increment();
+    }
+    // By returning NO_FOUND, caller will send request to server.
+    *status = Status(StatusCode::kNotFound, "");
+    return true;
+  }
+  hits_.Increment();
+  *response = check_response;
+  *status = OkStatus();
+  return true;
+}
+
+Status CheckAggregatorImpl::CheckNegative(CacheShard* shard,
+                                          const Signature& signature,
+                                          SharedCheckResponse* response) {
+  MutexLock lock(shard->negative_mutex);
+  NegativeCache::ScopedLookup lookup(shard->negative_cache.get(), signature);
+  if (!lookup.Found()) {
+    misses_.Increment();
+    // By returning NO_FOUND, caller will send request to server.
+    return Status(StatusCode::kNotFound, "");
+  }
+  hits_.Increment();
+  *response = *lookup.value();
+  return OkStatus();
+}
+
 bool CheckAggregatorImpl::ShouldFlush(const CacheElem& elem) {
   int64_t age = SimpleCycleTimer::Now() - elem.last_check_time();
   // TODO(chengliang): consider accumulated tokens as well. If the
@@ -174,15 +634,91 @@ bool CheckAggregatorImpl::ShouldFlush(const CacheElem& elem) {
   return age >= flush_interval_in_cycle_;
 }
 
+bool CheckAggregatorImpl::StartFlush(CacheElem* elem) {
+  int64_t last_check_time = elem->last_check_time();
+  if (!ShouldFlush(*elem)) return false;
+  return elem->compare_and_set_last_check_time(last_check_time,
+                                               SimpleCycleTimer::Now());
+}
+
+bool CheckAggregatorImpl::Admit(CacheShard* shard, const Signature& signature,
+                                size_t units) {
+  if (!shard->sketch) return true;
+  shard->sketch->Increment(signature.hash());
+  Signature victim;
+  return !shard->cache->EvictionCandidate(units, &victim) ||
+         shard->sketch->Admit(signature.hash(), victim.hash());
+}
+
+size_t CheckAggregatorImpl::EntryUnits(const CacheElem& elem) const {
+  return options_.max_bytes > 0 ? elem.SpaceUsed() : 1;
+}
+
+bool CheckAggregatorImpl::CanServeStale(const CacheElem& elem) {
+  return stale_limit_in_cycle_ > 0 &&
+         SimpleCycleTimer::Now() - elem.response_time() < stale_limit_in_cycle_;
+}
+
+void CheckAggregatorImpl::SetCheckResponse(CacheShard* shard, CacheElem* elem,
+                                           SharedCheckResponse response) {
+  const SharedCheckResponse* old_response =
+      elem->swap_check_response(std::move(response));
+  if (options_.lock_free_hits) {
+    shard->retired.responses.push_back(old_response);
+  } else {
+    delete old_response;
+  }
+}
+
 Status CheckAggregatorImpl::CacheResponse(const CheckRequest& request,
                                           const CheckResponse& response) {
-  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  CheckCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                              &stack_buffer);
-  if (cache_) {
-    string request_signature = GenerateCheckRequestSignature(request);
-    CheckCache::ScopedLookup lookup(cache_.get(), request_signature);
+  if (shards_.empty()) return OkStatus();
+  return CacheResponse(request, std::make_shared<CheckResponse>(response));
+}
+
+Status CheckAggregatorImpl::CacheResponse(const CheckRequest& request,
+                                          SharedCheckResponse response) {
+  return SetResponse(request, std::move(response), true);
+}
+
+Status CheckAggregatorImpl::RefreshResponse(const CheckRequest& request,
+                                            const CheckResponse& response) {
+  if (shards_.empty()) return OkStatus();
+  return SetResponse(request, std::make_shared<CheckResponse>(response), false);
+}
+
+Status CheckAggregatorImpl::SetResponse(const CheckRequest& request,
+                                        SharedCheckResponse response,
+                                        bool insert) {
+  if (!shards_.empty()) {
+    Signature request_signature =
+        GenerateCheckRequestSignature(request, options_.signature_hash);
+    CacheShard* shard = GetShard(request_signature);
+    // Measured before taking the lock.
+    size_t response_space_used =
+        options_.max_bytes > 0 ? response->SpaceUsedLong() : 0;
+
+    CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+    ShardLock lock(this, shard, &stack_buffer);
+
+    if (shard->negative_cache) {
+      MutexLock negative_lock(shard->negative_mutex);
+      if (response->check_errors_size() > 0) {
+        // A denial replaces the passing response of the request, if any. Its
+        // aggregated request is flushed out.
+        if (insert || shard->cache->StillInUse(request_signature) ||
+            shard->negative_cache->StillInUse(request_signature)) {
+          shard->cache->Remove(request_signature);
+          shard->negative_cache->Insert(
+              request_signature, new SharedCheckResponse(std::move(response)),
+              1);
+        }
+        return OkStatus();
+      }
+      shard->negative_cache->Remove(request_signature);
+    }
+
+    CheckCache::ScopedLookup lookup(shard->cache.get(), request_signature);
 
     int64_t now = SimpleCycleTimer::Now();
     // TODO(qiwzhang): supports quota
@@ -190,12 +726,30 @@ Status CheckAggregatorImpl::CacheResponse(const CheckRequest& request,
     int quota_scale = 0;
     if (lookup.Found()) {
       lookup.value()->set_last_check_time(now);
-      lookup.value()->set_check_response(response);
+      lookup.value()->set_response_time(now);
+      SetCheckResponse(shard, lookup.value(), std::move(response));
       lookup.value()->set_quota_scale(quota_scale);
       lookup.value()->set_is_flushing(false);
-    } else {
-      CacheElem* cache_elem = new CacheElem(response, now, quota_scale);
-      cache_->Insert(request_signature, cache_elem, 1);
+      if (options_.max_bytes > 0) {
+        lookup.value()->set_response_space_used(response_space_used);
+        shard->cache->UpdateSize(request_signature, lookup.value(),
+                                 lookup.value()->SpaceUsed());
+      }
+    } else if (insert) {
+      std::unique_ptr<CacheElem> cache_elem(
+          new CacheElem(std::move(response), now, quota_scale));
+      cache_elem->set_response_space_used(response_space_used);
+      if (options_.lock_free_hits) {
+        cache_elem->EnableTokenCounters(request.operation(),
+                                        metric_kinds_.get());
+      }
+      size_t units = EntryUnits(*cache_elem);
+      if (Admit(shard, request_signature, units)) {
+        if (options_.lock_free_hits) {
+          shard->snapshot_stale.store(true, std::memory_order_release);
+        }
+        shard->cache->Insert(request_signature, cache_elem.release(), units);
+      }
     }
   }
 
@@ -205,50 +759,220 @@ Status CheckAggregatorImpl::CacheResponse(const CheckRequest& request,
 // When the next Flush() should be called.
 // Flush() call remove expired response.
 int CheckAggregatorImpl::GetNextFlushInterval() {
-  if (!cache_) return -1;
+  if (shards_.empty()) return -1;
+  if (options_.hot_entry_refresh_qps > 0) {
+    return std::min(options_.expiration_ms, hot_refresh_interval_ms_);
+  }
   return options_.expiration_ms;
 }
 
 // Flush aggregated requests whom are longer than flush_interval.
 // Called at time specified by GetNextFlushInterval().
+// Each shard is locked on its own, so Check() calls on other shards are not
+// blocked while one shard is being flushed.
 Status CheckAggregatorImpl::Flush() {
-  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  CheckCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                              &stack_buffer);
-  if (cache_) {
-    cache_->RemoveExpiredEntries();
+  RetiredObjects retired;
+  for (const auto& shard : shards_) {
+    CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+    ShardLock lock(this, shard.get(), &stack_buffer);
+    if (options_.lock_free_hits) {
+      TouchReferencedEntries(shard.get());
+    }
+    if (options_.hot_entry_refresh_qps > 0) {
+      RefreshHotEntries(shard.get());
+    }
+    shard->cache->RemoveExpiredEntries();
+    if (shard->negative_cache) {
+      MutexLock negative_lock(shard->negative_mutex);
+      shard->negative_cache->RemoveExpiredEntries();
+    }
+    if (options_.lock_free_hits) {
+      PublishSnapshot(shard.get(), &retired);
+    }
   }
 
+  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+  Reclaim(&retired, &stack_buffer);
   return OkStatus();
 }
 
-void CheckAggregatorImpl::OnCacheEntryDelete(CacheElem* elem) {
-  if (!elem->HasPendingCheckRequest()) {
+// Copying the shard is O(entries), so it is only done here, from Flush() and
+// FlushAll(), rather than on every Check() or CacheResponse() call.
+void CheckAggregatorImpl::PublishSnapshot(CacheShard* shard,
+                                          RetiredObjects* retired) {
+  if (shard->snapshot_stale.load(std::memory_order_relaxed)) {
+    HitTable* snapshot = new HitTable;
+    snapshot->resize(shard->cache->Entries());
+    for (auto it = shard->cache->begin(); it != shard->cache->end(); ++it) {
+      (*snapshot)[it->first] = it->second;
+    }
+    retired->snapshots.push_back(shard->snapshot.exchange(snapshot));
+    shard->snapshot_stale.store(false, std::memory_order_release);
+  }
+  retired->elems.insert(retired->elems.end(), shard->retired.elems.begin(),
+                        shard->retired.elems.end());
+  shard->retired.elems.clear();
+  retired->responses.insert(retired->responses.end(),
+                            shard->retired.responses.begin(),
+                            shard->retired.responses.end());
+  shard->retired.responses.clear();
+}
+
+void CheckAggregatorImpl::Reclaim(RetiredObjects* retired,
+                                  StackBuffer* stack_buffer) {
+  if (retired->snapshots.empty() && retired->elems.empty() &&
+      retired->responses.empty()) {
+    return;
+  }
+  // Lock-free readers may have loaded an old snapshot, or an entry or a
+  // response from it, before they were replaced.
+  rcu_.Synchronize();
+  for (const HitTable* snapshot : retired->snapshots) {
+    delete snapshot;
+  }
+  for (const SharedCheckResponse* response : retired->responses) {
+    delete response;
+  }
+  for (CacheElem* elem : retired->elems) {
+    FlushOutCacheElem(elem, stack_buffer);
     delete elem;
+  }
+  retired->snapshots.clear();
+  retired->elems.clear();
+  retired->responses.clear();
+}
+
+// Lock-free hits only set the referenced bit of their entry, like a CLOCK
+// cache. Touching these entries here approximates the LRU order: an entry hit
+// between two Flush() calls is treated as used at the second one.
+void CheckAggregatorImpl::TouchReferencedEntries(CacheShard* shard) {
+  std::vector<Signature> referenced;
+  for (auto it = shard->cache->begin(); it != shard->cache->end(); ++it) {
+    if (it->second->clear_referenced()) {
+      referenced.push_back(it->first);
+      if (shard->sketch) {
+        shard->sketch->Increment(it->first.hash());
+      }
+    }
+  }
+  // Touch() does not remove expired entries, so the cache is not modified
+  // before all referenced entries are touched.
+  for (const Signature& signature : referenced) {
+    shard->cache->Touch(signature);
+  }
+}
+
+void CheckAggregatorImpl::RefreshHotEntries(CacheShard* shard) {
+  int64_t now = SimpleCycleTimer::Now();
+  // An entry is hot if it had at least min_hits since the last call.
+  double min_hits = static_cast<double>(options_.hot_entry_refresh_qps) *
+                    (now - shard->last_refresh_time) /
+                    SimpleCycleTimer::Frequency();
+  shard->last_refresh_time = now;
+  int64_t refresh_age =
+      flush_interval_in_cycle_ - hot_refresh_interval_in_cycle_;
+
+  for (auto it = shard->cache->begin(); it != shard->cache->end(); ++it) {
+    CacheElem* elem = it->second;
+    int64_t hits = elem->clear_hits();
+    if (hits == 0 || hits < min_hits ||
+        elem->check_response()->check_errors_size() > 0) {
+      continue;
+    }
+    int64_t last_check_time = elem->last_check_time();
+    if (now - last_check_time < refresh_age) continue;
+    // An entry with nothing aggregated sends no refresh, so its refresh clock
+    // is left alone.
+    elem->MergeTokens(metric_kinds_.get(), options_.signature_hash);
+    if (!elem->HasPendingCheckRequest()) continue;
+    // Like StartFlush(), keeps Check() calls from starting another refresh.
+    if (!elem->compare_and_set_last_check_time(last_check_time, now)) {
+      continue;
+    }
+    elem->set_is_flushing(true);
+    refreshes_.Increment();
+    AddRemovedItem(shard->stack_buffer,
+                   elem->ReturnCheckRequestAndClear(service_name_,
+                                                    service_config_id_));
+  }
+}
+
+void CheckAggregatorImpl::OnCacheEntryDelete(CacheShard* shard,
+                                             CacheElem* elem) {
+  if (options_.lock_free_hits) {
+    // Lock-free readers may still use the elem until the next Flush(), and
+    // add tokens to it before they see it is removed. Reclaim() flushes out
+    // these tokens.
+    elem->set_removed();
+    FlushOutCacheElem(elem, shard->stack_buffer);
+    shard->retired.elems.push_back(elem);
+    shard->snapshot_stale.store(true, std::memory_order_release);
     return;
   }
+  FlushOutCacheElem(elem, shard->stack_buffer);
+  delete elem;
+}
+
+void CheckAggregatorImpl::FlushOutCacheElem(CacheElem* elem,
+                                            StackBuffer* stack_buffer) {
+  elem->MergeTokens(metric_kinds_.get(), options_.signature_hash);
+  if (!elem->HasPendingCheckRequest()) return;
 
   CheckRequest request;
   request = elem->ReturnCheckRequestAndClear(service_name_, service_config_id_);
-  AddRemovedItem(request);
-  delete elem;
+  AddRemovedItem(stack_buffer, std::move(request));
+  flushes_.Increment();
 }
 
 // Flush out aggregated check requests, clear all cache items.
 // Usually called at destructor.
 Status CheckAggregatorImpl::FlushAll() {
-  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  CheckCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                              &stack_buffer);
-  if (cache_) {
-    cache_->RemoveAll();
+  RetiredObjects retired;
+  for (const auto& shard : shards_) {
+    CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+    ShardLock lock(this, shard.get(), &stack_buffer);
+    shard->cache->RemoveAll();
+    if (shard->negative_cache) {
+      MutexLock negative_lock(shard->negative_mutex);
+      shard->negative_cache->RemoveAll();
+    }
+    if (options_.lock_free_hits) {
+      PublishSnapshot(shard.get(), &retired);
+    }
   }
 
+  CheckCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+  Reclaim(&retired, &stack_buffer);
   return OkStatus();
 }
 
+void CheckAggregatorImpl::GetStatistics(CacheStatistics* stat) {
+  stat->hits = hits_.Value();
+  stat->misses = misses_.Value();
+  stat->refreshes = refreshes_.Value();
+  stat->negative_refreshes = negative_refreshes_.Value();
+  stat->flushes = flushes_.Value();
+  stat->evictions = 0;
+  stat->expirations = 0;
+  stat->entries = 0;
+  stat->bytes = 0;
+  for (const auto& shard : shards_) {
+    MutexLock lock(shard->mutex);
+    stat->evictions += shard->cache->Evictions();
+    stat->expirations += shard->cache->Expirations();
+    stat->entries += shard->cache->Entries();
+    if (options_.max_bytes > 0) {
+      stat->bytes += shard->cache->Size();
+    }
+    if (shard->negative_cache) {
+      MutexLock negative_lock(shard->negative_mutex);
+      stat->evictions += shard->negative_cache->Evictions();
+      stat->expirations += shard->negative_cache->Expirations();
+      stat->entries += shard->negative_cache->Entries();
+    }
+  }
+}
+
 std::unique_ptr<CheckAggregator> CreateCheckAggregator(
     const std::string& service_name, const std::string& service_config_id,
     const CheckAggregationOptions& options,
@@ -18,9 +18,11 @@ limitations under the License.
 #ifndef GOOGLE_SERVICE_CONTROL_CLIENT_CHECK_AGGREGATOR_IMPL_H_
 #define GOOGLE_SERVICE_CONTROL_CLIENT_CHECK_AGGREGATOR_IMPL_H_
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "google/api/metric.pb.h"
 #include "google/api/servicecontrol/v1/operation.pb.h"
@@ -28,6 +30,12 @@ limitations under the License.
 #include "src/aggregator_interface.h"
 #include "src/cache_removed_items_handler.h"
 #include "src/operation_aggregator.h"
+#include "src/signature.h"
+#include "utils/flat_hash_map.h"
+#include "utils/frequency_sketch.h"
+#include "utils/latency_recorder.h"
+#include "utils/read_copy_update.h"
+#include "utils/sharded_counter.h"
 #include "utils/simple_lru_cache.h"
 #include "utils/simple_lru_cache_inl.h"
 #include "utils/thread.h"
@@ -66,6 +74,36 @@ namespace service_control_client {
 //    it will NOT have aggregated data when that entry is removed. It will not
 //    send to flush_callback(). The item simply just got deleted.
 //
+// With CheckAggregationOptions::stale_while_revalidate_ms, refreshes a cached
+// passing response in the background:
+// 1) Calls Check(), found a cached passing response,
+// 2) If it passes refresh_interval, Check() still returns it, and the
+//    aggregated request is sent by flush_callback.
+// 3) flush_callback sets the new response by calling RefreshResponse().
+// 4) If the response is older than expiration + stale_while_revalidate_ms,
+//    because the refresh failed or the entry was idle, Check() returns
+//    NOT_FOUND as for a new entry.
+//
+// With CheckAggregationOptions::hot_entry_refresh_qps, Flush() also refreshes
+// the passing responses of frequently checked entries which are about to
+// pass refresh_interval, by sending their aggregated requests to
+// flush_callback, which sets the new responses by calling RefreshResponse().
+//
+// With CheckAggregationOptions::negative_entries, denied responses are kept in
+// a separate cache per shard, with its own mutex, and are not refreshed: a
+// Check() call missing the main cache returns the denial from this cache
+// until it expires, then returns NOT_FOUND.
+//
+// With CheckAggregationOptions::lock_free_hits, a Check() call that finds a
+// cached response reads it from an immutable snapshot of its cache shard,
+// protected by read-copy-update, without taking the shard lock. Its tokens are
+// summed in atomic counters of the cache entry. Calls that add or remove cache
+// entries still lock the shard, but do not copy it: Flush() publishes a new
+// snapshot of each changed shard, then frees the removed entries and replaced
+// responses once no lock-free Check() can use them anymore. Until then, a
+// Check() call for an entry added or removed since the last Flush() takes the
+// locked path.
+//
 // Object life management:
 // The callers of this object needs to make sure the object is still valid
 // before calling its methods. Specifically, callers may use async
@@ -97,6 +135,9 @@ class CheckAggregatorImpl : public CheckAggregator,
   // calls CacheResponse() to set its response.
   virtual void SetFlushCallback(FlushCallback callback);
 
+  // Sets the recorder of the time spent waiting for contended shard locks.
+  virtual void SetLockWaitRecorder(std::shared_ptr<LatencyRecorder> recorder);
+
   // If the check could not be handled by the cache, returns NOT_FOUND,
   // caller has to send the request to service control server and call
   // CacheResponse() to set the response to the cache.
@@ -105,11 +146,56 @@ class CheckAggregatorImpl : public CheckAggregator,
       const ::google::api::servicecontrol::v1::CheckRequest& request,
       ::google::api::servicecontrol::v1::CheckResponse* response);
 
+  // Same as above, but returns the cached response without copying it.
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          response);
+
+  // Same as the above two, with the signature generated by the caller.
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const Signature& signature,
+      ::google::api::servicecontrol::v1::CheckResponse* response);
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const Signature& signature,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          response);
+
+  // Checks a batch of requests, locking each shard once.
+  virtual void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>* responses,
+      std::vector<::google::protobuf::util::Status>* statuses);
+
+  // Same as above, with the signatures generated by the caller.
+  virtual void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          requests,
+      const std::vector<Signature>& signatures,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>* responses,
+      std::vector<::google::protobuf::util::Status>* statuses);
+
   // Caches a response from a remote Service Controller Check call.
   virtual ::google::protobuf::util::Status CacheResponse(
       const ::google::api::servicecontrol::v1::CheckRequest& request,
       const ::google::api::servicecontrol::v1::CheckResponse& response);
 
+  // Same as above, but shares the response instead of copying it.
+  virtual ::google::protobuf::util::Status CacheResponse(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>
+          response);
+
+  // Sets the response of a flushed request, if its entry is still cached.
+  virtual ::google::protobuf::util::Status RefreshResponse(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const ::google::api::servicecontrol::v1::CheckResponse& response);
+
   // When the next Flush() should be called.
   // Returns in ms from now, or -1 for never
   virtual int GetNextFlushInterval();
@@ -121,22 +207,50 @@ class CheckAggregatorImpl : public CheckAggregator,
   // Flushes out all cache items. Usually called at destructor.
   virtual ::google::protobuf::util::Status FlushAll();
 
+  // Gets the statistics of the cache.
+  virtual void GetStatistics(CacheStatistics* stat);
+
  private:
+  // A cached check response, shared with the callers of Check().
+  using SharedCheckResponse =
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>;
+
   // Cache entry for aggregated check requests and previous check response.
+  //
+  // In lock-free mode, the check response, last check time, flushing flag,
+  // referenced bit and token counters are read and updated without the shard
+  // lock. All other members are guarded by the shard lock.
   class CacheElem {
    public:
-    CacheElem(const ::google::api::servicecontrol::v1::CheckResponse& response,
-              const int64_t time, const int quota_scale)
-        : check_response_(response),
-          last_check_time_(time),
-          quota_scale_(quota_scale),
-          is_flushing_(false) {}
+    CacheElem(SharedCheckResponse response, const int64_t time,
+              const int quota_scale);
+
+    ~CacheElem() { delete check_response_.load(); }
 
     // Aggregates the given request to this cache entry.
     void Aggregate(
         const ::google::api::servicecontrol::v1::CheckRequest& request,
+        const MetricKindMap* metric_kinds, SignatureHashType hash_type);
+
+    // Enables the lock-free aggregation of requests with the same metric
+    // values as the given operation, if their tokens can be summed: all
+    // metric values must be int64 values of DELTA metrics.
+    void EnableTokenCounters(
+        const ::google::api::servicecontrol::v1::Operation& operation,
         const MetricKindMap* metric_kinds);
 
+    // Adds the tokens of the given request to the token counters. Lock free.
+    // Returns false if the counters do not fit the request, which then has to
+    // be aggregated with Aggregate().
+    bool AddTokens(
+        const ::google::api::servicecontrol::v1::CheckRequest& request);
+
+    // Moves the tokens summed by AddTokens() into the aggregated request.
+    // The tokens of concurrent AddTokens() calls may be partially moved, the
+    // rest is moved by the next call.
+    void MergeTokens(const MetricKindMap* metric_kinds,
+                     SignatureHashType hash_type);
+
     // Returns the aggregated CheckRequest and reset the cache entry.
     ::google::api::servicecontrol::v1::CheckRequest ReturnCheckRequestAndClear(
         const std::string& service_name, const std::string& service_config_id);
@@ -145,24 +259,40 @@ class CheckAggregatorImpl : public CheckAggregator,
       return operation_aggregator_ != NULL;
     }
 
-    // Setter for check response.
-    inline void set_check_response(
-        const ::google::api::servicecontrol::v1::CheckResponse&
-            check_response) {
-      check_response_ = check_response;
+    // Replaces the check response. Returns the previous one, which the caller
+    // owns and must not delete while lock-free readers may still use it.
+    inline const SharedCheckResponse* swap_check_response(
+        SharedCheckResponse check_response) {
+      return check_response_.exchange(
+          new SharedCheckResponse(std::move(check_response)));
     }
     // Getter for check response.
-    inline const ::google::api::servicecontrol::v1::CheckResponse&
-    check_response() const {
-      return check_response_;
+    inline const SharedCheckResponse& check_response() const {
+      return *check_response_.load(std::memory_order_acquire);
     }
 
     // Setter for last check time.
     inline void set_last_check_time(const int64_t last_check_time) {
-      last_check_time_ = last_check_time;
+      last_check_time_.store(last_check_time, std::memory_order_relaxed);
     }
     // Getter for last check time.
-    inline const int64_t last_check_time() const { return last_check_time_; }
+    inline const int64_t last_check_time() const {
+      return last_check_time_.load(std::memory_order_relaxed);
+    }
+    // Sets the last check time if it is still expected_time. Returns whether
+    // it was set.
+    inline bool compare_and_set_last_check_time(int64_t expected_time,
+                                                const int64_t last_check_time) {
+      return last_check_time_.compare_exchange_strong(expected_time,
+                                                      last_check_time);
+    }
+
+    // Setter for response time.
+    inline void set_response_time(const int64_t response_time) {
+      response_time_ = response_time;
+    }
+    // Getter for response time.
+    inline int64_t response_time() const { return response_time_; }
 
     // Setter for check response.
     inline void set_quota_scale(const int quota_scale) {
@@ -172,22 +302,73 @@ class CheckAggregatorImpl : public CheckAggregator,
     inline int quota_scale() const { return quota_scale_; }
 
     // Getter and Setter of is_flushing_;
-    inline bool is_flushing() const { return is_flushing_; }
-    inline void set_is_flushing(bool v) { is_flushing_ = v; }
+    inline bool is_flushing() const {
+      return is_flushing_.load(std::memory_order_relaxed);
+    }
+    inline void set_is_flushing(bool v) {
+      is_flushing_.store(v, std::memory_order_relaxed);
+    }
+
+    // Marks the entry as used by a lock-free Check(). Only writes the bit if
+    // it is not set yet, to keep the cache line shared between readers.
+    inline void set_referenced() {
+      if (!referenced_.load(std::memory_order_relaxed)) {
+        referenced_.store(true, std::memory_order_relaxed);
+      }
+    }
+    // Clears the referenced bit, and returns whether it was set.
+    inline bool clear_referenced() {
+      return referenced_.exchange(false, std::memory_order_relaxed);
+    }
+
+    // Marks the entry as removed from the cache. Lock-free Check() calls
+    // which still find it in the shard snapshot take the locked path.
+    inline void set_removed() {
+      removed_.store(true, std::memory_order_relaxed);
+    }
+    // Getter of the removed flag.
+    inline bool removed() const {
+      return removed_.load(std::memory_order_relaxed);
+    }
+
+    // Counts a Check() call served by this entry.
+    inline void add_hit() { hits_.fetch_add(1, std::memory_order_relaxed); }
+    // Resets the hit count, and returns the hits counted since the last call.
+    inline int64_t clear_hits() {
+      return hits_.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Setter for the approximate bytes used by the check response.
+    inline void set_response_space_used(size_t response_space_used) {
+      response_space_used_ = response_space_used;
+    }
+
+    // Returns the approximate number of bytes used by this entry.
+    size_t SpaceUsed() const;
 
    private:
+    // Aggregates the given operation to this cache entry.
+    void AggregateOperation(
+        const ::google::api::servicecontrol::v1::Operation& operation,
+        const MetricKindMap* metric_kinds, SignatureHashType hash_type);
+
     // Internal operation.
     std::unique_ptr<OperationAggregator> operation_aggregator_;
 
-    // The check response for the last check request.
-    ::google::api::servicecontrol::v1::CheckResponse check_response_;
+    // The check response for the last check request. Owned. The shared_ptr
+    // itself is replaced, never assigned, so that lock-free readers can copy
+    // it.
+    std::atomic<const SharedCheckResponse*> check_response_;
     // In general, this is the last time a check response is updated.
     //
     // During flush, we set it to be the request start time to prevent a next
     // check request from triggering another flush. Note that this prevention
     // works only during the flush interval, which means for long RPC, there
     // could be up to RPC_time/flush_interval ongoing check requests.
-    int64_t last_check_time_;
+    std::atomic<int64_t> last_check_time_;
+    // The time the check response was received. Unlike last_check_time_, it
+    // is not changed when a refresh starts.
+    int64_t response_time_;
     // Scale used to predict how much quota are charged. It is calculated
     // as the tokens charged in the last check response / requested tokens.
     // The predicated amount tokens consumed is then request tokens * scale.
@@ -195,24 +376,233 @@ class CheckAggregatorImpl : public CheckAggregator,
     int quota_scale_;
 
     // If true, is sending the request to server to get new response.
-    bool is_flushing_;
+    std::atomic<bool> is_flushing_;
+
+    // Set by lock-free Check() calls, cleared when the use is applied to the
+    // LRU order.
+    std::atomic<bool> referenced_;
+
+    // Set when the entry is removed from the cache in lock-free mode.
+    std::atomic<bool> removed_;
+
+    // The number of Check() calls since the last Flush(). Only counted if hot
+    // entries are refreshed.
+    std::atomic<int64_t> hits_;
+
+    // Approximate bytes used by the check response, and by the token
+    // template and counters.
+    size_t response_space_used_;
+    size_t token_space_used_;
+
+    // Lock-free token aggregation. Requests with the same signature have the
+    // same metric names and metric value labels, in the same order. If their
+    // values are int64 deltas, they only differ in those values and in their
+    // times, so token_counters_[i] sums the i-th metric value of the requests,
+    // in the order of the metric values of token_template_. Null if disabled.
+    std::unique_ptr<const ::google::api::servicecontrol::v1::Operation>
+        token_template_;
+    std::unique_ptr<std::atomic<int64_t>[]> token_counters_;
+    // The number of requests added to the token counters, and the earliest
+    // start time and latest end time of their operations, in nanoseconds.
+    std::atomic<int64_t> token_requests_;
+    std::atomic<int64_t> token_start_time_;
+    std::atomic<int64_t> token_end_time_;
   };
 
   using CacheDeleter = std::function<void(CacheElem*)>;
   // Key is the signature of the check request. Value is the CacheElem.
-  // It is a LRU cache with MaxIdelTime as response_expiration_time.
-  using CheckCache =
-      SimpleLRUCacheWithDeleter<std::string, CacheElem, CacheDeleter>;
+  // It is a LRU cache with MaxIdelTime as response_expiration_time, on the
+  // open-addressing table backend.
+  using CheckCache = SimpleLRUCacheWithDeleter<
+      Signature, CacheElem, CacheDeleter, internal::SimpleLRUHash<Signature>,
+      std::equal_to<Signature>, SimpleLRUCacheFlatMap<Signature, CacheElem>>;
+
+  // Key is the signature of a denied check request. Value is its response.
+  // Entries expire negative_expiration_ms after they are inserted.
+  using NegativeCache = SimpleLRUCache<
+      Signature, SharedCheckResponse, internal::SimpleLRUHash<Signature>,
+      std::equal_to<Signature>,
+      SimpleLRUCacheFlatMap<Signature, SharedCheckResponse>>;
+
+  // An immutable lookup table of the entries of a cache shard, used by
+  // lock-free Check() calls.
+  using HitTable = FlatHashMap<Signature, CacheElem*>;
+
+  // Lock-free mode only. The replaced snapshots, removed entries and replaced
+  // responses which lock-free Check() calls may still be using.
+  struct RetiredObjects {
+    std::vector<const HitTable*> snapshots;
+    std::vector<CacheElem*> elems;
+    std::vector<const SharedCheckResponse*> responses;
+  };
+
+  // One shard of the check cache. A request is always mapped to the same
+  // shard by its signature.
+  struct CacheShard {
+    CacheShard()
+        : stack_buffer(NULL),
+          last_refresh_time(SimpleCycleTimer::Now()),
+          snapshot(NULL),
+          snapshot_stale(false) {}
+    ~CacheShard() { delete snapshot.load(); }
+
+    // Mutex guarding the access of cache and stack_buffer.
+    Mutex mutex;
+
+    // The cache that maps from operation signature to an operation.
+    std::unique_ptr<CheckCache> cache;
+
+    // Points to the StackBuffer of the call holding the mutex. Set by
+    // ShardLock. Guarded by mutex.
+    StackBuffer* stack_buffer;
+
+    // The last time hot entries were looked for. Guarded by mutex.
+    int64_t last_refresh_time;
+
+    // Estimates how often the requests were recently checked, for the cache
+    // admission. Null if disabled. Guarded by mutex.
+    std::unique_ptr<FrequencySketch> sketch;
+
+    // The cache of denied responses, null if disabled, and the mutex guarding
+    // it. If both mutexes are held, negative_mutex is locked last.
+    Mutex negative_mutex;
+    std::unique_ptr<NegativeCache> negative_cache;
+
+    // Lock-free mode only. The entries of the cache, for lock-free lookups.
+    // Replaced, never modified, under mutex.
+    std::atomic<const HitTable*> snapshot;
+
+    // Lock-free mode only. Whether entries were added or removed since the
+    // snapshot was published. Set under mutex, read by lock-free Check()
+    // calls, which take the locked path for requests missing a stale
+    // snapshot.
+    std::atomic<bool> snapshot_stale;
+
+    // Lock-free mode only, guarded by mutex. The objects replaced or removed
+    // since the snapshot was published.
+    RetiredObjects retired;
+  };
+
+  // Locks a shard and points its stack_buffer to the given StackBuffer, like
+  // a MutexLock followed by a StackBuffer::Swapper.
+  // Must be declared after the StackBuffer.
+  class ShardLock {
+   public:
+    ShardLock(CheckAggregatorImpl* aggregator, CacheShard* shard,
+              StackBuffer* stack_buffer);
+    ~ShardLock();
+
+   private:
+    CacheShard* shard_;
+    MutexLock lock_;
+
+    GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ShardLock);
+  };
+
+  // Returns the shard caching the given request signature.
+  // REQUIRES: the cache is enabled.
+  CacheShard* GetShard(const Signature& signature);
+
+  // Returns OK if the request can be served by the cache, NOT_FOUND if it has
+  // to be sent to the server, or INVALID_ARGUMENT.
+  ::google::protobuf::util::Status CheckCacheable(
+      const ::google::api::servicecontrol::v1::CheckRequest& request);
+
+  // Serves a cacheable check from the cache.
+  ::google::protobuf::util::Status CheckSigned(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      const Signature& request_signature, SharedCheckResponse* response);
+
+  // Implements CheckBatch(). Generates the signatures of the cacheable
+  // requests if signatures is null.
+  void CheckBatchSigned(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          requests,
+      const std::vector<Signature>* signatures,
+      std::vector<SharedCheckResponse>* responses,
+      std::vector<::google::protobuf::util::Status>* statuses);
+
+  // Serves the check from the shard. Must be called with the shard locked by
+  // a ShardLock.
+  ::google::protobuf::util::Status CheckLocked(
+      CacheShard* shard, const Signature& request_signature,
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      SharedCheckResponse* response);
+
+  // Serves the check from the negative cache of the shard. Returns NOT_FOUND
+  // if the request has no cached denial.
+  ::google::protobuf::util::Status CheckNegative(
+      CacheShard* shard, const Signature& signature,
+      SharedCheckResponse* response);
+
+  // Serves the check from the shard snapshot, without locking the shard.
+  // Returns false if the check has to take the locked path instead.
+  bool CheckLockFree(
+      CacheShard* shard, const Signature& signature,
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      SharedCheckResponse* response, ::google::protobuf::util::Status* status);
 
   // Returns whether we should flush a cache entry.
   //   If the aggregated check request is less than flush interval, no need to
   //   flush.
   bool ShouldFlush(const CacheElem& elem);
 
+  // If the entry should be flushed, sets its last check time to now and
+  // returns true. Only one of concurrent callers returns true.
+  bool StartFlush(CacheElem* elem);
+
+  // Returns whether the passing response of the entry can still be returned
+  // while it is refreshed in the background.
+  bool CanServeStale(const CacheElem& elem);
+
+  // Records a use of a request missing the shard's cache, and returns whether
+  // its entry of the given units can be added. Must be called with the shard
+  // locked.
+  bool Admit(CacheShard* shard, const Signature& signature, size_t units);
+
+  // Returns the units of an entry in the cache: its approximate bytes if the
+  // cache is bounded by bytes, 1 otherwise.
+  size_t EntryUnits(const CacheElem& elem) const;
+
+  // Sets the response of a request to its cache entry. Adds the entry if it
+  // is not cached, insert is true, and it is admitted.
+  ::google::protobuf::util::Status SetResponse(
+      const ::google::api::servicecontrol::v1::CheckRequest& request,
+      SharedCheckResponse response, bool insert);
+
+  // Replaces the check response of a cache entry.
+  void SetCheckResponse(CacheShard* shard, CacheElem* elem,
+                        SharedCheckResponse response);
+
+  // Applies the uses of lock-free Check() calls since the last call to the LRU
+  // order of the shard, by touching the referenced entries.
+  void TouchReferencedEntries(CacheShard* shard);
+
+  // Starts the refresh of the passing responses of the shard's entries which
+  // were hot since the last call and are about to pass the flush interval.
+  // Their aggregated requests are added to the shard's stack buffer.
+  void RefreshHotEntries(CacheShard* shard);
+
+  // Lock-free mode only. Publishes a new snapshot of the shard if entries
+  // were added or removed since the last one, and moves the objects lock-free
+  // Check() calls may still use to retired. Must be called with the shard
+  // locked.
+  void PublishSnapshot(CacheShard* shard, RetiredObjects* retired);
+
+  // Waits until lock-free Check() calls are done with the retired objects,
+  // then frees them. Tokens added to the removed entries after they were
+  // flushed out are flushed out to the stack buffer. Must be called without
+  // any shard lock held.
+  void Reclaim(RetiredObjects* retired, StackBuffer* stack_buffer);
+
   // Flushes the internal operation in the elem and delete the elem. The
   // response from the server is NOT cached.
-  // Takes ownership of the elem.
-  void OnCacheEntryDelete(CacheElem* elem);
+  // Takes ownership of the elem. In lock-free mode, the elem is only deleted
+  // by the next Flush().
+  void OnCacheEntryDelete(CacheShard* shard, CacheElem* elem);
+
+  // Adds the aggregated request of the elem, if any, to the stack buffer.
+  void FlushOutCacheElem(CacheElem* elem, StackBuffer* stack_buffer);
 
   // The service name for this cache.
   const std::string service_name_;
@@ -226,17 +616,38 @@ class CheckAggregatorImpl : public CheckAggregator,
   // Defaults to DELTA if not specified. Not owned.
   std::shared_ptr<MetricKindMap> metric_kinds_;
 
-  // Mutex guarding the access of cache_;
-  Mutex cache_mutex_;
-
-  // The cache that maps from operation signature to an operation.
+  // The cache shards. Empty if the cache is disabled.
   // We don't calculate fine grained cost for cache entries, assign each
   // entry 1 cost unit.
-  // Guarded by mutex_, except when compare against NULL.
-  std::unique_ptr<CheckCache> cache_;
+  // Each shard is guarded by its own mutex. The vector itself is only
+  // modified in the constructor.
+  std::vector<std::unique_ptr<CacheShard>> shards_;
+
+  // Records the time waited for contended shard locks. Null if not recorded.
+  std::shared_ptr<LatencyRecorder> lock_wait_recorder_;
+
+  // The counters of CacheStatistics, updated without the shard locks.
+  // Evictions and expirations are counted by the shard caches.
+  ShardedCounter hits_;
+  ShardedCounter misses_;
+  ShardedCounter refreshes_;
+  ShardedCounter negative_refreshes_;
+  ShardedCounter flushes_;
 
   // flush interval in cycles.
   int64_t flush_interval_in_cycle_;
+  // How long a passing response can be returned after it was received, in
+  // cycles. 0 if stale responses are not returned.
+  int64_t stale_limit_in_cycle_;
+  // If hot entries are refreshed, the interval between Flush() calls, in ms
+  // and in cycles. Hot entries are refreshed when they are due for a refresh
+  // before the next Flush().
+  int hot_refresh_interval_ms_;
+  int64_t hot_refresh_interval_in_cycle_;
+
+  // Protects the shard snapshots, and the entries and responses they reach,
+  // from being freed while lock-free Check() calls use them.
+  ReadCopyUpdate rcu_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CheckAggregatorImpl);
 };
@@ -22,6 +22,8 @@ limitations under the License.
 #include "utils/status_test_util.h"
 
 #include <unistd.h>
+#include <atomic>
+#include <thread>
 
 using std::string;
 using ::google::api::servicecontrol::v1::Operation;
@@ -131,15 +133,20 @@ class CheckAggregatorImplTest : public ::testing::Test {
     ASSERT_TRUE(
         TextFormat::ParseFromString(kErrorResponse2, &error_response2_));
 
-    CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
-                                    kExpirationMs);
+    ResetAggregator(CheckAggregationOptions(1 /*entries*/, kFlushIntervalMs,
+                                            kExpirationMs));
+  }
 
+  // Replaces aggregator_ with one created with the options, flushing into
+  // flushed_, and clears flushed_.
+  void ResetAggregator(const CheckAggregationOptions& options) {
     aggregator_ = CreateCheckAggregator(
         kServiceName, kServiceConfigId, options,
         std::shared_ptr<MetricKindMap>(new MetricKindMap));
     ASSERT_TRUE((bool)(aggregator_));
     aggregator_->SetFlushCallback(std::bind(
         &CheckAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+    flushed_.clear();
   }
 
   void FlushCallback(const CheckRequest& request) {
@@ -207,6 +214,25 @@ TEST_F(CheckAggregatorImplTest, TestCachePassResponses) {
   EXPECT_TRUE(MessageDifferencer::Equals(flushed_[0], request1_));
 }
 
+TEST_F(CheckAggregatorImplTest, TestCacheSharedResponse) {
+  std::shared_ptr<const CheckResponse> response;
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+
+  std::shared_ptr<const CheckResponse> server_response(
+      new CheckResponse(pass_response1_));
+  EXPECT_OK(aggregator_->CacheResponse(request1_, server_response));
+  // The cached response is shared, not copied.
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_EQ(response, server_response);
+
+  // A replaced response stays valid for its holders.
+  EXPECT_OK(aggregator_->CacheResponse(request1_, error_response1_));
+  EXPECT_TRUE(MessageDifferencer::Equals(*response, pass_response1_));
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(*response, error_response1_));
+}
+
 TEST_F(CheckAggregatorImplTest, TestCacheErrorResponses) {
   CheckResponse response;
   EXPECT_ERROR_CODE(StatusCode::kNotFound, aggregator_->Check(request1_, &response));
@@ -242,6 +268,58 @@ TEST_F(CheckAggregatorImplTest, TestCacheCapacity) {
   EXPECT_TRUE(MessageDifferencer::Equals(flushed_[1], request2_));
 }
 
+TEST_F(CheckAggregatorImplTest, TestStatistics) {
+  CheckResponse response;
+  EXPECT_ERROR_CODE(StatusCode::kNotFound, aggregator_->Check(request1_, &response));
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+
+  // request2 evicts request1 from the 1-entry cache and flushes it.
+  EXPECT_ERROR_CODE(StatusCode::kNotFound, aggregator_->Check(request2_, &response));
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+  EXPECT_EQ(flushed_.size(), 1);
+
+  CacheStatistics stat;
+  aggregator_->GetStatistics(&stat);
+  EXPECT_EQ(stat.hits, 1);
+  EXPECT_EQ(stat.misses, 2);
+  EXPECT_EQ(stat.refreshes, 0);
+  EXPECT_EQ(stat.negative_refreshes, 0);
+  EXPECT_EQ(stat.flushes, 1);
+  EXPECT_EQ(stat.evictions, 1);
+  EXPECT_EQ(stat.expirations, 0);
+  EXPECT_EQ(stat.entries, 1);
+  EXPECT_EQ(stat.bytes, 0);
+}
+
+TEST_F(CheckAggregatorImplTest, TestCacheMaxBytes) {
+  CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
+                                  kExpirationMs);
+  options.max_bytes = 1 << 20;
+  ResetAggregator(options);
+
+  // The cache is not bounded by num_entries.
+  CheckResponse response;
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_OK(aggregator_->Check(request2_, &response));
+
+  // A response of 600KB evicts the least recently used entries to fit.
+  CheckResponse large_response = pass_response2_;
+  large_response.set_operation_id(std::string(600 << 10, 'x'));
+  CheckRequest request3 = request2_;
+  request3.mutable_operation()->set_consumer_id("project:3");
+  EXPECT_OK(aggregator_->CacheResponse(request3, large_response));
+  EXPECT_OK(aggregator_->CacheResponse(request2_, large_response));
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request3, &response));
+  EXPECT_OK(aggregator_->Check(request2_, &response));
+  EXPECT_EQ(response.operation_id().size(), 600 << 10);
+}
+
 TEST_F(CheckAggregatorImplTest, TestRefresh) {
   CheckResponse response;
   EXPECT_ERROR_CODE(StatusCode::kNotFound, aggregator_->Check(request1_, &response));
@@ -293,6 +371,185 @@ TEST_F(CheckAggregatorImplTest, TestCacheExpired) {
   EXPECT_TRUE(MessageDifferencer::Equals(flushed_[0], request1_));
 }
 
+TEST_F(CheckAggregatorImplTest, TestStaleWhileRevalidate) {
+  for (bool lock_free_hits : {false, true}) {
+    CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
+                                    kExpirationMs);
+    options.lock_free_hits = lock_free_hits;
+    options.stale_while_revalidate_ms = 300;
+    ResetAggregator(options);
+
+    CheckResponse response;
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request1_, &response));
+    EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+
+    // Once due for a refresh, the cached response is still returned, and the
+    // refresh request is flushed out.
+    usleep(120000);
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+    ASSERT_EQ(flushed_.size(), 1);
+    EXPECT_TRUE(MessageDifferencer::Equals(flushed_[0], request1_));
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_EQ(flushed_.size(), 1);
+
+    // The refreshed response replaces the cached one. A response of an entry
+    // which is not cached is dropped.
+    EXPECT_OK(aggregator_->RefreshResponse(flushed_[0], pass_response2_));
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+    EXPECT_OK(aggregator_->RefreshResponse(request2_, pass_response2_));
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request2_, &response));
+
+    // The entry is still cached after the expiration, but a response older
+    // than expiration + stale_while_revalidate_ms is not returned.
+    usleep(220000);
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    usleep(330000);
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request1_, &response));
+  }
+}
+
+TEST_F(CheckAggregatorImplTest, TestRefreshHotEntries) {
+  for (bool lock_free_hits : {false, true}) {
+    CheckAggregationOptions options(10 /*entries*/, kFlushIntervalMs,
+                                    kExpirationMs);
+    options.lock_free_hits = lock_free_hits;
+    options.hot_entry_refresh_qps = 100;
+    ResetAggregator(options);
+    EXPECT_EQ(aggregator_->GetNextFlushInterval(), kFlushIntervalMs / 4);
+
+    CheckResponse response;
+    EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+    EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+    // request1 is hot, request2 is not.
+    for (int i = 0; i < 20; ++i) {
+      EXPECT_OK(aggregator_->Check(request1_, &response));
+    }
+    EXPECT_OK(aggregator_->Check(request2_, &response));
+
+    // Not about to pass the flush interval yet.
+    EXPECT_OK(aggregator_->Flush());
+    EXPECT_EQ(flushed_.size(), 0);
+
+    for (int i = 0; i < 20; ++i) {
+      EXPECT_OK(aggregator_->Check(request1_, &response));
+    }
+    EXPECT_OK(aggregator_->Check(request2_, &response));
+    usleep(80000);
+    EXPECT_OK(aggregator_->Flush());
+    ASSERT_EQ(flushed_.size(), 1);
+    // The quota of the 40 checks of request1 is aggregated in the refresh.
+    CheckRequest expected = request1_;
+    expected.mutable_operation()
+        ->mutable_metric_value_sets(0)
+        ->mutable_metric_values(0)
+        ->set_int64_value(40000);
+    EXPECT_TRUE(MessageDifferencer::Equals(flushed_[0].operation()
+                                               .metric_value_sets(0)
+                                               .metric_values(0),
+                                           expected.operation()
+                                               .metric_value_sets(0)
+                                               .metric_values(0)));
+
+    // The refresh is in flight, so request1 is not refreshed by Check(), but
+    // request2 is.
+    usleep(30000);
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request2_, &response));
+    EXPECT_OK(aggregator_->RefreshResponse(flushed_[0], pass_response2_));
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+  }
+}
+
+TEST_F(CheckAggregatorImplTest, TestNegativeCache) {
+  for (bool lock_free_hits : {false, true}) {
+    CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
+                                    kExpirationMs);
+    options.lock_free_hits = lock_free_hits;
+    options.negative_entries = 2;
+    options.negative_expiration_ms = 150;
+    ResetAggregator(options);
+
+    // Denials do not evict the passing response of request1.
+    CheckRequest request3 = request2_;
+    request3.mutable_operation()->set_consumer_id("api_key:invalid-3");
+    CheckRequest request4 = request2_;
+    request4.mutable_operation()->set_consumer_id("api_key:invalid-4");
+    EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+    EXPECT_OK(aggregator_->CacheResponse(request2_, error_response2_));
+    EXPECT_OK(aggregator_->CacheResponse(request3, error_response2_));
+
+    CheckResponse response;
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+    EXPECT_OK(aggregator_->Check(request2_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, error_response2_));
+    EXPECT_OK(aggregator_->Check(request3, &response));
+
+    // The oldest denial is evicted from the full negative cache.
+    EXPECT_OK(aggregator_->CacheResponse(request4, error_response2_));
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request2_, &response));
+    EXPECT_OK(aggregator_->Check(request4, &response));
+
+    // A denial of request1 replaces its passing response, and flushes out
+    // its aggregated quota. A pass of request3 removes its denial.
+    EXPECT_EQ(flushed_.size(), 0);
+    EXPECT_OK(aggregator_->CacheResponse(request1_, error_response1_));
+    EXPECT_EQ(flushed_.size(), 1);
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, error_response1_));
+    EXPECT_OK(aggregator_->CacheResponse(request3, pass_response2_));
+    EXPECT_OK(aggregator_->Check(request3, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+
+    // Denials expire after negative_expiration_ms, even if checked.
+    usleep(160000);
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request1_, &response));
+  }
+}
+
+TEST_F(CheckAggregatorImplTest, TestTinyLfuAdmission) {
+  for (bool lock_free_hits : {false, true}) {
+    CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
+                                    kExpirationMs);
+    options.lock_free_hits = lock_free_hits;
+    options.tiny_lfu_admission = true;
+    ResetAggregator(options);
+
+    CheckResponse response;
+    EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_OK(aggregator_->Check(request1_, &response));
+    }
+    // Lock-free hits are counted by the flush.
+    EXPECT_OK(aggregator_->Flush());
+
+    // request2 was used less often than request1, and is not admitted.
+    EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request2_, &response));
+    EXPECT_OK(aggregator_->Check(request1_, &response));
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+
+    // Once used more often, request2 replaces request1.
+    for (int i = 0; i < 10 && !aggregator_->Check(request2_, &response).ok();
+         ++i) {
+      EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+    }
+    EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+    EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                      aggregator_->Check(request1_, &response));
+  }
+}
+
 TEST_F(CheckAggregatorImplTest, TestFlushAllWithCallbackCallingCacheResposne) {
   aggregator_->SetFlushCallback(
       std::bind(&CheckAggregatorImplTest::FlushCallbackCallingBackToAggregator,
@@ -338,5 +595,265 @@ TEST_F(CheckAggregatorImplTest, TestCheckWithCallbackCallingCacheResposne) {
   EXPECT_EQ(flushed_.size(), 1);
 }
 
+TEST_F(CheckAggregatorImplTest, TestShardedCache) {
+  CheckAggregationOptions options(10 /*entries*/, kFlushIntervalMs,
+                                  kExpirationMs, 4 /*shards*/);
+  ResetAggregator(options);
+
+  CheckResponse response;
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+  EXPECT_OK(aggregator_->Check(request2_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+  EXPECT_EQ(flushed_.size(), 0);
+
+  EXPECT_OK(aggregator_->FlushAll());
+  EXPECT_EQ(flushed_.size(), 2);
+}
+
+TEST_F(CheckAggregatorImplTest, TestCheckBatch) {
+  for (bool lock_free_hits : {false, true}) {
+    CheckAggregationOptions options(10 /*entries*/, kFlushIntervalMs,
+                                    kExpirationMs, 4 /*shards*/);
+    options.lock_free_hits = lock_free_hits;
+    ResetAggregator(options);
+
+    CheckRequest invalid_request = request1_;
+    invalid_request.set_service_name("some-other-service-name");
+    std::vector<CheckRequest> requests = {request1_, request2_,
+                                          invalid_request};
+    std::vector<std::shared_ptr<const CheckResponse>> responses;
+    std::vector<Status> statuses;
+
+    EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+    aggregator_->CheckBatch(requests, &responses, &statuses);
+    ASSERT_EQ(statuses.size(), 3);
+    ASSERT_EQ(responses.size(), 3);
+    EXPECT_OK(statuses[0]);
+    EXPECT_TRUE(MessageDifferencer::Equals(*responses[0], pass_response1_));
+    EXPECT_EQ(statuses[1].code(), StatusCode::kNotFound);
+    EXPECT_EQ(statuses[2].code(), StatusCode::kInvalidArgument);
+
+    EXPECT_OK(aggregator_->CacheResponse(request2_, error_response2_));
+    aggregator_->CheckBatch(requests, &responses, &statuses);
+    EXPECT_OK(statuses[0]);
+    EXPECT_TRUE(MessageDifferencer::Equals(*responses[0], pass_response1_));
+    EXPECT_OK(statuses[1]);
+    EXPECT_TRUE(MessageDifferencer::Equals(*responses[1], error_response2_));
+  }
+}
+
+TEST_F(CheckAggregatorImplTest, TestShardedCacheConcurrentChecks) {
+  CheckAggregationOptions options(10 /*entries*/, 60000 /*flush_interval*/,
+                                  120000 /*expiration*/, 4 /*shards*/);
+  ResetAggregator(options);
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+
+  const int kThreads = 8;
+  const int kChecksPerThread = 500;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([this, i]() {
+      const CheckRequest& request = (i % 2 == 0) ? request1_ : request2_;
+      for (int j = 0; j < kChecksPerThread; ++j) {
+        CheckResponse response;
+        EXPECT_OK(aggregator_->Check(request, &response));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 2);
+  int64_t total = 0;
+  for (const auto& flushed : flushed_) {
+    total += flushed.operation().metric_value_sets(0).metric_values(0)
+                 .int64_value();
+  }
+  // Half of the threads check request1 (1000 tokens), the other half check
+  // request2 (2000 tokens).
+  EXPECT_EQ(total, (kThreads / 2) * kChecksPerThread * (1000 + 2000));
+}
+
+TEST_F(CheckAggregatorImplTest, TestLockFreeHitsRefresh) {
+  CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
+                                  kExpirationMs);
+  options.lock_free_hits = true;
+  ResetAggregator(options);
+
+  CheckResponse response;
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+
+  usleep(120000);
+  // First one should be NOT_FOUND for refresh, the second one uses the cached
+  // response.
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+
+  // A metric value with its own end time can not use the token counters, and
+  // is aggregated under the lock instead.
+  CheckRequest timed_request = request1_;
+  timed_request.mutable_operation()
+      ->mutable_metric_value_sets(0)
+      ->mutable_metric_values(0)
+      ->mutable_end_time()
+      ->set_seconds(2000);
+  EXPECT_OK(aggregator_->Check(timed_request, &response));
+
+  EXPECT_OK(aggregator_->CacheResponse(request1_, error_response1_));
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, error_response1_));
+  EXPECT_EQ(flushed_.size(), 0);
+
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 1);
+  // The quota value has been aggregated 4 times, once under the lock.
+  const Operation& operation = flushed_[0].operation();
+  ASSERT_EQ(operation.metric_value_sets(0).metric_values_size(), 1);
+  const auto& value = operation.metric_value_sets(0).metric_values(0);
+  EXPECT_EQ(value.int64_value(), 4000);
+  EXPECT_EQ(value.end_time().seconds(), 2000);
+  EXPECT_TRUE(MessageDifferencer::Equals(operation.start_time(),
+                                         request1_.operation().start_time()));
+}
+
+TEST_F(CheckAggregatorImplTest, TestLockFreeHitsKeepEntriesAlive) {
+  CheckAggregationOptions options(10 /*entries*/, kFlushIntervalMs,
+                                  kExpirationMs);
+  options.lock_free_hits = true;
+  ResetAggregator(options);
+
+  CheckResponse response;
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+  usleep(120000);
+  // Only request1 is used. Its use is applied to the LRU order by Flush().
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+  EXPECT_OK(aggregator_->Flush());
+  EXPECT_EQ(flushed_.size(), 0);
+
+  usleep(120000);
+  EXPECT_OK(aggregator_->Flush());
+  // request2 is expired, and has no aggregated tokens to flush out. request1
+  // would have been flushed out if it had expired too.
+  EXPECT_EQ(flushed_.size(), 0);
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request2_, &response));
+  // request1 is still cached: this check is aggregated, as a refresh.
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_EQ(flushed_[0].operation().metric_value_sets(0)
+                .metric_values(0).int64_value(),
+            2000);
+}
+
+TEST_F(CheckAggregatorImplTest, TestLockFreeHitsBeforeFlush) {
+  CheckAggregationOptions options(1 /*entries*/, kFlushIntervalMs,
+                                  kExpirationMs);
+  options.lock_free_hits = true;
+  ResetAggregator(options);
+
+  CheckResponse response;
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->Flush());
+  EXPECT_OK(aggregator_->Check(request1_, &response));
+
+  // request2 evicts request1, whose tokens are flushed out right away. Until
+  // the next Flush(), request1 is still in the shard snapshot but is not
+  // served from it, and request2 is served under the lock.
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_EQ(flushed_[0].operation().metric_value_sets(0)
+                .metric_values(0).int64_value(),
+            1000);
+  EXPECT_ERROR_CODE(StatusCode::kNotFound,
+                    aggregator_->Check(request1_, &response));
+  EXPECT_OK(aggregator_->Check(request2_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+
+  EXPECT_OK(aggregator_->Flush());
+  EXPECT_OK(aggregator_->Check(request2_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response2_));
+  EXPECT_EQ(flushed_.size(), 1);
+
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 2);
+  EXPECT_EQ(flushed_[1].operation().metric_value_sets(0)
+                .metric_values(0).int64_value(),
+            4000);
+}
+
+TEST_F(CheckAggregatorImplTest, TestLockFreeHitsConcurrentChecks) {
+  // With a single entry, request1 and request2 keep evicting each other while
+  // other threads use them.
+  CheckAggregationOptions options(1 /*entries*/, 60000 /*flush_interval*/,
+                                  120000 /*expiration*/);
+  options.lock_free_hits = true;
+  ResetAggregator(options);
+  Mutex flushed_mutex;
+  aggregator_->SetFlushCallback([this, &flushed_mutex](
+                                    const CheckRequest& request) {
+    MutexLock lock(flushed_mutex);
+    flushed_.push_back(request);
+  });
+
+  const int kThreads = 8;
+  const int kChecksPerThread = 2000;
+  std::atomic<int64_t> checked_tokens(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([this, i, &checked_tokens]() {
+      const CheckRequest& request = (i % 2 == 0) ? request1_ : request2_;
+      const CheckResponse& pass_response =
+          (i % 2 == 0) ? pass_response1_ : pass_response2_;
+      const int64_t tokens = request.operation()
+                                 .metric_value_sets(0)
+                                 .metric_values(0)
+                                 .int64_value();
+      for (int j = 0; j < kChecksPerThread; ++j) {
+        CheckResponse response;
+        Status status = aggregator_->Check(request, &response);
+        if (status.ok()) {
+          EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response));
+          checked_tokens += tokens;
+        } else {
+          EXPECT_ERROR_CODE(StatusCode::kNotFound, status);
+          EXPECT_OK(aggregator_->CacheResponse(request, pass_response));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_OK(aggregator_->FlushAll());
+  int64_t flushed_tokens = 0;
+  for (const auto& flushed : flushed_) {
+    flushed_tokens += flushed.operation()
+                          .metric_value_sets(0)
+                          .metric_values(0)
+                          .int64_value();
+  }
+  // Every token of a successful check is flushed out exactly once.
+  EXPECT_EQ(flushed_tokens, checked_tokens.load());
+}
+
 }  // namespace service_control_client
 }  // namespace google
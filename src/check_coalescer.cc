@@ -0,0 +1,53 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "src/check_coalescer.h"
+
+namespace google {
+namespace service_control_client {
+
+CheckCoalescer::CheckCoalescer(int max_waiters) : max_waiters_(max_waiters) {}
+
+bool CheckCoalescer::Join(const Signature& signature, Waiter waiter,
+                          bool* leader) {
+  MutexLock lock(mutex_);
+  auto it = in_flight_.find(signature);
+  if (it == in_flight_.end()) {
+    in_flight_[signature];
+    *leader = true;
+    return false;
+  }
+  *leader = false;
+  if (it->second.size() >= static_cast<size_t>(max_waiters_)) {
+    return false;
+  }
+  it->second.push_back(std::move(waiter));
+  return true;
+}
+
+std::vector<CheckCoalescer::Waiter> CheckCoalescer::Complete(
+    const Signature& signature) {
+  std::vector<Waiter> waiters;
+  MutexLock lock(mutex_);
+  auto it = in_flight_.find(signature);
+  if (it != in_flight_.end()) {
+    waiters.swap(it->second);
+    in_flight_.erase(it);
+  }
+  return waiters;
+}
+
+}  // namespace service_control_client
+}  // namespace google
@@ -0,0 +1,74 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_CHECK_COALESCER_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_CHECK_COALESCER_H_
+
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "google/protobuf/stubs/status.h"
+#include "src/signature.h"
+#include "utils/flat_hash_map.h"
+#include "utils/google_macros.h"
+#include "utils/thread.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace google {
+namespace service_control_client {
+
+// Coalesces concurrent cache misses of the same check request: the first miss
+// sends the request to the server, and the misses arriving while it is in
+// flight wait for its response instead of sending their own.
+// Thread safe.
+class CheckCoalescer {
+ public:
+  // Called with the status and the response of the in-flight check. The
+  // response is empty, not null, if the check failed.
+  typedef std::function<void(
+      const ::google::protobuf::util::Status&,
+      const std::shared_ptr<const ::google::api::servicecontrol::v1::
+                                CheckResponse>&)>
+      Waiter;
+
+  // max_waiters is the maximum number of waiters queued on one in-flight
+  // check. Once reached, further misses send their own requests.
+  explicit CheckCoalescer(int max_waiters);
+
+  // Queues the waiter on the in-flight check of the signature, and returns
+  // true. Otherwise the caller has to send the request itself, and *leader
+  // tells whether its request became the in-flight one of the signature, in
+  // which case it has to call Complete() once the request is done.
+  bool Join(const Signature& signature, Waiter waiter, bool* leader);
+
+  // Ends the in-flight check of the signature, returning its waiters. The
+  // caller calls them with the response.
+  std::vector<Waiter> Complete(const Signature& signature);
+
+ private:
+  const int max_waiters_;
+
+  Mutex mutex_;
+  // The waiters of the in-flight checks, by signature. Guarded by mutex_.
+  FlatHashMap<Signature, std::vector<Waiter>> in_flight_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CheckCoalescer);
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_CHECK_COALESCER_H_
@@ -0,0 +1,80 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "src/check_coalescer.h"
+
+#include "gtest/gtest.h"
+
+using ::google::api::servicecontrol::v1::CheckResponse;
+using ::google::protobuf::util::OkStatus;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::StatusCode;
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+Signature MakeSignature(unsigned char seed) {
+  unsigned char digest[16] = {seed};
+  return Signature(digest);
+}
+
+}  // namespace
+
+TEST(CheckCoalescerTest, TestJoinAndComplete) {
+  CheckCoalescer coalescer(2);
+  Signature signature1 = MakeSignature(1);
+  Signature signature2 = MakeSignature(2);
+
+  int called = 0;
+  CheckCoalescer::Waiter waiter =
+      [&called](const Status& status,
+                const std::shared_ptr<const CheckResponse>& response) {
+        EXPECT_TRUE(status.ok());
+        EXPECT_EQ(response->operation_id(), "id");
+        ++called;
+      };
+
+  // The first caller of each signature becomes the leader.
+  bool leader = false;
+  EXPECT_FALSE(coalescer.Join(signature1, waiter, &leader));
+  EXPECT_TRUE(leader);
+  EXPECT_FALSE(coalescer.Join(signature2, waiter, &leader));
+  EXPECT_TRUE(leader);
+
+  // Two waiters can be queued on signature1, the third one is not.
+  EXPECT_TRUE(coalescer.Join(signature1, waiter, &leader));
+  EXPECT_FALSE(leader);
+  EXPECT_TRUE(coalescer.Join(signature1, waiter, &leader));
+  EXPECT_FALSE(coalescer.Join(signature1, waiter, &leader));
+  EXPECT_FALSE(leader);
+
+  std::shared_ptr<CheckResponse> response(new CheckResponse);
+  response->set_operation_id("id");
+  std::vector<CheckCoalescer::Waiter> waiters = coalescer.Complete(signature1);
+  ASSERT_EQ(waiters.size(), 2);
+  for (const auto& w : waiters) {
+    w(OkStatus(), response);
+  }
+  EXPECT_EQ(called, 2);
+  EXPECT_TRUE(coalescer.Complete(signature2).empty());
+
+  // Once completed, the next caller is a leader again.
+  EXPECT_FALSE(coalescer.Join(signature1, waiter, &leader));
+  EXPECT_TRUE(leader);
+}
+
+}  // namespace service_control_client
+}  // namespace google
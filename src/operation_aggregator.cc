@@ -17,13 +17,18 @@ limitations under the License.
 #include "src/money_utils.h"
 #include "src/signature.h"
 #include "utils/distribution_helper.h"
+#include "utils/flat_hash_map.h"
 #include "utils/stl_util.h"
 
+#include "google/protobuf/descriptor.h"
 #include "google/protobuf/stubs/logging.h"
 
+#include <algorithm>
+
 using std::string;
 using ::google::protobuf::Timestamp;
 using google::api::MetricDescriptor;
+using google::api::servicecontrol::v1::Distribution;
 using google::api::servicecontrol::v1::MetricValue;
 using google::api::servicecontrol::v1::MetricValueSet;
 using google::api::servicecontrol::v1::Operation;
@@ -38,92 +43,405 @@ namespace {
 // limit the final report size.
 const int kMaxLogEntries = 100;
 
+// A timestamp kept in plain fields.
+struct Time {
+  int64_t seconds;
+  int32_t nanos;
+};
+
+Time ToTime(const Timestamp& timestamp) {
+  return Time{timestamp.seconds(), timestamp.nanos()};
+}
+
+void ToTimestamp(const Time& time, Timestamp* timestamp) {
+  timestamp->set_seconds(time.seconds);
+  timestamp->set_nanos(time.nanos);
+}
+
+// Returns whether time a is before b or not.
+bool TimeBefore(const Time& a, const Time& b) {
+  return a.seconds < b.seconds || (a.seconds == b.seconds && a.nanos < b.nanos);
+}
+
 // Returns whether timestamp a is before b or not.
 bool TimestampBefore(const Timestamp& a, const Timestamp& b) {
-  return a.seconds() < b.seconds() ||
-         (a.seconds() == b.seconds() && a.nanos() < b.nanos());
-}
-
-// Merges two metric values, with metric kind being Cumulative or
-// Gauge.
-//
-// New value will override old value, based on the end time.
-void MergeCumulativeOrGaugeMetricValue(const MetricValue& from,
-                                       MetricValue* to) {
-  if (TimestampBefore(from.end_time(), to->end_time())) return;
-
-  *to = from;
-}
-
-// Merges two metric values, with metric kind being Delta.
-//
-// Time [from_start, from_end] and [to_start, to_end] will be merged to time
-// [min(from_start, to_start), max(from_end, to_end)]. It is OK to have gap or
-// overlap between the two time spans.
-//
-// For INT64/DOUBLE/MONEY/DISTRIBUTION, values will be added together,
-// except no change when the bucket options does not match.
-void MergeDeltaMetricValue(const MetricValue& from, MetricValue* to) {
-  if (to->value_case() != from.value_case()) {
+  return TimeBefore(ToTime(a), ToTime(b));
+}
+
+// The distinct bucket options of the distribution values of a metric, shared
+// by its aggregated values.
+class BucketOptionsTable {
+ public:
+  // Returns the bucket options equal to the ones of the given distribution,
+  // adding them if they are missing.
+  const Distribution* Intern(const Distribution& distribution) {
+    for (const auto& options : options_) {
+      if (DistributionHelper::BucketOptionsEqual(*options, distribution)) {
+        return options.get();
+      }
+    }
+    Distribution* options = new Distribution;
+    switch (distribution.bucket_option_case()) {
+      case Distribution::kLinearBuckets:
+        *options->mutable_linear_buckets() = distribution.linear_buckets();
+        break;
+      case Distribution::kExponentialBuckets:
+        *options->mutable_exponential_buckets() =
+            distribution.exponential_buckets();
+        break;
+      case Distribution::kExplicitBuckets:
+        *options->mutable_explicit_buckets() = distribution.explicit_buckets();
+        break;
+      default:
+        break;
+    }
+    options_.emplace_back(options);
+    return options;
+  }
+
+ private:
+  std::vector<std::unique_ptr<Distribution>> options_;
+};
+
+// Returns the fields of the distribution which are not kept in the plain
+// fields of a DistributionValue, such as its exemplars, or null if it has
+// none. Like DistributionHelper::Merge(), these fields are taken from the
+// first merged distribution with a positive count.
+std::unique_ptr<Distribution> OtherDistributionFields(
+    const Distribution& distribution) {
+  const auto* reflection = distribution.GetReflection();
+  std::vector<const ::google::protobuf::FieldDescriptor*> fields;
+  reflection->ListFields(distribution, &fields);
+  bool has_other_fields =
+      reflection->GetUnknownFields(distribution).field_count() > 0;
+  for (const auto* field : fields) {
+    switch (field->number()) {
+      case Distribution::kCountFieldNumber:
+      case Distribution::kMeanFieldNumber:
+      case Distribution::kMinimumFieldNumber:
+      case Distribution::kMaximumFieldNumber:
+      case Distribution::kSumOfSquaredDeviationFieldNumber:
+      case Distribution::kBucketCountsFieldNumber:
+      case Distribution::kLinearBucketsFieldNumber:
+      case Distribution::kExponentialBucketsFieldNumber:
+      case Distribution::kExplicitBucketsFieldNumber:
+        break;
+      default:
+        has_other_fields = true;
+        break;
+    }
+  }
+  if (!has_other_fields) return nullptr;
+
+  std::unique_ptr<Distribution> other(new Distribution(distribution));
+  other->clear_count();
+  other->clear_mean();
+  other->clear_minimum();
+  other->clear_maximum();
+  other->clear_sum_of_squared_deviation();
+  other->clear_bucket_counts();
+  other->clear_bucket_option();
+  return other;
+}
+
+// An aggregated distribution value.
+struct DistributionValue {
+  int64_t count;
+  double mean;
+  double minimum;
+  double maximum;
+  double sum_of_squared_deviation;
+  std::vector<int64_t> bucket_counts;
+  // Not owned, interned in the BucketOptionsTable of the metric.
+  const Distribution* bucket_options;
+  // Any other fields of the distribution, null if there are none.
+  std::unique_ptr<Distribution> other_fields;
+};
+
+// The aggregated value of one metric value signature, kept in plain fields.
+struct MetricSlot {
+  MetricSlot() : has_start_time(false), has_end_time(false) {}
+
+  // Sets all but the labels from the given metric value.
+  void Set(const MetricValue& from, BucketOptionsTable* bucket_options);
+
+  // Merges two metric values, with metric kind being Cumulative or
+  // Gauge.
+  //
+  // New value will override old value, based on the end time.
+  void MergeCumulativeOrGauge(const MetricValue& from,
+                              BucketOptionsTable* bucket_options);
+
+  // Merges two metric values, with metric kind being Delta.
+  //
+  // Time [from_start, from_end] and [to_start, to_end] will be merged to time
+  // [min(from_start, to_start), max(from_end, to_end)]. It is OK to have gap
+  // or overlap between the two time spans.
+  //
+  // For INT64/DOUBLE/DISTRIBUTION, values will be added together,
+  // except no change when the bucket options does not match.
+  void MergeDelta(const MetricValue& from);
+
+  // Materializes the slot as a MetricValue proto.
+  void ToProto(MetricValue* value) const;
+
+  std::vector<std::pair<string, string>> labels;
+  bool has_start_time;
+  bool has_end_time;
+  Time start_time;
+  Time end_time;
+  MetricValue::ValueCase value_case;
+  union {
+    int64_t int64_value;
+    double double_value;
+  };
+  std::unique_ptr<DistributionValue> distribution_value;
+  // Any other kind of value, with only its value set.
+  std::unique_ptr<MetricValue> other_value;
+};
+
+// Merges the "from" distribution to "to" distribution, the same way as
+// DistributionHelper::Merge(). No change if the buckets do not match.
+void MergeDistribution(const Distribution& from, DistributionValue* to) {
+  if (!DistributionHelper::BucketOptionsEqual(from, *to->bucket_options) ||
+      from.bucket_counts_size() != static_cast<int>(to->bucket_counts.size())) {
+    return;
+  }
+
+  if (from.count() <= 0) return;
+  if (to->count <= 0) {
+    to->count = from.count();
+    to->mean = from.mean();
+    to->minimum = from.minimum();
+    to->maximum = from.maximum();
+    to->sum_of_squared_deviation = from.sum_of_squared_deviation();
+    std::copy(from.bucket_counts().begin(), from.bucket_counts().end(),
+              to->bucket_counts.begin());
+    to->other_fields = OtherDistributionFields(from);
+    return;
+  }
+
+  int64_t count = to->count;
+  double mean = to->mean;
+  to->count += from.count();
+  to->minimum = std::min(from.minimum(), to->minimum);
+  to->maximum = std::max(from.maximum(), to->maximum);
+  to->mean = (count * mean + from.count() * from.mean()) / to->count;
+  to->sum_of_squared_deviation =
+      to->sum_of_squared_deviation + from.sum_of_squared_deviation() +
+      count * (to->mean - mean) * (to->mean - mean) +
+      from.count() * (to->mean - from.mean()) * (to->mean - from.mean());
+
+  for (int i = 0; i < from.bucket_counts_size(); i++) {
+    to->bucket_counts[i] += from.bucket_counts(i);
+  }
+}
+
+void MetricSlot::Set(const MetricValue& from,
+                     BucketOptionsTable* bucket_options) {
+  has_start_time = from.has_start_time();
+  if (has_start_time) start_time = ToTime(from.start_time());
+  has_end_time = from.has_end_time();
+  if (has_end_time) end_time = ToTime(from.end_time());
+
+  value_case = from.value_case();
+  distribution_value.reset();
+  other_value.reset();
+  switch (value_case) {
+    case MetricValue::kInt64Value:
+      int64_value = from.int64_value();
+      break;
+    case MetricValue::kDoubleValue:
+      double_value = from.double_value();
+      break;
+    case MetricValue::kDistributionValue: {
+      const Distribution& distribution = from.distribution_value();
+      distribution_value.reset(new DistributionValue{
+          distribution.count(), distribution.mean(), distribution.minimum(),
+          distribution.maximum(), distribution.sum_of_squared_deviation(),
+          std::vector<int64_t>(distribution.bucket_counts().begin(),
+                               distribution.bucket_counts().end()),
+          bucket_options->Intern(distribution),
+          OtherDistributionFields(distribution)});
+      break;
+    }
+    case MetricValue::VALUE_NOT_SET:
+      break;
+    default:
+      other_value.reset(new MetricValue(from));
+      other_value->clear_labels();
+      other_value->clear_start_time();
+      other_value->clear_end_time();
+      break;
+  }
+}
+
+void MetricSlot::MergeCumulativeOrGauge(const MetricValue& from,
+                                        BucketOptionsTable* bucket_options) {
+  Time to_end_time = has_end_time ? end_time : Time{0, 0};
+  if (TimeBefore(ToTime(from.end_time()), to_end_time)) return;
+
+  Set(from, bucket_options);
+}
+
+void MetricSlot::MergeDelta(const MetricValue& from) {
+  if (value_case != from.value_case()) {
+    MetricValue to;
+    ToProto(&to);
     GOOGLE_LOG(WARNING) << "Metric values are not compatible: "
-                        << from.DebugString() << ", " << to->DebugString();
+                        << from.DebugString() << ", " << to.DebugString();
     return;
   }
 
   if (from.has_start_time()) {
-    if (!to->has_start_time() ||
-        TimestampBefore(from.start_time(), to->start_time())) {
-      *(to->mutable_start_time()) = from.start_time();
+    Time from_start_time = ToTime(from.start_time());
+    if (!has_start_time || TimeBefore(from_start_time, start_time)) {
+      has_start_time = true;
+      start_time = from_start_time;
     }
   }
 
   if (from.has_end_time()) {
-    if (!to->has_end_time() ||
-        TimestampBefore(to->end_time(), from.end_time())) {
-      *(to->mutable_end_time()) = from.end_time();
+    Time from_end_time = ToTime(from.end_time());
+    if (!has_end_time || TimeBefore(end_time, from_end_time)) {
+      has_end_time = true;
+      end_time = from_end_time;
     }
   }
 
-  switch (to->value_case()) {
+  switch (value_case) {
     case MetricValue::kInt64Value:
-      to->set_int64_value(to->int64_value() + from.int64_value());
+      int64_value += from.int64_value();
       break;
     case MetricValue::kDoubleValue:
-      to->set_double_value(to->double_value() + from.double_value());
+      double_value += from.double_value();
       break;
     case MetricValue::kDistributionValue:
-      (void)DistributionHelper::Merge(from.distribution_value(),
-                                to->mutable_distribution_value());
+      MergeDistribution(from.distribution_value(), distribution_value.get());
       break;
     default:
-      GOOGLE_LOG(WARNING) << "Unknown metric kind for: " << to->DebugString();
+      GOOGLE_LOG(WARNING) << "Unknown metric kind for: " << from.DebugString();
       break;
   }
 }
 
-// Merges one metric value into another.
-void MergeMetricValue(MetricDescriptor::MetricKind metric_kind,
-                      const MetricValue& from, MetricValue* to) {
-  if (metric_kind == MetricDescriptor::DELTA) {
-    MergeDeltaMetricValue(from, to);
-  } else {
-    MergeCumulativeOrGaugeMetricValue(from, to);
+void MetricSlot::ToProto(MetricValue* value) const {
+  for (const auto& label : labels) {
+    (*value->mutable_labels())[label.first] = label.second;
+  }
+  if (has_start_time) ToTimestamp(start_time, value->mutable_start_time());
+  if (has_end_time) ToTimestamp(end_time, value->mutable_end_time());
+
+  switch (value_case) {
+    case MetricValue::kInt64Value:
+      value->set_int64_value(int64_value);
+      break;
+    case MetricValue::kDoubleValue:
+      value->set_double_value(double_value);
+      break;
+    case MetricValue::kDistributionValue: {
+      Distribution* distribution = value->mutable_distribution_value();
+      *distribution = *distribution_value->bucket_options;
+      if (distribution_value->other_fields) {
+        distribution->MergeFrom(*distribution_value->other_fields);
+      }
+      distribution->set_count(distribution_value->count);
+      distribution->set_mean(distribution_value->mean);
+      distribution->set_minimum(distribution_value->minimum);
+      distribution->set_maximum(distribution_value->maximum);
+      distribution->set_sum_of_squared_deviation(
+          distribution_value->sum_of_squared_deviation);
+      distribution->mutable_bucket_counts()->Reserve(
+          distribution_value->bucket_counts.size());
+      for (int64_t bucket_count : distribution_value->bucket_counts) {
+        distribution->add_bucket_counts(bucket_count);
+      }
+      break;
+    }
+    default:
+      if (other_value) {
+        value->MergeFrom(*other_value);
+      }
+      break;
   }
 }
 
+// Returns the approximate number of bytes used by a slot.
+size_t SlotSpaceUsed(const MetricSlot& slot) {
+  size_t size = sizeof(MetricSlot) + sizeof(Signature) + sizeof(size_t) +
+                slot.labels.capacity() * sizeof(slot.labels[0]);
+  for (const auto& label : slot.labels) {
+    size += label.first.capacity() + label.second.capacity();
+  }
+  if (slot.distribution_value) {
+    size += sizeof(DistributionValue) +
+            slot.distribution_value->bucket_counts.capacity() *
+                sizeof(int64_t);
+    if (slot.distribution_value->other_fields) {
+      size += slot.distribution_value->other_fields->SpaceUsedLong();
+    }
+  }
+  if (slot.other_value) {
+    size += slot.other_value->SpaceUsedLong();
+  }
+  return size;
+}
+
 }  //  namespace
 
+struct OperationAggregator::MetricColumn {
+  MetricColumn(const string& metric_name,
+               MetricDescriptor::MetricKind metric_kind)
+      : metric_name(metric_name), metric_kind(metric_kind) {}
+
+  // Merges one metric value into its slot, adding the slot if it is missing.
+  // Returns the approximate number of bytes of the added slot, if any.
+  size_t Merge(const MetricValue& metric_value, SignatureHashType hash_type) {
+    Signature signature =
+        GenerateReportMetricValueSignature(metric_value, hash_type);
+    auto it = slot_index.find(signature);
+    if (it == slot_index.end()) {
+      slot_index[signature] = slots.size();
+      slots.emplace_back();
+      MetricSlot& slot = slots.back();
+      slot.labels.assign(metric_value.labels().begin(),
+                         metric_value.labels().end());
+      slot.Set(metric_value, &bucket_options);
+      return SlotSpaceUsed(slot);
+    } else if (metric_kind == MetricDescriptor::DELTA) {
+      slots[it->second].MergeDelta(metric_value);
+    } else {
+      slots[it->second].MergeCumulativeOrGauge(metric_value, &bucket_options);
+    }
+    return 0;
+  }
+
+  const string metric_name;
+  const MetricDescriptor::MetricKind metric_kind;
+  // Maps a metric value signature to its index in slots.
+  FlatHashMap<Signature, size_t> slot_index;
+  std::vector<MetricSlot> slots;
+  BucketOptionsTable bucket_options;
+};
+
 OperationAggregator::OperationAggregator(
     const Operation& operation,
     const std::unordered_map<string, MetricDescriptor::MetricKind>*
-        metric_kinds)
-    : operation_(operation), metric_kinds_(metric_kinds) {
+        metric_kinds,
+    SignatureHashType hash_type)
+    : operation_(operation),
+      metric_kinds_(metric_kinds),
+      hash_type_(hash_type),
+      space_used_(sizeof(OperationAggregator)) {
   MergeMetricValueSets(operation);
 
   // Clear the metric value sets in operation_.
   operation_.clear_metric_value_sets();
+  space_used_ += operation_.SpaceUsedLong() - sizeof(operation_);
 }
 
+OperationAggregator::~OperationAggregator() {}
+
 void OperationAggregator::MergeOperation(const Operation& operation) {
   if (operation.has_start_time()) {
     if (!operation_.has_start_time() ||
@@ -149,45 +467,59 @@ bool OperationAggregator::TooBig() const {
 
 Operation OperationAggregator::ToOperationProto() const {
   Operation op(operation_);
+  AddMetricValueSets(&op);
+  return op;
+}
 
-  for (const auto& metric_value_set : metric_value_sets_) {
-    MetricValueSet* set = op.add_metric_value_sets();
-    set->set_metric_name(metric_value_set.first);
+void OperationAggregator::MoveToOperationProto(Operation* operation) {
+  *operation = std::move(operation_);
+  AddMetricValueSets(operation);
+  metric_columns_.clear();
+}
 
-    for (const auto& metric_value : metric_value_set.second) {
-      *(set->add_metric_values()) = metric_value.second;
+void OperationAggregator::AddMetricValueSets(Operation* operation) const {
+  for (const auto& column : metric_columns_) {
+    MetricValueSet* set = operation->add_metric_value_sets();
+    set->set_metric_name(column->metric_name);
+
+    set->mutable_metric_values()->Reserve(column->slots.size());
+    for (const auto& slot : column->slots) {
+      slot.ToProto(set->add_metric_values());
     }
   }
+}
 
-  return op;
+OperationAggregator::MetricColumn* OperationAggregator::GetMetricColumn(
+    const string& metric_name) {
+  for (const auto& column : metric_columns_) {
+    if (column->metric_name == metric_name) {
+      return column.get();
+    }
+  }
+
+  MetricDescriptor::MetricKind metric_kind = MetricDescriptor::DELTA;
+  if (metric_kinds_) {
+    metric_kind =
+        FindWithDefault(*metric_kinds_, metric_name, MetricDescriptor::DELTA);
+  }
+  metric_columns_.emplace_back(new MetricColumn(metric_name, metric_kind));
+  space_used_ += sizeof(MetricColumn) + sizeof(metric_columns_[0]) +
+                 metric_name.capacity();
+  return metric_columns_.back().get();
 }
 
 void OperationAggregator::MergeLogEntries(const Operation& operation) {
   for (const auto& entry : operation.log_entries()) {
     *(operation_.add_log_entries()) = entry;
+    space_used_ += entry.SpaceUsedLong();
   }
 }
 
 void OperationAggregator::MergeMetricValueSets(const Operation& operation) {
   for (const auto& metric_value_set : operation.metric_value_sets()) {
-    // Intentionally use the side effect of [] to add missing keys.
-    std::unordered_map<string, MetricValue>& metric_values =
-        metric_value_sets_[metric_value_set.metric_name()];
-
-    MetricDescriptor::MetricKind metric_kind = MetricDescriptor::DELTA;
-    if (metric_kinds_) {
-      metric_kind =
-          FindWithDefault(*metric_kinds_, metric_value_set.metric_name(),
-                          MetricDescriptor::DELTA);
-    }
+    MetricColumn* column = GetMetricColumn(metric_value_set.metric_name());
     for (const auto& metric_value : metric_value_set.metric_values()) {
-      string signature = GenerateReportMetricValueSignature(metric_value);
-      MetricValue* existing = FindOrNull(metric_values, signature);
-      if (existing == nullptr) {
-        metric_values.emplace(signature, metric_value);
-      } else {
-        MergeMetricValue(metric_kind, metric_value, existing);
-      }
+      space_used_ += column->Merge(metric_value, hash_type_);
     }
   }
 }
@@ -18,11 +18,15 @@ limitations under the License.
 #ifndef GOOGLE_SERVICE_CONTROL_CLIENT_OPERATION_AGGREGATOR_H_
 #define GOOGLE_SERVICE_CONTROL_CLIENT_OPERATION_AGGREGATOR_H_
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "google/api/metric.pb.h"
 #include "google/api/servicecontrol/v1/metric_value.pb.h"
 #include "google/api/servicecontrol/v1/operation.pb.h"
+#include "include/aggregation_options.h"
+#include "src/signature.h"
 #include "utils/google_macros.h"
 
 namespace google {
@@ -32,12 +36,15 @@ namespace service_control_client {
 class OperationAggregator {
  public:
   // Constructor. Does not take ownership of metric_kinds, which must outlive
-  // this instance.
+  // this instance. hash_type is used to generate metric value signatures.
   OperationAggregator(
       const ::google::api::servicecontrol::v1::Operation& operation,
       const std::unordered_map<std::string,
                                ::google::api::MetricDescriptor::MetricKind>*
-          metric_kinds);
+          metric_kinds,
+      SignatureHashType hash_type = SignatureHashType::kMd5);
+
+  ~OperationAggregator();
 
   // Merges the given operation with this operation, assuming the given
   // operation has the same operation signature.
@@ -47,10 +54,29 @@ class OperationAggregator {
   // Transforms to Operation proto message.
   ::google::api::servicecontrol::v1::Operation ToOperationProto() const;
 
+  // Moves the aggregated operation into the given empty operation. Nothing but
+  // the metric values is copied when both are on the heap. The aggregator is
+  // left empty and must not be used afterwards.
+  void MoveToOperationProto(
+      ::google::api::servicecontrol::v1::Operation* operation);
+
   // Check if the operation is too big.
   bool TooBig() const;
 
+  // Returns the approximate number of bytes used by the aggregated operation.
+  size_t SpaceUsed() const { return space_used_; }
+
  private:
+  // The aggregated values of one metric.
+  struct MetricColumn;
+
+  // Returns the column of the given metric, adding it if it is missing.
+  MetricColumn* GetMetricColumn(const std::string& metric_name);
+
+  // Materializes the aggregated metric values into the operation.
+  void AddMetricValueSets(
+      ::google::api::servicecontrol::v1::Operation* operation) const;
+
   // Merges the metric value sets in the given operation into this operation.
   void MergeMetricValueSets(
       const ::google::api::servicecontrol::v1::Operation& operation);
@@ -62,20 +88,24 @@ class OperationAggregator {
   // Used to store everything but metric value sets.
   ::google::api::servicecontrol::v1::Operation operation_;
 
-  // Aggregated metric values in the operation.
-  // Key is metric_name.
-  // Value is a map of metric value signature to aggregated metric value.
-  std::unordered_map<
-      std::string,
-      std::unordered_map<std::string,
-                         ::google::api::servicecontrol::v1::MetricValue>>
-      metric_value_sets_;
+  // Aggregated metric values in the operation, one column per metric name in
+  // the order they are first seen. Operations carry a handful of metrics, so
+  // a column is found by a linear scan. Values are kept in plain fields, and
+  // are only materialized as MetricValueSet protos when the operation is
+  // flushed.
+  std::vector<std::unique_ptr<MetricColumn>> metric_columns_;
 
   // Metric kinds. Key is the metric name and value is the metric kind.
   // Defaults to DELTA if not specified.
   const std::unordered_map<
       std::string, ::google::api::MetricDescriptor::MetricKind>* metric_kinds_;
 
+  // The hash function used to generate metric value signatures.
+  const SignatureHashType hash_type_;
+
+  // Approximate bytes used, updated as values are merged.
+  size_t space_used_;
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(OperationAggregator);
 };
 
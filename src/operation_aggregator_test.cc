@@ -18,14 +18,17 @@ limitations under the License.
 #include "gmock/gmock.h"
 #include "google/protobuf/stubs/logging.h"
 #include "google/protobuf/text_format.h"
+#include "google/protobuf/unknown_field_set.h"
 #include "google/protobuf/util/message_differencer.h"
 #include "google/type/money.pb.h"
 #include "gtest/gtest.h"
+#include "utils/distribution_helper.h"
 
 using std::string;
 using ::google::api::MetricDescriptor;
 using ::google::api::servicecontrol::v1::Distribution;
 using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::MetricValueSet;
 using ::google::api::servicecontrol::v1::Operation;
 using ::google::type::Money;
 using ::google::protobuf::TextFormat;
@@ -393,6 +396,25 @@ TEST_F(OperationAggregatorTest, Delta_MergeOperation1AndOperation2) {
       MessageDifferencer::Equals(iop.ToOperationProto(), delta_merged12_));
 }
 
+TEST_F(OperationAggregatorTest, Delta_MoveToOperationProto) {
+  OperationAggregator iop(operation1_, &delta_metric_kind_);
+  iop.MergeOperation(operation2_);
+  Operation operation;
+  iop.MoveToOperationProto(&operation);
+  EXPECT_TRUE(MessageDifferencer::Equals(operation, delta_merged12_));
+}
+
+TEST_F(OperationAggregatorTest, SpaceUsed) {
+  OperationAggregator iop(operation1_, &delta_metric_kind_);
+  size_t space_used = iop.SpaceUsed();
+  EXPECT_GT(space_used, operation1_.log_entries(0).SpaceUsedLong());
+
+  // Merged log entries are counted.
+  iop.MergeOperation(operation1_);
+  EXPECT_GE(iop.SpaceUsed(),
+            space_used + operation1_.log_entries(0).SpaceUsedLong());
+}
+
 TEST_F(OperationAggregatorTest, Delta_MergeOperation2AndOperation1) {
   // Merge order does not matter.
   // log_entries is a repeated field, the order is different if added in
@@ -510,6 +532,78 @@ TEST_F(OperationAggregatorTest, DeltaMetricKind_DistributionValue) {
       MessageDifferencer::Equals(iop.ToOperationProto(), delta_merged12_));
 }
 
+TEST_F(OperationAggregatorTest, DeltaMetricKind_DistributionOtherFields) {
+  Distribution distribution;
+  Distribution sum;
+  ASSERT_TRUE(TextFormat::ParseFromString(kDistribution, &distribution));
+  ASSERT_TRUE(TextFormat::ParseFromString(kSumDistribution, &sum));
+  // A field the aggregator does not keep in plain fields, such as one added
+  // to the proto after this client was built.
+  distribution.GetReflection()->MutableUnknownFields(&distribution)->AddVarint(
+      1000, 7);
+
+  // Like the count and buckets, it is kept from the first distribution.
+  SetDistributionValue(distribution, &operation1_);
+  SetDistributionValue(distribution, &operation2_);
+  OperationAggregator iop(operation1_, &delta_metric_kind_);
+  iop.MergeOperation(operation2_);
+
+  const Distribution& merged = iop.ToOperationProto()
+                                   .metric_value_sets(0)
+                                   .metric_values(0)
+                                   .distribution_value();
+  const auto& unknown_fields = merged.GetReflection()->GetUnknownFields(merged);
+  ASSERT_EQ(unknown_fields.field_count(), 1);
+  EXPECT_EQ(unknown_fields.field(0).number(), 1000);
+  EXPECT_EQ(unknown_fields.field(0).varint(), 7);
+  EXPECT_EQ(merged.count(), sum.count());
+}
+
+TEST_F(OperationAggregatorTest, Delta_MultipleMetricValues) {
+  // Metric values with different labels are aggregated separately, and are
+  // flushed in the order they are first seen.
+  Operation operation3 = operation2_;
+  MetricValue* value3 =
+      operation3.mutable_metric_value_sets(0)->mutable_metric_values(0);
+  (*value3->mutable_labels())["method"] = "get";
+  OperationAggregator iop(operation1_, &delta_metric_kind_);
+  iop.MergeOperation(operation3);
+  iop.MergeOperation(operation2_);
+  iop.MergeOperation(operation3);
+
+  Operation operation = iop.ToOperationProto();
+  ASSERT_EQ(operation.metric_value_sets_size(), 1);
+  const MetricValueSet& set = operation.metric_value_sets(0);
+  EXPECT_EQ(set.metric_name(), kMetric);
+  ASSERT_EQ(set.metric_values_size(), 2);
+  EXPECT_TRUE(MessageDifferencer::Equals(
+      set.metric_values(0),
+      delta_merged12_.metric_value_sets(0).metric_values(0)));
+  EXPECT_EQ(set.metric_values(1).labels().at("method"), "get");
+  EXPECT_EQ(set.metric_values(1).int64_value(),
+            2 * value3->int64_value());
+}
+
+TEST_F(OperationAggregatorTest, DeltaMetricKind_DistributionBucketsMismatch) {
+  Distribution distribution1;
+  Distribution distribution2;
+  ASSERT_TRUE(DistributionHelper::InitLinear(3, 1, 0, &distribution1).ok());
+  ASSERT_TRUE(DistributionHelper::InitLinear(3, 2, 0, &distribution2).ok());
+  ASSERT_TRUE(DistributionHelper::AddSample(1, &distribution1).ok());
+  ASSERT_TRUE(DistributionHelper::AddSample(1, &distribution2).ok());
+
+  // Distributions with different bucket options are not merged.
+  SetDistributionValue(distribution1, &operation1_);
+  SetDistributionValue(distribution2, &operation2_);
+  OperationAggregator iop(operation1_, &delta_metric_kind_);
+  iop.MergeOperation(operation2_);
+
+  Operation operation = iop.ToOperationProto();
+  EXPECT_TRUE(MessageDifferencer::Equals(
+      operation.metric_value_sets(0).metric_values(0).distribution_value(),
+      distribution1));
+}
+
 }  // namespace
 }  // namespace service_control_client
 }  // namespace google
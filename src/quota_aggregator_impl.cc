@@ -45,6 +45,11 @@ void QuotaAggregatorImpl::CacheElem::Aggregate(
   }
 }
 
+size_t QuotaAggregatorImpl::CacheElem::SpaceUsed() const {
+  return sizeof(CacheElem) + 2 * quota_request_.SpaceUsedLong() +
+         quota_response_->SpaceUsedLong();
+}
+
 AllocateQuotaRequest
 QuotaAggregatorImpl::CacheElem::ReturnAllocateQuotaRequestAndClear(
     const string& service_name, const std::string& service_config_id) {
@@ -72,12 +77,20 @@ QuotaAggregatorImpl::QuotaAggregatorImpl(const std::string& service_name,
     : service_name_(service_name),
       service_config_id_(service_config_id),
       options_(options),
-      in_flush_all_(false) {
+      in_flush_all_(false),
+      in_flush_(false),
+      evictions_(0),
+      expirations_(0) {
   if (options.num_entries > 0) {
+    int64_t max_units =
+        options.max_bytes > 0 ? options.max_bytes : options.num_entries;
     cache_.reset(new QuotaCache(
-        options.num_entries, std::bind(&QuotaAggregatorImpl::OnCacheEntryDelete,
-                                       this, std::placeholders::_1)));
+        max_units, std::bind(&QuotaAggregatorImpl::OnCacheEntryDelete, this,
+                             std::placeholders::_1)));
     cache_->SetAgeBasedEviction(options.refresh_interval_ms / 1000.0);
+    if (options.tiny_lfu_admission) {
+      sketch_.reset(new FrequencySketch(options.num_entries));
+    }
   }
 
   refresh_interval_in_cycle_ =
@@ -101,6 +114,11 @@ void QuotaAggregatorImpl::SetFlushCallback(FlushCallback callback) {
   InternalSetFlushCallback(callback);
 }
 
+void QuotaAggregatorImpl::SetLockWaitRecorder(
+    std::shared_ptr<LatencyRecorder> recorder) {
+  lock_wait_recorder_ = recorder;
+}
+
 // If the quota could not be handled by the cache, returns NOT_FOUND,
 // caller has to send the request to service control.
 // Otherwise, returns OK and cached response.
@@ -123,61 +141,85 @@ void QuotaAggregatorImpl::SetFlushCallback(FlushCallback callback) {
     return Status(StatusCode::kNotFound, "");
   }
 
-  AllocateQuotaCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  AllocateQuotaCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
-      this, &stack_buffer);
+  // Only the cache lookup and mutation are done with cache_mutex_ held. The
+  // signature is computed before, and the response is copied out after the
+  // lock is released.
+  Signature request_signature =
+      GenerateAllocateQuotaRequestSignature(request, options_.signature_hash);
 
-  string request_signature = GenerateAllocateQuotaRequestSignature(request);
+  // Holds a reference to the cached response. NULL if it was a cache miss.
+  std::shared_ptr<const AllocateQuotaResponse> cached_response;
 
-  QuotaCache::ScopedLookup lookup(cache_.get(), request_signature);
-  if (!lookup.Found()) {
-    // To avoid sending concurrent allocateQuota from concurrent requests.
-    // insert a temporary positive response to the cache. Requests from other
-    // requests will be aggregated to this temporary element until the
-    // response for the actual request arrives.
-    ::google::api::servicecontrol::v1::AllocateQuotaResponse temp_response;
-    CacheElem* cache_elem = new CacheElem(request, temp_response,
-                                          SimpleCycleTimer::Now());
-    cache_elem->set_signature(request_signature);
-    cache_elem->set_in_flight(true);
-    cache_->Insert(request_signature, cache_elem, 1);
+  AllocateQuotaCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
+  {
+    MutexLock lock =
+        LockAndRecordWait(&cache_mutex_, lock_wait_recorder_.get());
+    AllocateQuotaCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
+        this, &stack_buffer);
+
+    QuotaCache::ScopedLookup lookup(cache_.get(), request_signature);
+    if (sketch_) {
+      sketch_->Increment(request_signature.hash());
+    }
+    if (!lookup.Found()) {
+      // To avoid sending concurrent allocateQuota from concurrent requests.
+      // insert a temporary positive response to the cache. Requests from other
+      // requests will be aggregated to this temporary element until the
+      // response for the actual request arrives.
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse temp_response;
+      std::unique_ptr<CacheElem> cache_elem(
+          new CacheElem(request, temp_response, SimpleCycleTimer::Now()));
+      cache_elem->set_signature(request_signature);
+      cache_elem->set_in_flight(true);
+      size_t units = EntryUnits(*cache_elem);
+      // If not admitted to the full cache, the request is sent without the
+      // temporary element.
+      if (Admit(request_signature, units)) {
+        cache_->Insert(request_signature, cache_elem.release(), units);
+      }
+    } else {
+      if (lookup.value()->in_flight() == false &&
+          ShouldRefresh(*lookup.value()) == true) {
+        // Update in_flight to avoid duplicated request
+        lookup.value()->set_in_flight(true);
+        lookup.value()->set_last_refresh_time(SimpleCycleTimer::Now());
+
+        AllocateQuotaRequest refresh_request =
+            lookup.value()->ReturnAllocateQuotaRequestAndClear(
+                service_name_, service_config_id_);
+        if (!lookup.value()->is_positive_response()) {
+          // If the cached response is negative, then use NORMAL QuotaMode
+          // instead of BEST_EFFORT
+          refresh_request.mutable_allocate_operation()->set_quota_mode(
+              QuotaOperation_QuotaMode::QuotaOperation_QuotaMode_NORMAL);
+        }
 
-    // Triggers refresh
-    AddRemovedItem(request);
+        // Triggers refresh
+        AddRemovedItem(std::move(refresh_request));
+        refreshes_.Increment();
+      }
 
-    // return positive response
-    *response = cache_elem->quota_response();
-    return ::google::protobuf::util::OkStatus();
-  }
+      // Aggregate tokens if the cached response is positive
+      if (lookup.value()->is_positive_response()) {
+        lookup.value()->Aggregate(request);
+      }
 
-  if (lookup.value()->in_flight() == false &&
-      ShouldRefresh(*lookup.value()) == true) {
-    // Update in_flight to avoid duplicated request
-    lookup.value()->set_in_flight(true);
-    lookup.value()->set_last_refresh_time(SimpleCycleTimer::Now());
-
-    AllocateQuotaRequest refresh_request =
-        lookup.value()->ReturnAllocateQuotaRequestAndClear(service_name_,
-                                                           service_config_id_);
-    if(!lookup.value()->is_positive_response()) {
-      // If the cached response is negative, then use NORMAL QuotaMode
-      // instead of BEST_EFFORT
-      refresh_request.mutable_allocate_operation()->
-          set_quota_mode(
-              QuotaOperation_QuotaMode::QuotaOperation_QuotaMode_NORMAL);
+      cached_response = lookup.value()->shared_quota_response();
     }
+  }
 
+  if (!cached_response) {
+    misses_.Increment();
     // Triggers refresh
-    AddRemovedItem(refresh_request);
-  }
+    stack_buffer.Add(request);
 
-  // Aggregate tokens if the cached response is positive
-  if (lookup.value()->is_positive_response()) {
-    lookup.value()->Aggregate(request);
+    // return positive response
+    response->Clear();
+    return ::google::protobuf::util::OkStatus();
   }
 
-  *response = lookup.value()->quota_response();
+  hits_.Increment();
+  *response = *cached_response;
   return ::google::protobuf::util::OkStatus();
 }
 
@@ -189,17 +231,26 @@ void QuotaAggregatorImpl::SetFlushCallback(FlushCallback callback) {
     return ::google::protobuf::util::OkStatus();
   }
 
-  string request_signature = GenerateAllocateQuotaRequestSignature(request);
+  Signature request_signature =
+      GenerateAllocateQuotaRequestSignature(request, options_.signature_hash);
+  // Copies the response before taking the lock.
+  std::shared_ptr<const AllocateQuotaResponse> cached_response =
+      std::make_shared<AllocateQuotaResponse>(response);
 
   AllocateQuotaCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
+  MutexLock lock =
+      LockAndRecordWait(&cache_mutex_, lock_wait_recorder_.get());
   AllocateQuotaCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
       this, &stack_buffer);
 
   QuotaCache::ScopedLookup lookup(cache_.get(), request_signature);
   if (lookup.Found()) {
     lookup.value()->set_in_flight(false);
-    lookup.value()->set_quota_response(response);
+    lookup.value()->set_quota_response(std::move(cached_response));
+    if (options_.max_bytes > 0) {
+      cache_->UpdateSize(request_signature, lookup.value(),
+                         lookup.value()->SpaceUsed());
+    }
   }
 
   return ::google::protobuf::util::OkStatus();
@@ -218,6 +269,19 @@ bool QuotaAggregatorImpl::ShouldRefresh(const CacheElem& elem) const {
   return age >= refresh_interval_in_cycle_;
 }
 
+// Check a request missing the cache can be added to it
+bool QuotaAggregatorImpl::Admit(const Signature& signature,
+                                size_t units) const {
+  if (!sketch_) return true;
+  Signature victim;
+  return !cache_->EvictionCandidate(units, &victim) ||
+         sketch_->Admit(signature.hash(), victim.hash());
+}
+
+size_t QuotaAggregatorImpl::EntryUnits(const CacheElem& elem) const {
+  return options_.max_bytes > 0 ? elem.SpaceUsed() : 1;
+}
+
 // Check the cached element should be dropped from the cache
 bool QuotaAggregatorImpl::ShouldDrop(const CacheElem& elem) const {
   int64_t age = SimpleCycleTimer::Now() - elem.last_refresh_time();
@@ -228,12 +292,15 @@ bool QuotaAggregatorImpl::ShouldDrop(const CacheElem& elem) const {
 // Called at time specified by GetNextFlushInterval().
 ::google::protobuf::util::Status QuotaAggregatorImpl::Flush() {
   AllocateQuotaCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
+  MutexLock lock =
+      LockAndRecordWait(&cache_mutex_, lock_wait_recorder_.get());
   AllocateQuotaCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
       this, &stack_buffer);
 
   if (cache_) {
+    in_flush_ = true;
     cache_->RemoveExpiredEntries();
+    in_flush_ = false;
   }
 
   return OkStatus();
@@ -243,7 +310,8 @@ bool QuotaAggregatorImpl::ShouldDrop(const CacheElem& elem) const {
 // Usually called at destructor.
 ::google::protobuf::util::Status QuotaAggregatorImpl::FlushAll() {
   AllocateQuotaCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
+  MutexLock lock =
+      LockAndRecordWait(&cache_mutex_, lock_wait_recorder_.get());
   AllocateQuotaCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
       this, &stack_buffer);
 
@@ -261,19 +329,38 @@ bool QuotaAggregatorImpl::ShouldDrop(const CacheElem& elem) const {
 void QuotaAggregatorImpl::OnCacheEntryDelete(CacheElem* elem) {
   if (in_flush_all_ == false && ShouldDrop(*elem) == false) {
     // insert the element back to the cache
-    cache_->Insert(elem->signature(), elem, 1);
+    cache_->Insert(elem->signature(), elem, EntryUnits(*elem));
 
     if (elem->in_flight() == false && elem->is_aggregated()) {
       elem->set_in_flight(true);
       elem->set_last_refresh_time(SimpleCycleTimer::Now());
       AddRemovedItem(elem->ReturnAllocateQuotaRequestAndClear(
         service_name_, service_config_id_));
+      refreshes_.Increment();
     }
   } else {
+    if (in_flush_) {
+      ++expirations_;
+    } else if (!in_flush_all_) {
+      ++evictions_;
+    }
     delete elem;
   }
 }
 
+void QuotaAggregatorImpl::GetStatistics(CacheStatistics* stat) {
+  stat->hits = hits_.Value();
+  stat->misses = misses_.Value();
+  stat->refreshes = refreshes_.Value();
+  stat->negative_refreshes = 0;
+  stat->flushes = 0;
+  MutexLock lock(cache_mutex_);
+  stat->evictions = evictions_;
+  stat->expirations = expirations_;
+  stat->entries = cache_ ? cache_->Entries() : 0;
+  stat->bytes = cache_ && options_.max_bytes > 0 ? cache_->Size() : 0;
+}
+
 std::unique_ptr<QuotaAggregator> CreateAllocateQuotaAggregator(
     const std::string& service_name, const std::string& service_config_id,
     const QuotaAggregationOptions& options) {
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef GOOGLE_SERVICE_CONTROL_CLIENT_QUOTA_AGGREGATOR_IMPL_H_
 #define GOOGLE_SERVICE_CONTROL_CLIENT_QUOTA_AGGREGATOR_IMPL_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -29,6 +30,10 @@ limitations under the License.
 #include "src/aggregator_interface.h"
 #include "src/cache_removed_items_handler.h"
 #include "src/quota_operation_aggregator.h"
+#include "src/signature.h"
+#include "utils/frequency_sketch.h"
+#include "utils/latency_recorder.h"
+#include "utils/sharded_counter.h"
 #include "utils/simple_lru_cache.h"
 #include "utils/simple_lru_cache_inl.h"
 #include "utils/thread.h"
@@ -58,6 +63,9 @@ class QuotaAggregatorImpl : public QuotaAggregator,
   // It will cause dead-lock.
   void SetFlushCallback(FlushCallback callback);
 
+  // Sets the recorder of the time spent waiting for the contended cache lock.
+  void SetLockWaitRecorder(std::shared_ptr<LatencyRecorder> recorder);
+
   // If the quota could not be handled by the cache, returns NOT_FOUND,
   // caller has to send the request to service control.
   // Otherwise, returns OK and cached response.
@@ -79,7 +87,9 @@ class QuotaAggregatorImpl : public QuotaAggregator,
                   response, const int64_t time)
         : operation_aggregator_(nullptr),
           quota_request_(request),
-          quota_response_(response),
+          quota_response_(std::make_shared<
+                          ::google::api::servicecontrol::v1::
+                              AllocateQuotaResponse>(response)),
           last_refresh_time_(time),
           in_flight_(false) {}
 
@@ -93,33 +103,52 @@ class QuotaAggregatorImpl : public QuotaAggregator,
                                        const std::string& service_config_id);
 
     // Change the negative response to the positive response for refreshing
-    void ClearAllocationErrors() { quota_response_.clear_allocate_errors(); }
+    void ClearAllocationErrors() {
+      auto response = std::make_shared<
+          ::google::api::servicecontrol::v1::AllocateQuotaResponse>(
+          *quota_response_);
+      response->clear_allocate_errors();
+      quota_response_ = response;
+    }
 
-    // Setter for quota_response_.
+    // Setter for quota_response_. The response is immutable once cached, so
+    // it can be built before the cache lock is taken.
     inline void set_quota_response(
-        const ::google::api::servicecontrol::v1::AllocateQuotaResponse&
+        std::shared_ptr<
+            const ::google::api::servicecontrol::v1::AllocateQuotaResponse>
             quota_response) {
-      quota_response_ = quota_response;
-
-      if(quota_response.allocate_errors_size() > 0) {
+      if (quota_response->allocate_errors_size() > 0) {
         operation_aggregator_ = NULL;
       }
+      quota_response_ = std::move(quota_response);
     }
 
     // Getter for quota_response_.
     inline const ::google::api::servicecontrol::v1::AllocateQuotaResponse&
     quota_response() const {
+      return *quota_response_;
+    }
+
+    // Returns a reference to the cached response. Callers holding it can
+    // read the response after the cache lock is released.
+    inline std::shared_ptr<
+        const ::google::api::servicecontrol::v1::AllocateQuotaResponse>
+    shared_quota_response() const {
       return quota_response_;
     }
 
+    // Returns the approximate number of bytes used by this entry. The
+    // aggregated request is counted as a copy of the initial one.
+    size_t SpaceUsed() const;
+
     // Return true if aggregated
     inline bool is_aggregated() const {
       return operation_aggregator_ != nullptr;
     }
 
     // Getter and Setter of signature_
-    inline std::string signature() const { return signature_; }
-    inline void set_signature(std::string v) { signature_ = v; }
+    inline const Signature& signature() const { return signature_; }
+    inline void set_signature(const Signature& v) { signature_ = v; }
 
     // Getter and Setter of in_flight_
     inline bool in_flight() const { return in_flight_; }
@@ -143,11 +172,13 @@ class QuotaAggregatorImpl : public QuotaAggregator,
     // The AllocateQuotaRequest for the initial allocate quota request.
     ::google::api::servicecontrol::v1::AllocateQuotaRequest quota_request_;
 
-    // The AllocateQuotaResponse for the last request.
-    ::google::api::servicecontrol::v1::AllocateQuotaResponse quota_response_;
+    // The AllocateQuotaResponse for the last request. Never NULL.
+    std::shared_ptr<
+        const ::google::api::servicecontrol::v1::AllocateQuotaResponse>
+        quota_response_;
 
     // maintain the signature to move unnecessary signature generation
-    std::string signature_;
+    Signature signature_;
 
     // the last refresh time of the cached element
     int64_t last_refresh_time_;
@@ -159,9 +190,11 @@ class QuotaAggregatorImpl : public QuotaAggregator,
   using CacheDeleter = std::function<void(CacheElem*)>;
 
   // Key is the signature of the check request. Value is the CacheElem.
-  // It is a LRU cache with MaxIdelTime as response_expiration_time.
-  using QuotaCache =
-      SimpleLRUCacheWithDeleter<std::string, CacheElem, CacheDeleter>;
+  // It is a LRU cache with MaxIdelTime as response_expiration_time, on the
+  // open-addressing table backend.
+  using QuotaCache = SimpleLRUCacheWithDeleter<
+      Signature, CacheElem, CacheDeleter, internal::SimpleLRUHash<Signature>,
+      std::equal_to<Signature>, SimpleLRUCacheFlatMap<Signature, CacheElem>>;
 
   // Methods from: QuotaAggregator interface
 
@@ -179,10 +212,21 @@ class QuotaAggregatorImpl : public QuotaAggregator,
   // Usually called at destructor.
   virtual ::google::protobuf::util::Status FlushAll();
 
+  // Gets the statistics of the cache.
+  virtual void GetStatistics(CacheStatistics* stat);
+
   bool ShouldRefresh(const CacheElem& elem) const;
 
   bool ShouldDrop(const CacheElem& elem) const;
 
+  // Returns whether a request missing the cache is admitted to it, with an
+  // entry of the given units. Must be called with cache_mutex_ held.
+  bool Admit(const Signature& signature, size_t units) const;
+
+  // Returns the units of an entry in the cache: its approximate bytes if the
+  // cache is bounded by bytes, 1 otherwise.
+  size_t EntryUnits(const CacheElem& elem) const;
+
  private:
   // The service name for this cache.
   const std::string service_name_;
@@ -195,8 +239,16 @@ class QuotaAggregatorImpl : public QuotaAggregator,
   // Mutex guarding the access of cache_;
   Mutex cache_mutex_;
 
+  // Records the time waited for cache_mutex_ when contended. Null if not
+  // recorded.
+  std::shared_ptr<LatencyRecorder> lock_wait_recorder_;
+
   std::unique_ptr<QuotaCache> cache_;
 
+  // Estimates how often the requests were recently used, for the cache
+  // admission. Null if disabled. Guarded by cache_mutex_.
+  std::unique_ptr<FrequencySketch> sketch_;
+
   // flush interval in cycles.
   int64_t refresh_interval_in_cycle_;
 
@@ -205,6 +257,18 @@ class QuotaAggregatorImpl : public QuotaAggregator,
 
   bool in_flush_all_;
 
+  // Whether Flush() is removing the expired entries. Guarded by cache_mutex_.
+  bool in_flush_;
+
+  // The counters of CacheStatistics. Entries removed by the cache are put
+  // back unless they expired, so evictions and expirations are counted by
+  // OnCacheEntryDelete(), under cache_mutex_.
+  ShardedCounter hits_;
+  ShardedCounter misses_;
+  ShardedCounter refreshes_;
+  int64_t evictions_;
+  int64_t expirations_;
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(QuotaAggregatorImpl);
 };
 
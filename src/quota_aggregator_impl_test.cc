@@ -276,6 +276,61 @@ TEST_F(QuotaAggregatorImplTest, TestCacheElementDrop) {
 }
 
 
+TEST_F(QuotaAggregatorImplTest, TestStatistics) {
+  AllocateQuotaResponse response;
+
+  EXPECT_OK(aggregator_->Quota(request1_, &response));
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  EXPECT_OK(aggregator_->Quota(request1_, &response));
+
+  CacheStatistics stat;
+  aggregator_->GetStatistics(&stat);
+  EXPECT_EQ(stat.hits, 1);
+  EXPECT_EQ(stat.misses, 1);
+  EXPECT_EQ(stat.entries, 1);
+  EXPECT_EQ(stat.expirations, 0);
+
+  // An idle entry is dropped by Flush() once it expires.
+  std::this_thread::sleep_for(std::chrono::milliseconds(kExpirationMs + 10));
+  EXPECT_OK(aggregator_->Flush());
+
+  aggregator_->GetStatistics(&stat);
+  EXPECT_EQ(stat.entries, 0);
+  EXPECT_EQ(stat.expirations, 1);
+  EXPECT_EQ(stat.evictions, 0);
+}
+
+
+TEST_F(QuotaAggregatorImplTest, TestTinyLfuAdmission) {
+  QuotaAggregationOptions options(1, kFlushIntervalMs, kExpirationMs);
+  options.tiny_lfu_admission = true;
+  aggregator_ =
+      CreateAllocateQuotaAggregator(kServiceName, kServiceConfigId, options);
+  aggregator_->SetFlushCallback(std::bind(
+      &QuotaAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+
+  AllocateQuotaResponse response;
+  EXPECT_OK(aggregator_->Quota(request1_, &response));
+  EXPECT_OK(aggregator_->CacheResponse(request1_, pass_response1_));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_OK(aggregator_->Quota(request1_, &response));
+  }
+  EXPECT_EQ(flushed_.size(), 1);
+
+  // request2 was used less often than request1, so it is sent to the server
+  // without being cached.
+  EXPECT_OK(aggregator_->Quota(request2_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, empty_response_));
+  EXPECT_EQ(flushed_.size(), 2);
+  EXPECT_OK(aggregator_->CacheResponse(request2_, pass_response2_));
+  EXPECT_OK(aggregator_->Quota(request2_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, empty_response_));
+  EXPECT_EQ(flushed_.size(), 3);
+
+  EXPECT_OK(aggregator_->Quota(request1_, &response));
+  EXPECT_TRUE(MessageDifferencer::Equals(response, pass_response1_));
+}
+
 TEST_F(QuotaAggregatorImplTest, TestNotMatchingServiceName) {
   *(request1_.mutable_service_name()) = "some-other-service-name";
   AllocateQuotaResponse response;
@@ -18,6 +18,8 @@ limitations under the License.
 
 #include "google/protobuf/stubs/logging.h"
 
+#include <algorithm>
+
 using std::string;
 using ::google::api::MetricDescriptor;
 using ::google::api::servicecontrol::v1::Operation;
@@ -57,11 +59,22 @@ ReportAggregatorImpl::ReportAggregatorImpl(
       options_(options),
       metric_kinds_(metric_kinds) {
   if (options.num_entries > 0) {
-    cache_.reset(
-        new ReportCache(options.num_entries,
-                        std::bind(&ReportAggregatorImpl::OnCacheEntryDelete,
-                                  this, std::placeholders::_1)));
-    cache_->SetAgeBasedEviction(options.flush_interval_ms / 1000.0);
+    int num_shards =
+        std::min(std::max(options.num_shards, 1), options.num_entries);
+    // Rounds up so the total capacity is at least num_entries.
+    int shard_entries = (options.num_entries + num_shards - 1) / num_shards;
+    int64_t shard_units = shard_entries;
+    if (options.max_bytes > 0) {
+      shard_units = (options.max_bytes + num_shards - 1) / num_shards;
+    }
+    for (int i = 0; i < num_shards; ++i) {
+      CacheShard* shard = new CacheShard;
+      shard->cache.reset(new ReportCache(
+          shard_units, std::bind(&ReportAggregatorImpl::OnCacheEntryDelete,
+                                   this, shard, std::placeholders::_1)));
+      shard->cache->SetAgeBasedEviction(options.flush_interval_ms / 1000.0);
+      shards_.emplace_back(shard);
+    }
   }
 }
 
@@ -78,90 +91,219 @@ void ReportAggregatorImpl::SetFlushCallback(FlushCallback callback) {
   InternalSetFlushCallback(callback);
 }
 
+void ReportAggregatorImpl::SetLockWaitRecorder(
+    std::shared_ptr<LatencyRecorder> recorder) {
+  lock_wait_recorder_ = recorder;
+}
+
 // Add a report request to cache
 Status ReportAggregatorImpl::Report(
     const ::google::api::servicecontrol::v1::ReportRequest& request) {
+  Status status = CheckCacheable(request);
+  if (status.ok()) {
+    MergeRequests(std::vector<const ReportRequest*>(1, &request));
+  }
+  return status;
+}
+
+void ReportAggregatorImpl::ReportBatch(
+    const std::vector<ReportRequest>& requests, std::vector<Status>* statuses) {
+  statuses->clear();
+  statuses->reserve(requests.size());
+  std::vector<const ReportRequest*> cacheable_requests;
+  cacheable_requests.reserve(requests.size());
+  for (const auto& request : requests) {
+    statuses->push_back(CheckCacheable(request));
+    if (statuses->back().ok()) {
+      cacheable_requests.push_back(&request);
+    }
+  }
+  if (!cacheable_requests.empty()) {
+    MergeRequests(cacheable_requests);
+  }
+}
+
+Status ReportAggregatorImpl::CheckCacheable(const ReportRequest& request) {
   if (request.service_name() != service_name_) {
     return Status(StatusCode::kInvalidArgument,
                   (string("Invalid service name: ") + request.service_name() +
                    string(" Expecting: ") + service_name_));
   }
-  if (HasHighImportantOperation(request) || !cache_) {
+  if (HasHighImportantOperation(request) || shards_.empty()) {
     // By returning NO_FOUND, caller will send request to server.
     return Status(StatusCode::kNotFound, "");
   }
+  return OkStatus();
+}
 
+void ReportAggregatorImpl::MergeRequests(
+    const std::vector<const ReportRequest*>& requests) {
+  // Signatures are computed before taking any lock. Operations are then
+  // grouped by shard so each shard is locked once per call, and by signature
+  // so each signature is looked up once per call.
+  struct ShardOperation {
+    size_t shard;
+    Signature signature;
+    const Operation* operation;
+  };
+  std::vector<ShardOperation> shard_operations;
+  for (const ReportRequest* request : requests) {
+    for (const auto& operation : request->operations()) {
+      Signature signature =
+          GenerateReportOperationSignature(operation, options_.signature_hash);
+      shard_operations.push_back(
+          {GetSignatureShard(signature, shards_.size()), signature,
+           &operation});
+    }
+  }
+  // Operations with the same signature are merged in their original order.
+  std::stable_sort(shard_operations.begin(), shard_operations.end(),
+                   [](const ShardOperation& a, const ShardOperation& b) {
+                     return a.shard < b.shard ||
+                            (a.shard == b.shard && a.signature < b.signature);
+                   });
+
+  // Removed items are flushed out after all shard locks are released.
   ReportCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  ReportCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                               &stack_buffer);
+  std::vector<const Operation*> operations;
+  auto it = shard_operations.begin();
+  while (it != shard_operations.end()) {
+    CacheShard* shard = shards_[it->shard].get();
+    MutexLock lock =
+        LockAndRecordWait(&shard->mutex, lock_wait_recorder_.get());
+    ReportCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
+        &shard->stack_buffer, &stack_buffer);
 
-  // Starts to cache and aggregate low important operations.
-  for (const auto& operation : request.operations()) {
-    string signature = GenerateReportOperationSignature(operation);
+    // Starts to cache and aggregate low important operations.
+    const size_t shard_index = it->shard;
+    while (it != shard_operations.end() && it->shard == shard_index) {
+      const Signature signature = it->signature;
+      operations.clear();
+      for (; it != shard_operations.end() && it->shard == shard_index &&
+             it->signature == signature;
+           ++it) {
+        operations.push_back(it->operation);
+      }
+      MergeOperations(shard, signature, operations);
+    }
+  }
+}
 
+void ReportAggregatorImpl::MergeOperations(
+    CacheShard* shard, const Signature& signature,
+    const std::vector<const Operation*>& operations) {
+  auto it = operations.begin();
+  while (it != operations.end()) {
     bool too_big = false;
     {
-      ReportCache::ScopedLookup lookup(cache_.get(), signature);
+      ReportCache::ScopedLookup lookup(shard->cache.get(), signature);
+      // A new entry is only inserted once all its operations are merged: if
+      // it is larger than the cache, Insert() evicts and deletes it at once.
+      std::unique_ptr<OperationAggregator> new_iop;
+      OperationAggregator* iop = nullptr;
       if (lookup.Found()) {
-        lookup.value()->MergeOperation(operation);
-        too_big = lookup.value()->TooBig();
+        iop = lookup.value();
       } else {
-        OperationAggregator* iop =
-            new OperationAggregator(operation, metric_kinds_.get());
-        cache_->Insert(signature, iop, 1);
+        new_iop.reset(new OperationAggregator(**it++, metric_kinds_.get(),
+                                              options_.signature_hash));
+        iop = new_iop.get();
+        misses_.Increment();
+      }
+      size_t space_used = iop->SpaceUsed();
+      auto merged = it;
+      while (!too_big && it != operations.end()) {
+        iop->MergeOperation(**it++);
+        too_big = iop->TooBig();
+      }
+      hits_.Add(it - merged);
+      if (new_iop) {
+        size_t units = options_.max_bytes > 0 ? iop->SpaceUsed() : 1;
+        shard->cache->Insert(signature, new_iop.release(), units);
+      } else if (options_.max_bytes > 0 && !too_big &&
+                 iop->SpaceUsed() != space_used) {
+        // The entry is pinned by the lookup, so it is not evicted here.
+        shard->cache->UpdateSize(signature, iop, iop->SpaceUsed());
       }
     }
     // If the merged operation is too big, remove it from the cache
     // to flush it out. Make sure to do that outside of lookup scope.
     if (too_big) {
-      cache_->Remove(signature);
+      shard->cache->Remove(signature);
     }
   }
-  return OkStatus();
 }
 
-void ReportAggregatorImpl::OnCacheEntryDelete(OperationAggregator* iop) {
+void ReportAggregatorImpl::OnCacheEntryDelete(CacheShard* shard,
+                                              OperationAggregator* iop) {
   // iop or cache is under projected.  This function is only called when
   // cache::Insert() or cache::Removed() is called and these operations
-  // are already protected by cache_mutex.
-  ReportRequest request;
-  request.set_service_name(service_name_);
-  request.set_service_config_id(service_config_id_);
-  // TODO(qiwzhang): Remove this copy
-  *(request.add_operations()) = iop->ToOperationProto();
-  delete iop;
-
-  AddRemovedItem(request);
-}
-
-bool ReportAggregatorImpl::MergeItem(const ReportRequest& new_item,
-                                     ReportRequest* old_item) {
-  if (old_item->service_name() != new_item.service_name() ||
-      old_item->operations().size() + new_item.operations().size() >
-          kMaxOperationsToSend) {
-    return false;
+  // are already protected by the shard mutex.
+  std::unique_ptr<OperationAggregator> owned_iop(iop);
+  ReportCacheRemovedItemsHandler::StackBuffer* stack_buffer =
+      shard->stack_buffer;
+  if (stack_buffer == nullptr) {
+    return;
+  }
+
+  // Appends the operation to the last request of the flush batch until it
+  // is full. Requests are allocated on the arena of the batch.
+  ReportRequest* request = stack_buffer->last_item();
+  if (request == nullptr ||
+      request->operations_size() >= kMaxOperationsToSend) {
+    request = stack_buffer->AddNew();
+    request->set_service_name(service_name_);
+    request->set_service_config_id(service_config_id_);
+  }
+
+  // The operation is moved out on the heap, and the arena takes it over
+  // instead of copying it.
+  Operation* operation = new Operation;
+  owned_iop->MoveToOperationProto(operation);
+  request->mutable_operations()->AddAllocated(operation);
+  flushes_.Increment();
+}
+
+void ReportAggregatorImpl::GetStatistics(CacheStatistics* stat) {
+  stat->hits = hits_.Value();
+  stat->misses = misses_.Value();
+  stat->refreshes = 0;
+  stat->negative_refreshes = 0;
+  stat->flushes = flushes_.Value();
+  stat->evictions = 0;
+  stat->expirations = 0;
+  stat->entries = 0;
+  stat->bytes = 0;
+  for (const auto& shard : shards_) {
+    MutexLock lock(shard->mutex);
+    stat->evictions += shard->cache->Evictions();
+    stat->expirations += shard->cache->Expirations();
+    stat->entries += shard->cache->Entries();
+    if (options_.max_bytes > 0) {
+      stat->bytes += shard->cache->Size();
+    }
   }
-  old_item->MergeFrom(new_item);
-  return true;
 }
 
 // When the next Flush() should be called.
 // Return in ms from now, or -1 for never
 int ReportAggregatorImpl::GetNextFlushInterval() {
-  if (!cache_) return -1;
+  if (shards_.empty()) return -1;
   return options_.flush_interval_ms;
 }
 
 // Flush aggregated requests whom are longer than flush_interval.
 // Called at time specified by GetNextFlushInterval().
+// Shards are drained one at a time, so Report() calls are only blocked while
+// their own shard is being drained. Expired items of all shards are batched
+// together and flushed out after the last shard lock is released.
 Status ReportAggregatorImpl::Flush() {
   ReportCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  ReportCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                               &stack_buffer);
-  if (cache_) {
-    cache_->RemoveExpiredEntries();
+  for (const auto& shard : shards_) {
+    MutexLock lock =
+        LockAndRecordWait(&shard->mutex, lock_wait_recorder_.get());
+    ReportCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
+        &shard->stack_buffer, &stack_buffer);
+    shard->cache->RemoveExpiredEntries();
   }
   return OkStatus();
 }
@@ -170,11 +312,12 @@ Status ReportAggregatorImpl::Flush() {
 // Usually called at destructor.
 Status ReportAggregatorImpl::FlushAll() {
   ReportCacheRemovedItemsHandler::StackBuffer stack_buffer(this);
-  MutexLock lock(cache_mutex_);
-  ReportCacheRemovedItemsHandler::StackBuffer::Swapper swapper(this,
-                                                               &stack_buffer);
-  if (cache_) {
-    cache_->RemoveAll();
+  for (const auto& shard : shards_) {
+    MutexLock lock =
+        LockAndRecordWait(&shard->mutex, lock_wait_recorder_.get());
+    ReportCacheRemovedItemsHandler::StackBuffer::Swapper swapper(
+        &shard->stack_buffer, &stack_buffer);
+    shard->cache->RemoveAll();
   }
   return OkStatus();
 }
@@ -21,6 +21,7 @@ limitations under the License.
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "google/api/metric.pb.h"
 #include "google/api/servicecontrol/v1/operation.pb.h"
@@ -28,6 +29,9 @@ limitations under the License.
 #include "src/aggregator_interface.h"
 #include "src/cache_removed_items_handler.h"
 #include "src/operation_aggregator.h"
+#include "src/signature.h"
+#include "utils/latency_recorder.h"
+#include "utils/sharded_counter.h"
 #include "utils/simple_lru_cache.h"
 #include "utils/simple_lru_cache_inl.h"
 #include "utils/thread.h"
@@ -55,11 +59,20 @@ class ReportAggregatorImpl : public ReportAggregator,
   // Sets the flush callback function.
   virtual void SetFlushCallback(FlushCallback callback);
 
+  // Sets the recorder of the time spent waiting for contended shard locks.
+  virtual void SetLockWaitRecorder(std::shared_ptr<LatencyRecorder> recorder);
+
   // Adds a report request to cache. Returns NOT_FOUND if it could not be
   // aggregated. Callers need to send it to the server.
   virtual ::google::protobuf::util::Status Report(
       const ::google::api::servicecontrol::v1::ReportRequest& request);
 
+  // Adds a batch of report requests to cache, locking each shard once.
+  virtual void ReportBatch(
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          requests,
+      std::vector<::google::protobuf::util::Status>* statuses);
+
   // When the next Flush() should be called.
   // Returns in ms from now, or -1 for never
   virtual int GetNextFlushInterval();
@@ -74,21 +87,55 @@ class ReportAggregatorImpl : public ReportAggregator,
   // the flush_callback() function return.
   virtual ::google::protobuf::util::Status FlushAll();
 
+  // Gets the statistics of the cache.
+  virtual void GetStatistics(CacheStatistics* stat);
+
  private:
   using CacheDeleter = std::function<void(OperationAggregator*)>;
   // Key is the signature of the operation. Value is the
-  // OperationAggregator.
-  using ReportCache =
-      SimpleLRUCacheWithDeleter<std::string, OperationAggregator, CacheDeleter>;
+  // OperationAggregator. Uses the open-addressing table backend.
+  using ReportCache = SimpleLRUCacheWithDeleter<
+      Signature, OperationAggregator, CacheDeleter,
+      internal::SimpleLRUHash<Signature>, std::equal_to<Signature>,
+      SimpleLRUCacheFlatMap<Signature, OperationAggregator>>;
+
+  // One shard of the report cache. An operation is always mapped to the same
+  // shard by its signature.
+  struct CacheShard {
+    CacheShard() : stack_buffer(nullptr) {}
+
+    // Mutex guarding the access of cache and stack_buffer.
+    Mutex mutex;
+
+    // The cache that maps from operation signature to an operation.
+    std::unique_ptr<ReportCache> cache;
+
+    // Points to the StackBuffer of the call holding the mutex. Set by
+    // StackBuffer::Swapper. Guarded by mutex.
+    StackBuffer* stack_buffer;
+  };
+
+  // Returns OK if the request can be aggregated, NOT_FOUND if it has to be
+  // sent to the server, or INVALID_ARGUMENT.
+  ::google::protobuf::util::Status CheckCacheable(
+      const ::google::api::servicecontrol::v1::ReportRequest& request);
 
-  // Callback function passed to Cache, called when a cache item is removed.
-  // Takes ownership of the iop.
-  void OnCacheEntryDelete(OperationAggregator* iop);
+  // Merges the operations of the given cacheable requests into the cache.
+  void MergeRequests(const std::vector<
+                     const ::google::api::servicecontrol::v1::ReportRequest*>&
+                         requests);
+
+  // Merges the operations, all having the given signature, into the shard.
+  // Must be called with shard->mutex held and shard->stack_buffer set.
+  void MergeOperations(
+      CacheShard* shard, const Signature& signature,
+      const std::vector<const ::google::api::servicecontrol::v1::Operation*>&
+          operations);
 
-  // Tries to merge two report requests.
-  bool MergeItem(
-      const ::google::api::servicecontrol::v1::ReportRequest& new_item,
-      ::google::api::servicecontrol::v1::ReportRequest* old_item);
+  // Callback function passed to Cache, called when a cache item is removed.
+  // Takes ownership of the iop, and moves its operation into the report
+  // requests of the shard's stack buffer.
+  void OnCacheEntryDelete(CacheShard* shard, OperationAggregator* iop);
 
   // The service name.
   const std::string service_name_;
@@ -101,14 +148,21 @@ class ReportAggregatorImpl : public ReportAggregator,
   // Defaults to DELTA if not specified. Not owned.
   std::shared_ptr<MetricKindMap> metric_kinds_;
 
-  // Mutex guarding the access of cache_;
-  Mutex cache_mutex_;
-
-  // The cache that maps from operation signature to an operation.
-  // We don't calculate fine grained cost for cache entries, assign each
-  // entry 1 cost unit.
-  // Guarded by mutex_, except when compare against nullptr.
-  std::unique_ptr<ReportCache> cache_;
+  // The cache shards. Empty if the cache is disabled.
+  // Each entry costs 1 unit by default, or its approximate size in bytes if
+  // options_.max_bytes is set.
+  // Each shard is guarded by its own mutex. The vector itself is only
+  // modified in the constructor.
+  std::vector<std::unique_ptr<CacheShard>> shards_;
+
+  // Records the time waited for contended shard locks. Null if not recorded.
+  std::shared_ptr<LatencyRecorder> lock_wait_recorder_;
+
+  // The counters of CacheStatistics, in operations. Evictions and
+  // expirations are counted by the shard caches.
+  ShardedCounter hits_;
+  ShardedCounter misses_;
+  ShardedCounter flushes_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReportAggregatorImpl);
 };
@@ -273,6 +273,73 @@ TEST_F(ReportAggregatorImplTest, TestCacheCapacity) {
   EXPECT_TRUE(MessageDifferencer::Equals(flushed_[1], request2_));
 }
 
+TEST_F(ReportAggregatorImplTest, TestStatistics) {
+  EXPECT_OK(aggregator_->Report(request1_));
+  EXPECT_OK(aggregator_->Report(request1_));
+
+  // request2_ has a different signature and evicts request1.
+  AddLabel("key1", "value1", request2_.mutable_operations(0));
+  EXPECT_OK(aggregator_->Report(request2_));
+  EXPECT_EQ(flushed_.size(), 1);
+
+  CacheStatistics stat;
+  aggregator_->GetStatistics(&stat);
+  EXPECT_EQ(stat.hits, 1);
+  EXPECT_EQ(stat.misses, 2);
+  EXPECT_EQ(stat.flushes, 1);
+  EXPECT_EQ(stat.evictions, 1);
+  EXPECT_EQ(stat.expirations, 0);
+  EXPECT_EQ(stat.entries, 1);
+}
+
+TEST_F(ReportAggregatorImplTest, TestCacheMaxBytes) {
+  OperationAggregator iop(request1_.operations(0), nullptr);
+  ReportAggregationOptions options(10 /*entries*/, 1000 /*flush_interval_ms*/);
+  options.max_bytes = 3 * iop.SpaceUsed();
+  aggregator_ = CreateReportAggregator(
+      kServiceName, kServiceConfigId, options,
+      std::shared_ptr<MetricKindMap>(new MetricKindMap));
+  aggregator_->SetFlushCallback(std::bind(
+      &ReportAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+
+  AddLabel("key1", "value1", request2_.mutable_operations(0));
+  EXPECT_OK(aggregator_->Report(request2_));
+  EXPECT_OK(aggregator_->Report(request1_));
+  EXPECT_EQ(flushed_.size(), 0);
+
+  // The log entries merged into request1 grow it until request2 is evicted.
+  for (int i = 0; i < 20 && flushed_.empty(); ++i) {
+    EXPECT_OK(aggregator_->Report(request1_));
+  }
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_TRUE(MessageDifferencer::Equals(flushed_[0], request2_));
+}
+
+TEST_F(ReportAggregatorImplTest, TestCacheMaxBytesOperationTooLarge) {
+  OperationAggregator iop(request1_.operations(0), nullptr);
+  ReportAggregationOptions options(10 /*entries*/, 1000 /*flush_interval_ms*/,
+                                   4 /*shards*/);
+  // Each of the 4 shards gets half the size of one operation.
+  options.max_bytes = 2 * iop.SpaceUsed();
+  aggregator_ = CreateReportAggregator(
+      kServiceName, kServiceConfigId, options,
+      std::shared_ptr<MetricKindMap>(new MetricKindMap));
+  aggregator_->SetFlushCallback(std::bind(
+      &ReportAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+
+  // All operations of request1 are merged before the entry is evicted at
+  // once, and flushed out.
+  ReportRequest request = request1_;
+  for (int i = 0; i < 10; ++i) {
+    *request.add_operations() = request1_.operations(0);
+  }
+  EXPECT_OK(aggregator_->Report(request));
+  ASSERT_EQ(flushed_.size(), 1);
+  ASSERT_EQ(flushed_[0].operations_size(), 1);
+  EXPECT_EQ(flushed_[0].operations(0).log_entries_size(),
+            11 * request1_.operations(0).log_entries_size());
+}
+
 TEST_F(ReportAggregatorImplTest, TestCacheExpiration) {
   EXPECT_OK(aggregator_->Report(request1_));
   // Item cached, nothing flushed out
@@ -345,5 +412,130 @@ TEST_F(ReportAggregatorImplTest, TestReportWithCallbackCallingFlush) {
   EXPECT_TRUE(MessageDifferencer::Equals(flushed_[1], request2_));
 }
 
+TEST_F(ReportAggregatorImplTest, TestShardedCache) {
+  ReportAggregationOptions options(10 /*entries*/, 1000 /*flush_interval_ms*/,
+                                   4 /*shards*/);
+  aggregator_ =
+      CreateReportAggregator(kServiceName, kServiceConfigId, options,
+                             std::shared_ptr<MetricKindMap>(new MetricKindMap));
+  aggregator_->SetFlushCallback(std::bind(
+      &ReportAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+
+  // One request carrying operations with three different signatures.
+  ReportRequest request = request1_;
+  for (int i = 0; i < 2; ++i) {
+    Operation* operation = request.add_operations();
+    *operation = request2_.operations(0);
+    AddLabel("key", std::to_string(i), operation);
+  }
+  EXPECT_OK(aggregator_->Report(request));
+  EXPECT_OK(aggregator_->Report(request1_));
+  EXPECT_EQ(flushed_.size(), 0);
+
+  EXPECT_OK(aggregator_->Flush());
+  // Not expired yet, nothing flush out.
+  EXPECT_EQ(flushed_.size(), 0);
+
+  EXPECT_OK(aggregator_->FlushAll());
+  // Operations from all shards are batched into one request.
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_EQ(flushed_[0].operations_size(), 3);
+  int64_t total = 0;
+  for (const auto& operation : flushed_[0].operations()) {
+    total += operation.metric_value_sets(0).metric_values(0).int64_value();
+  }
+  EXPECT_EQ(total, 1000 + 1000 + 2000 + 2000);
+}
+
+TEST_F(ReportAggregatorImplTest, TestShardedCacheExpiration) {
+  ReportAggregationOptions options(10 /*entries*/, 1000 /*flush_interval_ms*/,
+                                   4 /*shards*/);
+  aggregator_ =
+      CreateReportAggregator(kServiceName, kServiceConfigId, options,
+                             std::shared_ptr<MetricKindMap>(new MetricKindMap));
+  aggregator_->SetFlushCallback(std::bind(
+      &ReportAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+
+  EXPECT_OK(aggregator_->Report(request1_));
+  AddLabel("key1", "value1", request2_.mutable_operations(0));
+  EXPECT_OK(aggregator_->Report(request2_));
+  EXPECT_EQ(flushed_.size(), 0);
+
+  // sleep 1.2 second.
+  usleep(1200000);
+  EXPECT_OK(aggregator_->Flush());
+  // Both items should be expired now.
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_EQ(flushed_[0].operations_size(), 2);
+}
+
+TEST_F(ReportAggregatorImplTest, TestFlushBatchesOperations) {
+  ReportAggregationOptions options(100 /*entries*/,
+                                   1000 /*flush_interval_ms*/);
+  aggregator_ =
+      CreateReportAggregator(kServiceName, kServiceConfigId, options,
+                             std::shared_ptr<MetricKindMap>(new MetricKindMap));
+  aggregator_->SetFlushCallback(std::bind(
+      &ReportAggregatorImplTest::FlushCallback, this, std::placeholders::_1));
+
+  for (int i = 0; i < 25; ++i) {
+    ReportRequest request = request1_;
+    AddLabel("key", std::to_string(i), request.mutable_operations(0));
+    EXPECT_OK(aggregator_->Report(request));
+  }
+  EXPECT_EQ(flushed_.size(), 0);
+
+  // A flushed request carries at most 10 operations.
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 3);
+  EXPECT_EQ(flushed_[0].operations_size(), 10);
+  EXPECT_EQ(flushed_[1].operations_size(), 10);
+  EXPECT_EQ(flushed_[2].operations_size(), 5);
+  for (const auto& request : flushed_) {
+    EXPECT_EQ(request.service_name(), kServiceName);
+    EXPECT_EQ(request.service_config_id(), kServiceConfigId);
+    for (const auto& operation : request.operations()) {
+      EXPECT_EQ(operation.metric_value_sets(0).metric_values(0).int64_value(),
+                1000);
+    }
+  }
+}
+
+TEST_F(ReportAggregatorImplTest, TestReportBatch) {
+  ReportRequest high_request = request1_;
+  high_request.mutable_operations(0)->set_importance(Operation::HIGH);
+  ReportRequest invalid_request = request1_;
+  invalid_request.set_service_name("some-other-service-name");
+
+  std::vector<Status> statuses;
+  aggregator_->ReportBatch(
+      {request1_, high_request, invalid_request, request2_}, &statuses);
+  ASSERT_EQ(statuses.size(), 4);
+  EXPECT_OK(statuses[0]);
+  EXPECT_EQ(statuses[1].code(), StatusCode::kNotFound);
+  EXPECT_EQ(statuses[2].code(), StatusCode::kInvalidArgument);
+  EXPECT_OK(statuses[3]);
+  EXPECT_EQ(flushed_.size(), 0);
+
+  // The operations of request1 and request2 are merged.
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_TRUE(MessageDifferencer::Equals(flushed_[0], delta_merged12_));
+}
+
+TEST_F(ReportAggregatorImplTest, TestReportBatchFlushOutMaxLogEntry) {
+  // Operations of a batch with the same signature are merged until the
+  // merged operation is too big.
+  std::vector<ReportRequest> requests(120, request1_);
+  std::vector<Status> statuses;
+  aggregator_->ReportBatch(requests, &statuses);
+  ASSERT_EQ(flushed_.size(), 1);
+  EXPECT_EQ(flushed_[0].operations(0).log_entries_size(), 100);
+
+  EXPECT_OK(aggregator_->FlushAll());
+  ASSERT_EQ(flushed_.size(), 2);
+  EXPECT_EQ(flushed_[1].operations(0).log_entries_size(), 20);
+}
+
 }  // namespace service_control_client
 }  // namespace google
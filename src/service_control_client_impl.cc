@@ -26,6 +26,8 @@ using ::google::api::servicecontrol::v1::CheckRequest;
 using ::google::api::servicecontrol::v1::CheckResponse;
 using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
 using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::api::servicecontrol::v1::Operation;
 using ::google::api::servicecontrol::v1::ReportRequest;
 using ::google::api::servicecontrol::v1::ReportResponse;
 using ::google::protobuf::util::OkStatus;
@@ -34,6 +36,146 @@ using ::google::protobuf::util::StatusCode;
 
 namespace google {
 namespace service_control_client {
+namespace {
+
+// Returns a pointer to the request which does not own it. Used by the sync
+// calls: they wait until the transport is done with the request, so it does
+// not need to be copied.
+template <class Request>
+std::shared_ptr<const Request> Borrow(const Request& request) {
+  return std::shared_ptr<const Request>(std::shared_ptr<const Request>(),
+                                        &request);
+}
+
+// Makes an async call, and waits for its status.
+Status CallAndWait(
+    std::function<void(ServiceControlClient::DoneCallback)> async_call) {
+  StatusPromise status_promise;
+  StatusFuture status_future = status_promise.get_future();
+
+  async_call([&status_promise](Status status) {
+    // Need to move the promise as it must be owned by the thread where this
+    // lambda is executed rather than the thread where the original call is
+    // executed.
+    // Otherwise, if we call std::promise::set_value(), the original thread will
+    // be unblocked and it might destroy the promise object before set_value()
+    // has a chance to finish.
+    StatusPromise moved_promise(std::move(status_promise));
+    moved_promise.set_value(status);
+  });
+
+  status_future.wait();
+  return status_future.get();
+}
+
+// Joins the async calls of a batch. on_done is called once all of them are
+// done, with the first failure if any.
+class BatchDone : public std::enable_shared_from_this<BatchDone> {
+ public:
+  // The caller making the calls counts as one pending call, so on_done can
+  // not be called before all the calls are started. It calls Done() once it
+  // has started all of them.
+  explicit BatchDone(ServiceControlClient::DoneCallback on_done)
+      : pending_(1), on_done_(on_done) {}
+
+  // Starts one more call of the batch, returning its done callback.
+  ServiceControlClient::DoneCallback Start() {
+    ++pending_;
+    std::shared_ptr<BatchDone> self = shared_from_this();
+    return [self](const Status& status) { self->Done(status); };
+  }
+
+  void Done(const Status& status) {
+    {
+      MutexLock lock(mutex_);
+      if (status_.ok() && !status.ok()) {
+        status_ = status;
+      }
+    }
+    if (--pending_ == 0) {
+      on_done_(status_);
+    }
+  }
+
+ private:
+  std::atomic<int> pending_;
+  ServiceControlClient::DoneCallback on_done_;
+  Mutex mutex_;
+  // The first failure. Guarded by mutex_, and final once pending_ is 0.
+  Status status_;
+};
+
+// Calls the waiters coalesced with a check, which is done with status. The
+// response passed to them is only made if there are waiters and the check
+// succeeded. They get an empty response if it failed, whatever the transport
+// wrote into the response of the check.
+void CallWaiters(
+    const std::vector<CheckCoalescer::Waiter>& waiters, const Status& status,
+    const std::function<std::shared_ptr<const CheckResponse>()>& response) {
+  if (waiters.empty()) {
+    return;
+  }
+  std::shared_ptr<const CheckResponse> shared_response =
+      status.ok() ? response() : std::make_shared<CheckResponse>();
+  for (const auto& waiter : waiters) {
+    waiter(status, shared_response);
+  }
+}
+
+// Returns the time to record a latency from, or 0 if recorder is null.
+int64_t StartLatency(const std::shared_ptr<LatencyRecorder>& recorder) {
+  return recorder ? LatencyRecorder::Now() : 0;
+}
+
+// Records the latency from start, unless recorder is null.
+void RecordLatency(const std::shared_ptr<LatencyRecorder>& recorder,
+                   int64_t start) {
+  if (recorder) {
+    recorder->RecordSince(start);
+  }
+}
+
+// Wraps the on_done of a transport call about to be made, to record its
+// round trip to recorder unless it is null.
+TransportDoneFunc RecordRoundTrip(std::shared_ptr<LatencyRecorder> recorder,
+                                  TransportDoneFunc on_done) {
+  if (!recorder) {
+    return on_done;
+  }
+  int64_t start = LatencyRecorder::Now();
+  return [recorder, start, on_done](const Status& status) {
+    recorder->RecordSince(start);
+    on_done(status);
+  };
+}
+
+// Copies the latencies of recorder to distribution, which is cleared if
+// recorder is null.
+void GetLatencies(const std::shared_ptr<LatencyRecorder>& recorder,
+                  Distribution* distribution) {
+  if (recorder) {
+    recorder->ToDistribution(distribution);
+  } else {
+    distribution->Clear();
+  }
+}
+
+}  // namespace
+
+void ServiceControlClientImpl::LatencyRecorders::Create() {
+  cache_hit = std::make_shared<LatencyRecorder>();
+  transport = std::make_shared<LatencyRecorder>();
+  flush = std::make_shared<LatencyRecorder>();
+  lock_wait = std::make_shared<LatencyRecorder>();
+}
+
+void ServiceControlClientImpl::LatencyRecorders::Get(
+    LatencyStatistics* stat) const {
+  GetLatencies(cache_hit, &stat->cache_hit);
+  GetLatencies(transport, &stat->transport);
+  GetLatencies(flush, &stat->flush);
+  GetLatencies(lock_wait, &stat->lock_wait);
+}
 
 ServiceControlClientImpl::ServiceControlClientImpl(
     const string& service_name, const std::string& service_config_id,
@@ -50,22 +192,25 @@ ServiceControlClientImpl::ServiceControlClientImpl(
       CreateReportAggregator(service_name, service_config_id,
                              options.report_options, options.metric_kinds);
 
+  if (options.check_options.max_check_waiters > 0) {
+    check_coalescer_ = std::make_shared<CheckCoalescer>(
+        options.check_options.max_check_waiters);
+  }
+  check_signature_hash_ = options.check_options.signature_hash;
+  check_cache_enabled_ = options.check_options.num_entries > 0;
+
   quota_transport_ = options.quota_transport;
   check_transport_ = options.check_transport;
   report_transport_ = options.report_transport;
 
-  total_called_checks_ = 0;
-  send_checks_by_flush_ = 0;
-  send_checks_in_flight_ = 0;
-
-  total_called_quotas_ = 0;
-  send_quotas_by_flush_ = 0;
-  send_quotas_in_flight_ = 0;
-
-  total_called_reports_ = 0;
-  send_reports_by_flush_ = 0;
-  send_reports_in_flight_ = 0;
-  send_report_operations_ = 0;
+  if (options.record_latencies) {
+    check_latencies_.Create();
+    quota_latencies_.Create();
+    report_latencies_.Create();
+    check_aggregator_->SetLockWaitRecorder(check_latencies_.lock_wait);
+    quota_aggregator_->SetLockWaitRecorder(quota_latencies_.lock_wait);
+    report_aggregator_->SetLockWaitRecorder(report_latencies_.lock_wait);
+  }
 
   check_aggregator_->SetFlushCallback(
       std::bind(&ServiceControlClientImpl::CheckFlushCallback, this,
@@ -87,24 +232,33 @@ ServiceControlClientImpl::ServiceControlClientImpl(
     std::shared_ptr<QuotaAggregator> quota_aggregator_copy = quota_aggregator_;
     std::shared_ptr<ReportAggregator> report_aggregator_copy =
         report_aggregator_;
+    std::shared_ptr<LatencyRecorder> check_flush = check_latencies_.flush;
+    std::shared_ptr<LatencyRecorder> quota_flush = quota_latencies_.flush;
+    std::shared_ptr<LatencyRecorder> report_flush = report_latencies_.flush;
 
     flush_timer_ = options.periodic_timer(
-        flush_interval, [check_aggregator_copy, quota_aggregator_copy,
-                         report_aggregator_copy]() {
-
+        flush_interval,
+        [check_aggregator_copy, quota_aggregator_copy, report_aggregator_copy,
+         check_flush, quota_flush, report_flush]() {
+          int64_t start = StartLatency(check_flush);
           Status status = check_aggregator_copy->Flush();
+          RecordLatency(check_flush, start);
           if (!status.ok()) {
             GOOGLE_LOG(ERROR) << "Failed in Check::Flush() "
                               << status.message();
           }
 
+          start = StartLatency(quota_flush);
           status = quota_aggregator_copy->Flush();
+          RecordLatency(quota_flush, start);
           if (!status.ok()) {
             GOOGLE_LOG(ERROR) << "Failed in AllocateQuota::Flush() "
                               << status.message();
           }
 
+          start = StartLatency(report_flush);
           status = report_aggregator_copy->Flush();
+          RecordLatency(report_flush, start);
           if (!status.ok()) {
             GOOGLE_LOG(ERROR) << "Failed in Report::Flush() "
                               << status.message();
@@ -133,94 +287,251 @@ ServiceControlClientImpl::~ServiceControlClientImpl() {
 }
 
 void ServiceControlClientImpl::AllocateQuotaFlushCallback(
-    const AllocateQuotaRequest& quota_request) {
-  AllocateQuotaRequest* quota_request_copy =
-      new AllocateQuotaRequest(quota_request);
+    AllocateQuotaRequest&& quota_request) {
+  // Takes over the flushed request, so that on_done() callback can use it to
+  // call CacheResponse.
+  std::shared_ptr<const AllocateQuotaRequest> quota_request_owned =
+      std::make_shared<AllocateQuotaRequest>(std::move(quota_request));
   AllocateQuotaResponse* quota_response = new AllocateQuotaResponse;
 
-  quota_transport_(*quota_request_copy, quota_response,
-                   [this, quota_request_copy, quota_response](Status status) {
-                     if (!status.ok()) {
-                       GOOGLE_LOG(ERROR) << "Failed in AllocateQuota call: "
-                                         << status.message();
-                       // cache dummy response for fail open
-                       AllocateQuotaResponse dummy_response;
-                       (void)this->quota_aggregator_->CacheResponse(
-                           *quota_request_copy, dummy_response);
-                     } else {
-                       (void)this->quota_aggregator_->CacheResponse(
-                           *quota_request_copy, *quota_response);
-                     }
-
-                     delete quota_request_copy;
-                     delete quota_response;
-                   });
-
-  ++send_quotas_by_flush_;
+  quota_transport_(
+      *quota_request_owned, quota_response,
+      RecordRoundTrip(
+          quota_latencies_.transport,
+          [this, quota_request_owned, quota_response](Status status) {
+            if (!status.ok()) {
+              GOOGLE_LOG(ERROR) << "Failed in AllocateQuota call: "
+                                << status.message();
+              // cache dummy response for fail open
+              AllocateQuotaResponse dummy_response;
+              (void)this->quota_aggregator_->CacheResponse(
+                  *quota_request_owned, dummy_response);
+            } else {
+              (void)this->quota_aggregator_->CacheResponse(
+                  *quota_request_owned, *quota_response);
+            }
+
+            delete quota_response;
+          }));
+
+  send_quotas_by_flush_.Increment();
 }
 
 void ServiceControlClientImpl::CheckFlushCallback(
-    const CheckRequest& check_request) {
+    CheckRequest&& check_request) {
+  // Takes over the flushed request, so that on_done() callback can use it to
+  // refresh the cached response.
+  std::shared_ptr<const CheckRequest> check_request_owned =
+      std::make_shared<CheckRequest>(std::move(check_request));
   CheckResponse* check_response = new CheckResponse;
-  check_transport_(check_request, check_response,
-                   [check_response](Status status) {
-                     delete check_response;
-                     if (!status.ok()) {
-                       GOOGLE_LOG(ERROR) << "Failed in Check call: "
-                                         << status.message();
-                     }
-                   });
-  ++send_checks_by_flush_;
+  std::shared_ptr<CheckAggregator> check_aggregator_copy = check_aggregator_;
+  check_transport_(
+      *check_request_owned, check_response,
+      RecordRoundTrip(check_latencies_.transport,
+                      [check_aggregator_copy, check_request_owned,
+                       check_response](Status status) {
+                        if (status.ok()) {
+                          (void)check_aggregator_copy->RefreshResponse(
+                              *check_request_owned, *check_response);
+                        } else {
+                          GOOGLE_LOG(ERROR) << "Failed in Check call: "
+                                            << status.message();
+                        }
+                        delete check_response;
+                      }));
+  send_checks_by_flush_.Increment();
 }
 
 void ServiceControlClientImpl::ReportFlushCallback(
     const ReportRequest& report_request) {
   ReportResponse* report_response = new ReportResponse;
   report_transport_(report_request, report_response,
-                    [report_response](Status status) {
-                      delete report_response;
-                      if (!status.ok()) {
-                        GOOGLE_LOG(ERROR) << "Failed in Report call: "
-                                          << status.message();
-                      }
-                    });
-  ++send_reports_by_flush_;
-  send_report_operations_ += report_request.operations_size();
+                    RecordRoundTrip(report_latencies_.transport,
+                                    [report_response](Status status) {
+                                      delete report_response;
+                                      if (!status.ok()) {
+                                        GOOGLE_LOG(ERROR)
+                                            << "Failed in Report call: "
+                                            << status.message();
+                                      }
+                                    }));
+  send_reports_by_flush_.Increment();
+  send_report_operations_.Add(report_request.operations_size());
+}
+
+bool ServiceControlClientImpl::SignCheck(const CheckRequest& check_request,
+                                         Signature* signature) {
+  if ((!check_cache_enabled_ && !check_coalescer_) ||
+      check_request.operation().importance() != Operation::LOW) {
+    return false;
+  }
+  *signature =
+      GenerateCheckRequestSignature(check_request, check_signature_hash_);
+  return true;
+}
+
+bool ServiceControlClientImpl::JoinCheck(const CheckRequest& check_request,
+                                         const Signature& signature,
+                                         CheckCoalescer::Waiter waiter,
+                                         bool* leader) {
+  *leader = false;
+  if (!check_coalescer_ ||
+      check_request.operation().importance() != Operation::LOW) {
+    return false;
+  }
+  if (!check_coalescer_->Join(signature, std::move(waiter), leader)) {
+    return false;
+  }
+  coalesced_checks_.Increment();
+  return true;
+}
+
+template <class Response>
+bool ServiceControlClientImpl::CheckCached(
+    const CheckRequest& check_request, Signature* signature,
+    Response* check_response, const DoneCallback& on_check_done,
+    const TransportCheckFunc& check_transport) {
+  total_called_checks_.Increment();
+  if (check_transport == NULL) {
+    on_check_done(Status(StatusCode::kInvalidArgument, "transport is NULL."));
+    return true;
+  }
+
+  int64_t start = StartLatency(check_latencies_.cache_hit);
+  Status status =
+      SignCheck(check_request, signature)
+          ? check_aggregator_->Check(check_request, *signature, check_response)
+          : check_aggregator_->Check(check_request, check_response);
+  if (status.code() == StatusCode::kNotFound) {
+    return false;
+  }
+  RecordLatency(check_latencies_.cache_hit, start);
+  on_check_done(status);
+  return true;
+}
+
+void ServiceControlClientImpl::SendCheck(
+    std::shared_ptr<const CheckRequest> check_request,
+    const Signature& signature, CheckResponse* check_response,
+    DoneCallback on_check_done, TransportCheckFunc check_transport) {
+  bool leader;
+  if (JoinCheck(*check_request, signature,
+                [check_response, on_check_done](
+                    const Status& status,
+                    const std::shared_ptr<const CheckResponse>& response) {
+                  *check_response = *response;
+                  on_check_done(status);
+                },
+                &leader)) {
+    return;
+  }
+
+  std::shared_ptr<CheckAggregator> check_aggregator_copy = check_aggregator_;
+  std::shared_ptr<CheckCoalescer> check_coalescer_copy =
+      leader ? check_coalescer_ : nullptr;
+  check_transport(
+      *check_request, check_response,
+      RecordRoundTrip(
+          check_latencies_.transport,
+          [check_aggregator_copy, check_coalescer_copy, signature,
+           check_request, check_response, on_check_done](Status status) {
+            if (status.ok()) {
+              (void)check_aggregator_copy->CacheResponse(
+                  *check_request, *check_response);
+            } else {
+              GOOGLE_LOG(ERROR) << "Failed in Check call: "
+                                << status.message();
+            }
+            if (check_coalescer_copy) {
+              // Copied before on_check_done, which may release
+              // check_response.
+              CallWaiters(check_coalescer_copy->Complete(signature),
+                          status, [check_response]() {
+                            return std::make_shared<CheckResponse>(
+                                *check_response);
+                          });
+            }
+            on_check_done(status);
+          }));
+  send_checks_in_flight_.Increment();
+}
+
+void ServiceControlClientImpl::SendCheck(
+    std::shared_ptr<const CheckRequest> check_request,
+    const Signature& signature,
+    std::shared_ptr<const CheckResponse>* check_response,
+    DoneCallback on_check_done, TransportCheckFunc check_transport) {
+  bool leader;
+  if (JoinCheck(*check_request, signature,
+                [check_response, on_check_done](
+                    const Status& status,
+                    const std::shared_ptr<const CheckResponse>& response) {
+                  *check_response = response;
+                  on_check_done(status);
+                },
+                &leader)) {
+    return;
+  }
+
+  // The response from the server is shared by the caller, the cache and the
+  // coalesced callers.
+  std::shared_ptr<CheckResponse> server_response(new CheckResponse);
+  std::shared_ptr<CheckAggregator> check_aggregator_copy = check_aggregator_;
+  std::shared_ptr<CheckCoalescer> check_coalescer_copy =
+      leader ? check_coalescer_ : nullptr;
+  check_transport(
+      *check_request, server_response.get(),
+      RecordRoundTrip(
+          check_latencies_.transport,
+          [check_aggregator_copy, check_coalescer_copy, signature,
+           check_request, server_response, check_response,
+           on_check_done](Status status) {
+            if (status.ok()) {
+              (void)check_aggregator_copy->CacheResponse(
+                  *check_request, server_response);
+            } else {
+              GOOGLE_LOG(ERROR) << "Failed in Check call: "
+                                << status.message();
+            }
+            if (check_coalescer_copy) {
+              CallWaiters(check_coalescer_copy->Complete(signature),
+                          status, [server_response]() {
+                            return std::shared_ptr<
+                                const CheckResponse>(server_response);
+                          });
+            }
+            *check_response = server_response;
+            on_check_done(status);
+          }));
+  send_checks_in_flight_.Increment();
 }
 
 void ServiceControlClientImpl::Check(const CheckRequest& check_request,
                                      CheckResponse* check_response,
                                      DoneCallback on_check_done,
                                      TransportCheckFunc check_transport) {
-  ++total_called_checks_;
-  if (check_transport == NULL) {
-    on_check_done(Status(StatusCode::kInvalidArgument, "transport is NULL."));
+  Signature signature;
+  if (CheckCached(check_request, &signature, check_response, on_check_done,
+                  check_transport)) {
     return;
   }
+  // Makes a copy of check_request so that on_done() callback can use
+  // it to call CacheResponse.
+  SendCheck(std::make_shared<CheckRequest>(check_request), signature,
+            check_response, on_check_done, check_transport);
+}
 
-  Status status = check_aggregator_->Check(check_request, check_response);
-  if (status.code() == StatusCode::kNotFound) {
-    // Makes a copy of check_request so that on_done() callback can use
-    // it to call CacheResponse.
-    CheckRequest* check_request_copy = new CheckRequest(check_request);
-    std::shared_ptr<CheckAggregator> check_aggregator_copy = check_aggregator_;
-    check_transport(*check_request_copy, check_response,
-                    [check_aggregator_copy, check_request_copy, check_response,
-                     on_check_done](Status status) {
-                      if (status.ok()) {
-                        (void)check_aggregator_copy->CacheResponse(
-                            *check_request_copy, *check_response);
-                      } else {
-                        GOOGLE_LOG(ERROR) << "Failed in Check call: "
-                                          << status.message();
-                      }
-                      delete check_request_copy;
-                      on_check_done(status);
-                    });
-    ++send_checks_in_flight_;
+void ServiceControlClientImpl::Check(CheckRequest&& check_request,
+                                     CheckResponse* check_response,
+                                     DoneCallback on_check_done,
+                                     TransportCheckFunc check_transport) {
+  Signature signature;
+  if (CheckCached(check_request, &signature, check_response, on_check_done,
+                  check_transport)) {
     return;
   }
-  on_check_done(status);
+  SendCheck(std::make_shared<CheckRequest>(std::move(check_request)),
+            signature, check_response, on_check_done, check_transport);
 }
 
 void ServiceControlClientImpl::Check(const CheckRequest& check_request,
@@ -229,73 +540,189 @@ void ServiceControlClientImpl::Check(const CheckRequest& check_request,
   Check(check_request, check_response, on_check_done, check_transport_);
 }
 
+void ServiceControlClientImpl::Check(CheckRequest&& check_request,
+                                     CheckResponse* check_response,
+                                     DoneCallback on_check_done) {
+  Check(std::move(check_request), check_response, on_check_done,
+        check_transport_);
+}
+
 Status ServiceControlClientImpl::Check(const CheckRequest& check_request,
                                        CheckResponse* check_response) {
-  StatusPromise status_promise;
-  StatusFuture status_future = status_promise.get_future();
+  return CallAndWait([this, &check_request,
+                      check_response](DoneCallback on_check_done) {
+    Signature signature;
+    if (!CheckCached(check_request, &signature, check_response, on_check_done,
+                     check_transport_)) {
+      SendCheck(Borrow(check_request), signature, check_response,
+                on_check_done, check_transport_);
+    }
+  });
+}
 
-  Check(check_request, check_response, [&status_promise](Status status) {
-    // Need to move the promise as it must be owned by the thread where this
-    // lambda is executed rather than the thread where the original Check()
-    // call is executed.
-    // Otherwise, if we call std::promise::set_value(), the original thread will
-    // be unblocked and it might destroy the promise object before set_value()
-    // has a chance to finish.
-    StatusPromise moved_promise(std::move(status_promise));
-    moved_promise.set_value(status);
+void ServiceControlClientImpl::Check(
+    const CheckRequest& check_request,
+    std::shared_ptr<const CheckResponse>* check_response,
+    DoneCallback on_check_done, TransportCheckFunc check_transport) {
+  Signature signature;
+  if (CheckCached(check_request, &signature, check_response, on_check_done,
+                  check_transport)) {
+    return;
+  }
+  // Makes a copy of check_request so that on_done() callback can use
+  // it to call CacheResponse.
+  SendCheck(std::make_shared<CheckRequest>(check_request), signature,
+            check_response, on_check_done, check_transport);
+}
+
+void ServiceControlClientImpl::Check(
+    const CheckRequest& check_request,
+    std::shared_ptr<const CheckResponse>* check_response,
+    DoneCallback on_check_done) {
+  Check(check_request, check_response, on_check_done, check_transport_);
+}
+
+Status ServiceControlClientImpl::Check(
+    const CheckRequest& check_request,
+    std::shared_ptr<const CheckResponse>* check_response) {
+  return CallAndWait([this, &check_request,
+                      check_response](DoneCallback on_check_done) {
+    Signature signature;
+    if (!CheckCached(check_request, &signature, check_response, on_check_done,
+                     check_transport_)) {
+      SendCheck(Borrow(check_request), signature, check_response,
+                on_check_done, check_transport_);
+    }
   });
+}
 
-  status_future.wait();
-  return status_future.get();
+void ServiceControlClientImpl::CheckBatch(
+    const std::vector<CheckRequest>& check_requests,
+    std::vector<std::shared_ptr<const CheckResponse>>* check_responses,
+    DoneCallback on_check_done) {
+  CheckBatch(check_requests, check_responses, on_check_done, false);
 }
 
-void ServiceControlClientImpl::Quota(const AllocateQuotaRequest& quota_request,
-                                     AllocateQuotaResponse* quota_response,
-                                     DoneCallback on_quota_done,
-                                     TransportQuotaFunc quota_transport) {
-  ++total_called_quotas_;
+Status ServiceControlClientImpl::CheckBatch(
+    const std::vector<CheckRequest>& check_requests,
+    std::vector<std::shared_ptr<const CheckResponse>>* check_responses) {
+  return CallAndWait([this, &check_requests,
+                      check_responses](DoneCallback on_check_done) {
+    CheckBatch(check_requests, check_responses, on_check_done, true);
+  });
+}
+
+void ServiceControlClientImpl::CheckBatch(
+    const std::vector<CheckRequest>& check_requests,
+    std::vector<std::shared_ptr<const CheckResponse>>* check_responses,
+    DoneCallback on_check_done, bool borrow_requests) {
+  total_called_checks_.Add(check_requests.size());
+  if (check_transport_ == NULL) {
+    on_check_done(Status(StatusCode::kInvalidArgument, "transport is NULL."));
+    return;
+  }
+
+  std::vector<Signature> signatures(check_requests.size());
+  for (size_t i = 0; i < check_requests.size(); ++i) {
+    SignCheck(check_requests[i], &signatures[i]);
+  }
+  std::vector<Status> statuses;
+  check_aggregator_->CheckBatch(check_requests, signatures, check_responses,
+                                &statuses);
+
+  std::shared_ptr<BatchDone> batch =
+      std::make_shared<BatchDone>(on_check_done);
+  Status status = OkStatus();
+  for (size_t i = 0; i < check_requests.size(); ++i) {
+    if (statuses[i].code() == StatusCode::kNotFound) {
+      const CheckRequest& check_request = check_requests[i];
+      SendCheck(borrow_requests ? Borrow(check_request)
+                                : std::make_shared<CheckRequest>(check_request),
+                signatures[i], &(*check_responses)[i], batch->Start(),
+                check_transport_);
+    } else if (status.ok()) {
+      status = statuses[i];
+    }
+  }
+  batch->Done(status);
+}
+
+bool ServiceControlClientImpl::QuotaCached(
+    const AllocateQuotaRequest& quota_request,
+    AllocateQuotaResponse* quota_response, const DoneCallback& on_quota_done,
+    const TransportQuotaFunc& quota_transport) {
+  total_called_quotas_.Increment();
   if (quota_transport == NULL) {
     on_quota_done(Status(StatusCode::kInvalidArgument, "transport is NULL."));
-    return;
+    return true;
   }
 
+  int64_t start = StartLatency(quota_latencies_.cache_hit);
   Status status = quota_aggregator_->Quota(quota_request, quota_response);
   if (status.code() == StatusCode::kNotFound) {
-    // Makes a copy of check_request so that on_done() callback can use
-    // it to call CacheResponse.
-    AllocateQuotaRequest* quota_request_copy =
-        new AllocateQuotaRequest(quota_request);
+    return false;
+  }
+  RecordLatency(quota_latencies_.cache_hit, start);
+  // OkStatus(), return response status from AllocateQuotaResponse
+  on_quota_done(status);
+  return true;
+}
 
-    std::shared_ptr<QuotaAggregator> quota_aggregator_copy = quota_aggregator_;
-    quota_transport(*quota_request_copy, quota_response,
-                    [this, quota_aggregator_copy, quota_request_copy,
-                     quota_response, on_quota_done](Status status) {
-
-                      if (status.ok()) {
-                        (void)quota_aggregator_copy->CacheResponse(
-                            *quota_request_copy, *quota_response);
-                      } else {
-                        // on network error, failed open, reset in_flight flag
-                        // to false
-                        AllocateQuotaResponse dummy_response;
-                        (void)quota_aggregator_copy->CacheResponse(
-                            *quota_request_copy, dummy_response);
-
-                        GOOGLE_LOG(ERROR) << "Failed in Quota call: "
-                                          << status.message();
-                      }
-
-                      delete quota_request_copy;
-
-                      on_quota_done(status);
-                    });
-
-    ++send_quotas_in_flight_;
+void ServiceControlClientImpl::SendQuota(
+    std::shared_ptr<const AllocateQuotaRequest> quota_request,
+    AllocateQuotaResponse* quota_response, DoneCallback on_quota_done,
+    TransportQuotaFunc quota_transport) {
+  std::shared_ptr<QuotaAggregator> quota_aggregator_copy = quota_aggregator_;
+  quota_transport(
+      *quota_request, quota_response,
+      RecordRoundTrip(
+          quota_latencies_.transport,
+          [quota_aggregator_copy, quota_request, quota_response,
+           on_quota_done](Status status) {
+            if (status.ok()) {
+              (void)quota_aggregator_copy->CacheResponse(
+                  *quota_request, *quota_response);
+            } else {
+              // on network error, failed open, reset in_flight flag
+              // to false
+              AllocateQuotaResponse dummy_response;
+              (void)quota_aggregator_copy->CacheResponse(
+                  *quota_request, dummy_response);
+
+              GOOGLE_LOG(ERROR) << "Failed in Quota call: "
+                                << status.message();
+            }
+
+            on_quota_done(status);
+          }));
+
+  send_quotas_in_flight_.Increment();
+}
+
+void ServiceControlClientImpl::Quota(const AllocateQuotaRequest& quota_request,
+                                     AllocateQuotaResponse* quota_response,
+                                     DoneCallback on_quota_done,
+                                     TransportQuotaFunc quota_transport) {
+  if (QuotaCached(quota_request, quota_response, on_quota_done,
+                  quota_transport)) {
+    return;
+  }
+  // Makes a copy of quota_request so that on_done() callback can use
+  // it to call CacheResponse.
+  SendQuota(std::make_shared<AllocateQuotaRequest>(quota_request),
+            quota_response, on_quota_done, quota_transport);
+}
+
+void ServiceControlClientImpl::Quota(AllocateQuotaRequest&& quota_request,
+                                     AllocateQuotaResponse* quota_response,
+                                     DoneCallback on_quota_done,
+                                     TransportQuotaFunc quota_transport) {
+  if (QuotaCached(quota_request, quota_response, on_quota_done,
+                  quota_transport)) {
     return;
-  } else {
-    // OkStatus(), return response status from AllocateQuotaResponse
-    on_quota_done(status);
   }
+  SendQuota(std::make_shared<AllocateQuotaRequest>(std::move(quota_request)),
+            quota_response, on_quota_done, quota_transport);
 }
 
 // An async quota call.
@@ -305,45 +732,48 @@ void ServiceControlClientImpl::Quota(const AllocateQuotaRequest& quota_request,
   Quota(quota_request, quota_response, on_quota_done, quota_transport_);
 }
 
+void ServiceControlClientImpl::Quota(AllocateQuotaRequest&& quota_request,
+                                     AllocateQuotaResponse* quota_response,
+                                     DoneCallback on_quota_done) {
+  Quota(std::move(quota_request), quota_response, on_quota_done,
+        quota_transport_);
+}
+
 // A sync quota call.
 ::google::protobuf::util::Status ServiceControlClientImpl::Quota(
     const AllocateQuotaRequest& quota_request,
     AllocateQuotaResponse* quota_response) {
-  StatusPromise status_promise;
-  StatusFuture status_future = status_promise.get_future();
-
-  Quota(quota_request, quota_response, [&status_promise](Status status) {
-    // Need to move the promise as it must be owned by the thread where this
-    // lambda is executed rather than the thread where the original Check()
-    // call is executed.
-    // Otherwise, if we call std::promise::set_value(), the original thread will
-    // be unblocked and it might destroy the promise object before set_value()
-    // has a chance to finish.
-    StatusPromise moved_promise(std::move(status_promise));
-    moved_promise.set_value(status);
+  return CallAndWait([this, &quota_request,
+                      quota_response](DoneCallback on_quota_done) {
+    if (!QuotaCached(quota_request, quota_response, on_quota_done,
+                     quota_transport_)) {
+      SendQuota(Borrow(quota_request), quota_response, on_quota_done,
+                quota_transport_);
+    }
   });
-
-  status_future.wait();
-  return status_future.get();
 }
 
 void ServiceControlClientImpl::Report(const ReportRequest& report_request,
                                       ReportResponse* report_response,
                                       DoneCallback on_report_done,
                                       TransportReportFunc report_transport) {
-  ++total_called_reports_;
+  total_called_reports_.Increment();
   if (report_transport == NULL) {
     on_report_done(Status(StatusCode::kInvalidArgument, "transport is NULL."));
     return;
   }
 
+  int64_t start = StartLatency(report_latencies_.cache_hit);
   Status status = report_aggregator_->Report(report_request);
   if (status.code() == StatusCode::kNotFound) {
-    report_transport(report_request, report_response, on_report_done);
-    ++send_reports_in_flight_;
-    send_report_operations_ += report_request.operations_size();
+    report_transport(report_request, report_response,
+                     RecordRoundTrip(report_latencies_.transport,
+                                     on_report_done));
+    send_reports_in_flight_.Increment();
+    send_report_operations_.Add(report_request.operations_size());
     return;
   }
+  RecordLatency(report_latencies_.cache_hit, start);
   on_report_done(status);
 }
 
@@ -355,37 +785,82 @@ void ServiceControlClientImpl::Report(const ReportRequest& report_request,
 
 Status ServiceControlClientImpl::Report(const ReportRequest& report_request,
                                         ReportResponse* report_response) {
-  StatusPromise status_promise;
-  StatusFuture status_future = status_promise.get_future();
+  return CallAndWait(
+      [this, &report_request, report_response](DoneCallback on_report_done) {
+        Report(report_request, report_response, on_report_done);
+      });
+}
 
-  Report(report_request, report_response, [&status_promise](Status status) {
-    // Need to move the promise as it must be owned by the thread where this
-    // lambda is executed rather than the thread where the original Report()
-    // call is executed.
-    // Otherwise, if we call std::promise::set_value(), the original thread will
-    // be unblocked and it might destroy the promise object before set_value()
-    // has a chance to finish.
-    StatusPromise moved_promise(std::move(status_promise));
-    moved_promise.set_value(status);
-  });
+void ServiceControlClientImpl::ReportBatch(
+    const std::vector<ReportRequest>& report_requests,
+    DoneCallback on_report_done) {
+  total_called_reports_.Add(report_requests.size());
+  if (report_transport_ == NULL) {
+    on_report_done(Status(StatusCode::kInvalidArgument, "transport is NULL."));
+    return;
+  }
 
-  status_future.wait();
-  return status_future.get();
+  std::vector<Status> statuses;
+  report_aggregator_->ReportBatch(report_requests, &statuses);
+
+  std::shared_ptr<BatchDone> batch =
+      std::make_shared<BatchDone>(on_report_done);
+  Status status = OkStatus();
+  for (size_t i = 0; i < report_requests.size(); ++i) {
+    if (statuses[i].code() == StatusCode::kNotFound) {
+      const ReportRequest& report_request = report_requests[i];
+      ReportResponse* report_response = new ReportResponse;
+      DoneCallback on_done = batch->Start();
+      report_transport_(report_request, report_response,
+                        RecordRoundTrip(report_latencies_.transport,
+                                        [report_response, on_done](
+                                            Status status) {
+                                          delete report_response;
+                                          on_done(status);
+                                        }));
+      send_reports_in_flight_.Increment();
+      send_report_operations_.Add(report_request.operations_size());
+    } else if (status.ok()) {
+      status = statuses[i];
+    }
+  }
+  batch->Done(status);
+}
+
+Status ServiceControlClientImpl::ReportBatch(
+    const std::vector<ReportRequest>& report_requests) {
+  return CallAndWait(
+      [this, &report_requests](DoneCallback on_report_done) {
+        ReportBatch(report_requests, on_report_done);
+      });
 }
 
 Status ServiceControlClientImpl::GetStatistics(Statistics* stat) const {
-  stat->total_called_checks = total_called_checks_;
-  stat->send_checks_by_flush = send_checks_by_flush_;
-  stat->send_checks_in_flight = send_checks_in_flight_;
-
-  stat->total_called_quotas = total_called_quotas_;
-  stat->send_quotas_by_flush = send_quotas_by_flush_;
-  stat->send_quotas_in_flight = send_quotas_in_flight_;
-
-  stat->total_called_reports = total_called_reports_;
-  stat->send_reports_by_flush = send_reports_by_flush_;
-  stat->send_reports_in_flight = send_reports_in_flight_;
-  stat->send_report_operations = send_report_operations_;
+  stat->total_called_checks = total_called_checks_.Value();
+  stat->send_checks_by_flush = send_checks_by_flush_.Value();
+  stat->send_checks_in_flight = send_checks_in_flight_.Value();
+  stat->coalesced_checks = coalesced_checks_.Value();
+
+  stat->total_called_quotas = total_called_quotas_.Value();
+  stat->send_quotas_by_flush = send_quotas_by_flush_.Value();
+  stat->send_quotas_in_flight = send_quotas_in_flight_.Value();
+
+  stat->total_called_reports = total_called_reports_.Value();
+  stat->send_reports_by_flush = send_reports_by_flush_.Value();
+  stat->send_reports_in_flight = send_reports_in_flight_.Value();
+  stat->send_report_operations = send_report_operations_.Value();
+
+  check_aggregator_->GetStatistics(&stat->check_cache);
+  quota_aggregator_->GetStatistics(&stat->quota_cache);
+  report_aggregator_->GetStatistics(&stat->report_cache);
+  return OkStatus();
+}
+
+Status ServiceControlClientImpl::GetDetailedStatistics(
+    DetailedStatistics* stat) const {
+  check_latencies_.Get(&stat->check);
+  quota_latencies_.Get(&stat->quota);
+  report_latencies_.Get(&stat->report);
   return OkStatus();
 }
 
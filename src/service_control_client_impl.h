@@ -17,8 +17,11 @@ limitations under the License.
 #define GOOGLE_SERVICE_CONTROL_CLIENT_SERVICE_CONTROL_CLIENT_IMPL_H_
 
 #include "include/service_control_client.h"
+#include "src/check_coalescer.h"
 #include "src/quota_aggregator_impl.h"
 #include "utils/google_macros.h"
+#include "utils/latency_recorder.h"
+#include "utils/sharded_counter.h"
 
 #include <atomic>
 
@@ -54,6 +57,55 @@ class ServiceControlClientImpl : public ServiceControlClient {
       ::google::api::servicecontrol::v1::CheckResponse* check_response,
       DoneCallback on_check_done, TransportCheckFunc check_transport);
 
+  // An async check call taking over the check request.
+  virtual void Check(
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done);
+
+  // A check call taking over the check request, with per_request transport.
+  virtual void Check(
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport);
+
+  // An async check call returning a shared response.
+  virtual void Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done);
+
+  // A sync check call returning a shared response.
+  virtual ::google::protobuf::util::Status Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response);
+
+  // A check call returning a shared response, with per_request transport.
+  virtual void Check(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport);
+
+  // An async batch check call.
+  virtual void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses,
+      DoneCallback on_check_done);
+
+  // A sync batch check call.
+  virtual ::google::protobuf::util::Status CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses);
+
   // An async quota call.
   virtual void Quota(
       const ::google::api::servicecontrol::v1::AllocateQuotaRequest&
@@ -74,6 +126,18 @@ class ServiceControlClientImpl : public ServiceControlClient {
       ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
       DoneCallback on_quota_done, TransportQuotaFunc quota_transport);
 
+  // An async quota call taking over the quota request.
+  virtual void Quota(
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done);
+
+  // A quota call taking over the quota request, with per_request transport.
+  virtual void Quota(
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done, TransportQuotaFunc quota_transport);
+
   // An async report call.
   virtual void Report(
       const ::google::api::servicecontrol::v1::ReportRequest& report_request,
@@ -87,29 +151,127 @@ class ServiceControlClientImpl : public ServiceControlClient {
 
   virtual ::google::protobuf::util::Status GetStatistics(
       Statistics* stat) const;
+
+  virtual ::google::protobuf::util::Status GetDetailedStatistics(
+      DetailedStatistics* stat) const;
+
   // A report call with per_request transport.
   virtual void Report(
       const ::google::api::servicecontrol::v1::ReportRequest& report_request,
       ::google::api::servicecontrol::v1::ReportResponse* report_response,
       DoneCallback on_report_done, TransportReportFunc report_transport);
 
+  // An async batch report call.
+  virtual void ReportBatch(
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          report_requests,
+      DoneCallback on_report_done);
+
+  // A sync batch report call.
+  virtual ::google::protobuf::util::Status ReportBatch(
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          report_requests);
+
  private:
+  // The latency recorders of an API, as in LatencyStatistics. They are null
+  // unless latencies are recorded, and shared with the transport callbacks
+  // and the timer.
+  struct LatencyRecorders {
+    // Creates the recorders.
+    void Create();
+
+    // Copies the recorded latencies to stat.
+    void Get(LatencyStatistics* stat) const;
+
+    std::shared_ptr<LatencyRecorder> cache_hit;
+    std::shared_ptr<LatencyRecorder> transport;
+    std::shared_ptr<LatencyRecorder> flush;
+    std::shared_ptr<LatencyRecorder> lock_wait;
+  };
+
   ::google::protobuf::util::Status convertResponseStatus(
       const ::google::api::servicecontrol::v1::AllocateQuotaResponse& response);
 
   // A flush callback for check.
   void CheckFlushCallback(
-      const ::google::api::servicecontrol::v1::CheckRequest& check_request);
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request);
 
-  // A flush callback for check.
+  // A flush callback for quota.
   void AllocateQuotaFlushCallback(
-      const ::google::api::servicecontrol::v1::AllocateQuotaRequest&
-          quota_request);
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request);
 
   // A flush callback for report.
   void ReportFlushCallback(
       const ::google::api::servicecontrol::v1::ReportRequest& report_request);
 
+  // Generates the signature of a check request if the check cache or the
+  // coalescer uses it, which they only do for requests of LOW importance.
+  // Returns whether *signature was set.
+  bool SignCheck(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      Signature* signature);
+
+  // Coalesces a missed check request with the in-flight one of the same
+  // request, queuing waiter on it. signature is the one set by SignCheck().
+  // Returns false if the request has to be sent instead; if *leader is then
+  // set, other misses may wait for it, and the sender has to complete the
+  // check in check_coalescer_ with signature.
+  bool JoinCheck(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      const Signature& signature, CheckCoalescer::Waiter waiter, bool* leader);
+
+  // Counts the check call and looks it up in the cache. Returns false on a
+  // cache miss, when the request still has to be sent by check_transport
+  // with the *signature set by SignCheck(). Otherwise on_check_done has
+  // already been called.
+  template <class Response>
+  bool CheckCached(
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      Signature* signature, Response* check_response,
+      const DoneCallback& on_check_done,
+      const TransportCheckFunc& check_transport);
+
+  // Sends a missed check request and caches the response. check_request is
+  // kept alive until the transport calls back.
+  void SendCheck(
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckRequest>
+          check_request,
+      const Signature& signature,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport);
+  void SendCheck(
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckRequest>
+          check_request,
+      const Signature& signature,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport);
+
+  // Checks a batch of requests. The misses are sent with copies of their
+  // requests, unless borrow_requests is set by the sync call, which waits
+  // for the transport.
+  void CheckBatch(
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses,
+      DoneCallback on_check_done, bool borrow_requests);
+
+  // The same as CheckCached and SendCheck, for quota.
+  bool QuotaCached(
+      const ::google::api::servicecontrol::v1::AllocateQuotaRequest&
+          quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      const DoneCallback& on_quota_done,
+      const TransportQuotaFunc& quota_transport);
+  void SendQuota(
+      std::shared_ptr<
+          const ::google::api::servicecontrol::v1::AllocateQuotaRequest>
+          quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done, TransportQuotaFunc quota_transport);
+
   // Gets next flush interval
   int GetNextFlushInterval();
 
@@ -131,19 +293,25 @@ class ServiceControlClientImpl : public ServiceControlClient {
   // The Timer object.
   std::shared_ptr<PeriodicTimer> flush_timer_;
 
-  // Atomic object to deal with multi-threads situation.
-  std::atomic_int_fast64_t total_called_quotas_;
-  std::atomic_int_fast64_t send_quotas_by_flush_;
-  std::atomic_int_fast64_t send_quotas_in_flight_;
+  // Statistics counters, bumped by every calling thread. Sharded so that the
+  // threads do not contend on one cache line; summed in GetStatistics().
+  ShardedCounter total_called_quotas_;
+  ShardedCounter send_quotas_by_flush_;
+  ShardedCounter send_quotas_in_flight_;
+
+  ShardedCounter total_called_checks_;
+  ShardedCounter send_checks_by_flush_;
+  ShardedCounter send_checks_in_flight_;
+  ShardedCounter coalesced_checks_;
 
-  std::atomic_int_fast64_t total_called_checks_;
-  std::atomic_int_fast64_t send_checks_by_flush_;
-  std::atomic_int_fast64_t send_checks_in_flight_;
+  ShardedCounter total_called_reports_;
+  ShardedCounter send_reports_by_flush_;
+  ShardedCounter send_reports_in_flight_;
+  ShardedCounter send_report_operations_;
 
-  std::atomic_int_fast64_t total_called_reports_;
-  std::atomic_int_fast64_t send_reports_by_flush_;
-  std::atomic_int_fast64_t send_reports_in_flight_;
-  std::atomic_int_fast64_t send_report_operations_;
+  LatencyRecorders check_latencies_;
+  LatencyRecorders quota_latencies_;
+  LatencyRecorders report_latencies_;
 
   // The check aggregator object. Uses shared_ptr for check_aggregator_.
   // Transport::on_check_done() callback needs to call check_aggregator_
@@ -151,6 +319,14 @@ class ServiceControlClientImpl : public ServiceControlClient {
   // of check_aggregator_ to make sure it is not freed.
   std::shared_ptr<CheckAggregator> check_aggregator_;
 
+  // Coalesces concurrent check misses, null if disabled. Shared with the
+  // transport callbacks, like check_aggregator_.
+  std::shared_ptr<CheckCoalescer> check_coalescer_;
+  // The hash function of check request signatures.
+  SignatureHashType check_signature_hash_;
+  // Whether check_aggregator_ caches responses.
+  bool check_cache_enabled_;
+
   std::shared_ptr<QuotaAggregator> quota_aggregator_;
 
   // The report aggregator object. report_aggregator_ has to be shared_ptr since
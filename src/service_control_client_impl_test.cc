@@ -36,6 +36,7 @@ using ::google::api::servicecontrol::v1::ReportResponse;
 using ::google::protobuf::TextFormat;
 using ::google::protobuf::util::MessageDifferencer;
 using ::google::protobuf::util::Status;
+using ::google::protobuf::util::InternalError;
 using ::google::protobuf::util::StatusCode;
 using ::google::protobuf::util::UnknownError;
 using ::testing::Invoke;
@@ -891,6 +892,255 @@ TEST_F(ServiceControlClientImplTest,
                        &MockCheckTransport::CheckWithInplaceCallback));
 }
 
+TEST_F(ServiceControlClientImplTest, TestSharedResponseCheck) {
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckWithInplaceCallback));
+  mock_check_transport_.done_status_ = OkStatus();
+  mock_check_transport_.check_response_ = &pass_check_response1_;
+
+  std::shared_ptr<const CheckResponse> server_response;
+  EXPECT_OK(client_->Check(check_request1_, &server_response));
+  ASSERT_TRUE(server_response != nullptr);
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(*server_response, pass_check_response1_));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  // Cache hits return the response received from the server, not a copy.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _)).Times(0);
+  for (int i = 0; i < 10; i++) {
+    std::shared_ptr<const CheckResponse> cached_response;
+    Status done_status = UnknownError("");
+    client_->Check(check_request1_, &cached_response,
+                   [&done_status](Status status) { done_status = status; });
+    EXPECT_OK(done_status);
+    EXPECT_EQ(cached_response, server_response);
+  }
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  // There is a cached check request in the cache. When client is destroyed,
+  // it will call Transport Check.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckWithInplaceCallback));
+}
+
+TEST_F(ServiceControlClientImplTest, TestMovedRequestCheck) {
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckWithStoredCallback));
+  mock_check_transport_.check_response_ = &pass_check_response1_;
+  size_t saved_done_vector_size = mock_check_transport_.on_done_vector_.size();
+
+  // The client takes over the request, it has to outlive the caller's copy
+  // until the transport calls back.
+  CheckResponse check_response;
+  Status done_status = UnknownError("");
+  {
+    CheckRequest request = check_request1_;
+    client_->Check(std::move(request), &check_response,
+                   [&done_status](Status status) { done_status = status; });
+  }
+  EXPECT_EQ(done_status, UnknownError(""));
+  EXPECT_EQ(mock_check_transport_.on_done_vector_.size(),
+            saved_done_vector_size + 1);
+  EXPECT_TRUE(MessageDifferencer::Equals(mock_check_transport_.check_request_,
+                                         check_request1_));
+
+  mock_check_transport_.on_done_vector_[saved_done_vector_size](OkStatus());
+  EXPECT_OK(done_status);
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(check_response, pass_check_response1_));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  // The response has been cached for the moved request.
+  for (int i = 0; i < 10; i++) {
+    CheckRequest request = check_request1_;
+    CheckResponse cached_response;
+    done_status = UnknownError("");
+    client_->Check(std::move(request), &cached_response,
+                   [&done_status](Status status) { done_status = status; });
+    EXPECT_OK(done_status);
+    EXPECT_TRUE(
+        MessageDifferencer::Equals(cached_response, pass_check_response1_));
+  }
+
+  // There is a cached check request in the cache. When client is destroyed,
+  // it will call Transport Check.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckUsingThread));
+}
+
+TEST_F(ServiceControlClientImplTest, TestCheckBatch) {
+  ServiceControlClientOptions options(
+      CheckAggregationOptions(10 /*entries */, 500 /* refresh_interval_ms */,
+                              1000 /* expiration_ms */),
+      QuotaAggregationOptions(1 /*entries */, 500 /* refresh_interval_ms */),
+      ReportAggregationOptions(1 /* entries */, 500 /*flush_interval_ms*/));
+  options.check_transport = mock_check_transport_.GetFunc();
+  options.report_transport = mock_report_transport_.GetFunc();
+  ServiceControlClientFactoryImpl factory;
+  client_ = factory.CreateClient(kServiceName, kServiceConfigId, options);
+
+  // request1 is cached, only request2 is sent to the server.
+  InternalTestNonCachedCheckWithInplaceCallback(check_request1_, OkStatus(),
+                                                &pass_check_response1_);
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckWithStoredCallback));
+  mock_check_transport_.check_response_ = &pass_check_response2_;
+  size_t saved_done_vector_size = mock_check_transport_.on_done_vector_.size();
+
+  std::vector<std::shared_ptr<const CheckResponse>> check_responses;
+  Status done_status = UnknownError("");
+  client_->CheckBatch({check_request1_, check_request2_}, &check_responses,
+                      [&done_status](Status status) { done_status = status; });
+  // Waits for the check of request2.
+  EXPECT_EQ(done_status, UnknownError(""));
+  ASSERT_EQ(mock_check_transport_.on_done_vector_.size(),
+            saved_done_vector_size + 1);
+  EXPECT_TRUE(MessageDifferencer::Equals(mock_check_transport_.check_request_,
+                                         check_request2_));
+
+  mock_check_transport_.on_done_vector_[saved_done_vector_size](OkStatus());
+  EXPECT_OK(done_status);
+  ASSERT_EQ(check_responses.size(), 2);
+  EXPECT_TRUE(MessageDifferencer::Equals(*check_responses[0],
+                                         pass_check_response1_));
+  EXPECT_TRUE(MessageDifferencer::Equals(*check_responses[1],
+                                         pass_check_response2_));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  // Both are cached now.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _)).Times(0);
+  check_responses.clear();
+  EXPECT_OK(client_->CheckBatch({check_request1_, check_request2_},
+                                &check_responses));
+  EXPECT_TRUE(MessageDifferencer::Equals(*check_responses[1],
+                                         pass_check_response2_));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  Statistics stat;
+  EXPECT_OK(client_->GetStatistics(&stat));
+  EXPECT_EQ(stat.total_called_checks, 5);
+  EXPECT_EQ(stat.send_checks_in_flight, 2);
+
+  // Both cached check requests are flushed out when client is destroyed.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke(&mock_check_transport_,
+                             &MockCheckTransport::CheckWithInplaceCallback));
+}
+
+TEST_F(ServiceControlClientImplTest, TestCoalescedCheck) {
+  ServiceControlClientOptions options(
+      CheckAggregationOptions(10 /*entries */, 500 /* refresh_interval_ms */,
+                              1000 /* expiration_ms */),
+      QuotaAggregationOptions(1 /*entries */, 500 /* refresh_interval_ms */),
+      ReportAggregationOptions(1 /* entries */, 500 /*flush_interval_ms*/));
+  options.check_options.max_check_waiters = 2;
+  options.check_transport = mock_check_transport_.GetFunc();
+  options.report_transport = mock_report_transport_.GetFunc();
+  ServiceControlClientFactoryImpl factory;
+  client_ = factory.CreateClient(kServiceName, kServiceConfigId, options);
+
+  // The first miss is sent, the next two wait for it, and the waiter list is
+  // full for the last one, which is sent too.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke(&mock_check_transport_,
+                             &MockCheckTransport::CheckWithStoredCallback));
+  mock_check_transport_.check_response_ = &pass_check_response1_;
+  size_t saved_done_vector_size = mock_check_transport_.on_done_vector_.size();
+
+  CheckResponse check_responses[3];
+  Status done_status[3] = {UnknownError(""), UnknownError(""),
+                           UnknownError("")};
+  for (int i = 0; i < 2; ++i) {
+    client_->Check(check_request1_, &check_responses[i],
+                   [&done_status, i](Status status) {
+                     done_status[i] = status;
+                   });
+  }
+  std::shared_ptr<const CheckResponse> shared_response;
+  client_->Check(check_request1_, &shared_response,
+                 [&done_status](Status status) { done_status[2] = status; });
+  Status overflow_status = UnknownError("");
+  CheckResponse overflow_response;
+  client_->Check(check_request1_, &overflow_response,
+                 [&overflow_status](Status status) {
+                   overflow_status = status;
+                 });
+  ASSERT_EQ(mock_check_transport_.on_done_vector_.size(),
+            saved_done_vector_size + 2);
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  // The response of the first one completes the waiters.
+  mock_check_transport_.on_done_vector_[saved_done_vector_size](OkStatus());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_OK(done_status[i]);
+  }
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(check_responses[0], pass_check_response1_));
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(check_responses[1], pass_check_response1_));
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(*shared_response, pass_check_response1_));
+  EXPECT_EQ(overflow_status, UnknownError(""));
+
+  mock_check_transport_.on_done_vector_[saved_done_vector_size + 1](
+      OkStatus());
+  EXPECT_OK(overflow_status);
+  EXPECT_TRUE(
+      MessageDifferencer::Equals(overflow_response, pass_check_response1_));
+
+  Statistics stat;
+  EXPECT_OK(client_->GetStatistics(&stat));
+  EXPECT_EQ(stat.total_called_checks, 4);
+  EXPECT_EQ(stat.send_checks_in_flight, 2);
+  EXPECT_EQ(stat.coalesced_checks, 2);
+}
+
+TEST_F(ServiceControlClientImplTest, TestCoalescedCheckFailure) {
+  ServiceControlClientOptions options(
+      CheckAggregationOptions(10 /*entries */, 500 /* refresh_interval_ms */,
+                              1000 /* expiration_ms */),
+      QuotaAggregationOptions(1 /*entries */, 500 /* refresh_interval_ms */),
+      ReportAggregationOptions(1 /* entries */, 500 /*flush_interval_ms*/));
+  options.check_options.max_check_waiters = 1;
+  options.check_transport = mock_check_transport_.GetFunc();
+  options.report_transport = mock_report_transport_.GetFunc();
+  ServiceControlClientFactoryImpl factory;
+  client_ = factory.CreateClient(kServiceName, kServiceConfigId, options);
+
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckWithStoredCallback));
+  // The transport writes a response, but the check fails.
+  mock_check_transport_.check_response_ = &pass_check_response1_;
+  size_t saved_done_vector_size = mock_check_transport_.on_done_vector_.size();
+
+  CheckResponse check_response;
+  Status done_status = UnknownError("");
+  client_->Check(check_request1_, &check_response,
+                 [&done_status](Status status) { done_status = status; });
+  CheckResponse waiter_response;
+  Status waiter_status = UnknownError("");
+  client_->Check(check_request1_, &waiter_response,
+                 [&waiter_status](Status status) { waiter_status = status; });
+  ASSERT_EQ(mock_check_transport_.on_done_vector_.size(),
+            saved_done_vector_size + 1);
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_check_transport_));
+
+  // The waiter gets the failure, and an empty response.
+  mock_check_transport_.on_done_vector_[saved_done_vector_size](
+      InternalError("check failed"));
+  EXPECT_EQ(done_status, InternalError("check failed"));
+  EXPECT_EQ(waiter_status, InternalError("check failed"));
+  EXPECT_TRUE(MessageDifferencer::Equals(waiter_response, CheckResponse()));
+}
+
 TEST_F(ServiceControlClientImplTest, TestReplacedGoodCheckWithInplaceCallback) {
   // Send request1 and a pass response to cache,
   // then replace it with request2.  request1 will be evited, it will be send
@@ -1422,6 +1672,58 @@ TEST_F(ServiceControlClientImplTest, TestReplacedBlockingReportUsingThread) {
   EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_report_transport_));
 }
 
+TEST_F(ServiceControlClientImplTest, TestReportBatch) {
+  // request1 and request2 are cached and merged. The high important request
+  // is sent right away, and the batch is done once it is done.
+  ReportRequest high_request = report_request1_;
+  high_request.mutable_operations(0)->set_importance(Operation::HIGH);
+  std::vector<ReportRequest> requests = {report_request1_, high_request,
+                                         report_request2_};
+
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillOnce(Invoke(&mock_report_transport_,
+                       &MockReportTransport::ReportWithStoredCallback));
+  Status done_status = UnknownError("");
+  client_->ReportBatch(requests,
+                       [&done_status](Status status) { done_status = status; });
+  EXPECT_EQ(done_status, UnknownError(""));
+  ASSERT_EQ(mock_report_transport_.on_done_vector_.size(), 1);
+  EXPECT_TRUE(MessageDifferencer::Equals(mock_report_transport_.report_request_,
+                                         high_request));
+
+  mock_report_transport_.on_done_vector_[0](
+      Status(StatusCode::kPermissionDenied, ""));
+  EXPECT_EQ(done_status, Status(StatusCode::kPermissionDenied, ""));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_report_transport_));
+
+  Statistics stat;
+  EXPECT_OK(client_->GetStatistics(&stat));
+  EXPECT_EQ(stat.total_called_reports, 3);
+  EXPECT_EQ(stat.send_reports_in_flight, 1);
+
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillOnce(Invoke(&mock_report_transport_,
+                       &MockReportTransport::ReportWithInplaceCallback));
+  // Only after client is destroyed, the merged request is sent.
+  client_.reset();
+  EXPECT_TRUE(MessageDifferencer::Equals(mock_report_transport_.report_request_,
+                                         merged_report_request_));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_report_transport_));
+}
+
+TEST_F(ServiceControlClientImplTest, TestCachedBlockingReportBatch) {
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _)).Times(0);
+  EXPECT_OK(client_->ReportBatch({report_request1_, report_request2_}));
+  EXPECT_TRUE(Mock::VerifyAndClearExpectations(&mock_report_transport_));
+
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillOnce(Invoke(&mock_report_transport_,
+                       &MockReportTransport::ReportWithInplaceCallback));
+  client_.reset();
+  EXPECT_TRUE(MessageDifferencer::Equals(mock_report_transport_.report_request_,
+                                         merged_report_request_));
+}
+
 TEST_F(ServiceControlClientImplTest, TestNonCachedReportWithStoredCallback) {
   // Calls Client::Report with a high important request, it will not be cached.
   // Transport::Report() should be called.
@@ -1720,6 +2022,65 @@ TEST_F(ServiceControlClientImplTest, TestFlushCalled) {
   mock_report_transport_.on_done_vector_[0](OkStatus());
 }
 
+TEST_F(ServiceControlClientImplTest, TestDetailedStatistics) {
+  // Latencies are not recorded by default.
+  DetailedStatistics stat;
+  EXPECT_OK(client_->GetDetailedStatistics(&stat));
+  EXPECT_EQ(stat.check.cache_hit.count(), 0);
+  EXPECT_EQ(stat.check.cache_hit.bucket_counts_size(), 0);
+
+  ServiceControlClientOptions options(
+      CheckAggregationOptions(1 /*entries */, 500 /* refresh_interval_ms */,
+                              1000 /* expiration_ms */),
+      QuotaAggregationOptions(1 /*entries */, 500 /* refresh_interval_ms */),
+      ReportAggregationOptions(1 /* entries */, 500 /*flush_interval_ms*/));
+  options.record_latencies = true;
+
+  MockPeriodicTimer mock_timer;
+  options.check_transport = mock_check_transport_.GetFunc();
+  options.report_transport = mock_report_transport_.GetFunc();
+  options.periodic_timer = mock_timer.GetFunc();
+  EXPECT_CALL(mock_timer, StartTimer(_, _))
+      .WillOnce(Invoke(&mock_timer, &MockPeriodicTimer::MyStartTimer));
+
+  client_ = CreateServiceControlClient(kServiceName, kServiceConfigId, options);
+  ASSERT_TRUE(mock_timer.callback_ != NULL);
+
+  // A miss sent to the server, then a hit.
+  InternalTestNonCachedCheckWithInplaceCallback(check_request1_, OkStatus(),
+                                                &pass_check_response1_);
+  InternalTestCachedCheck(check_request1_, pass_check_response1_);
+
+  ReportResponse report_response;
+  EXPECT_OK(client_->Report(report_request1_, &report_response));
+  mock_timer.callback_();
+
+  EXPECT_OK(client_->GetDetailedStatistics(&stat));
+  EXPECT_EQ(stat.check.cache_hit.count(), 1);
+  EXPECT_EQ(stat.check.transport.count(), 1);
+  EXPECT_EQ(stat.check.flush.count(), 1);
+  EXPECT_EQ(stat.check.lock_wait.count(), 0);
+  EXPECT_EQ(stat.check.cache_hit.bucket_counts_size(),
+            stat.check.cache_hit.exponential_buckets().num_finite_buckets() +
+                2);
+
+  EXPECT_EQ(stat.quota.cache_hit.count(), 0);
+  EXPECT_EQ(stat.quota.transport.count(), 0);
+  EXPECT_EQ(stat.quota.flush.count(), 1);
+
+  EXPECT_EQ(stat.report.cache_hit.count(), 1);
+  EXPECT_EQ(stat.report.transport.count(), 0);
+  EXPECT_EQ(stat.report.flush.count(), 1);
+
+  // The cached requests are flushed out when client is destroyed.
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillOnce(Invoke(&mock_check_transport_,
+                       &MockCheckTransport::CheckWithInplaceCallback));
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillOnce(Invoke(&mock_report_transport_,
+                       &MockReportTransport::ReportWithInplaceCallback));
+}
+
 TEST_F(ServiceControlClientImplTest,
        TestTimerCallbackCalledAfterClientDeleted) {
   // When the client object is deleted, timer callback may be called after it
@@ -14,14 +14,19 @@ limitations under the License.
 ==============================================================================*/
 
 #include "src/signature.h"
+#include "utils/google_macros.h"
 #include "utils/md5.h"
+#include "utils/murmur3.h"
 
-#include <set>
-#include <map>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <utility>
 
 using std::string;
 using google::api::servicecontrol::v1::CheckRequest;
 using google::api::servicecontrol::v1::MetricValue;
+using google::api::servicecontrol::v1::MetricValueSet;
 using google::api::servicecontrol::v1::Operation;
 using google::api::servicecontrol::v1::AllocateQuotaRequest;
 using google::api::servicecontrol::v1::QuotaOperation;
@@ -32,47 +37,100 @@ namespace {
 const char kDelimiter[] = "\0";
 const int kDelimiterLength = 1;
 
+// Number of elements that fit in the on-stack buffer of a StackArray.
+const size_t kStackArraySize = 32;
+
+// A fixed size array which is kept on the stack unless it has more than
+// kStackArraySize elements. Labels and metric names are put into canonical
+// order by sorting pointers to them in such an array, so that a typical
+// request is hashed without any heap allocation.
+template <typename T>
+class StackArray {
+ public:
+  explicit StackArray(size_t size) : size_(size), data_(stack_) {
+    if (size > kStackArraySize) {
+      heap_.reset(new T[size]);
+      data_ = heap_.get();
+    }
+  }
+
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+  T& operator[](size_t i) { return data_[i]; }
+
+ private:
+  size_t size_;
+  T stack_[kStackArraySize];
+  std::unique_ptr<T[]> heap_;
+  T* data_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(StackArray);
+};
+
+// Returns the digest of the given hasher as a signature.
+template <class Hasher>
+Signature Finish(Hasher* hasher) {
+  static_assert(Hasher::kDigestLength == Signature::kSize,
+                "the digest must be 128 bits");
+  unsigned char digest[Signature::kSize];
+  hasher->Digest(digest);
+  return Signature(digest);
+}
+
 // Updates the give hasher with the given labels.
+template <class Hasher>
 void UpdateHashLabels(const ::google::protobuf::Map<string, string>& labels,
-                      MD5* hasher) {
-  std::map<string, string> ordered_labels(labels.begin(), labels.end());
-  for (const auto& label : ordered_labels) {
+                      Hasher* hasher) {
+  typedef ::google::protobuf::Map<string, string>::value_type Label;
+  StackArray<const Label*> ordered_labels(labels.size());
+  const Label** next = ordered_labels.begin();
+  for (const auto& label : labels) {
+    *next++ = &label;
+  }
+  // Map keys are unique, so the order is fully determined by the keys.
+  std::sort(ordered_labels.begin(), ordered_labels.end(),
+            [](const Label* a, const Label* b) { return a->first < b->first; });
+
+  for (const Label* label : ordered_labels) {
     // Note we must use the Update(void const *data, int size) function here
     // for the delimiter instead of Update(StringPiece data), because
     // StringPiece would use strlen and gets zero length.
     hasher->Update(kDelimiter, kDelimiterLength);
-    hasher->Update(label.first);
+    hasher->Update(label->first);
     hasher->Update(kDelimiter, kDelimiterLength);
-    hasher->Update(label.second);
+    hasher->Update(label->second);
   }
 }
 
 // Updates the give hasher with the given metric value.
-void UpdateHashMetricValue(const MetricValue& metric_value, MD5* hasher) {
+template <class Hasher>
+void UpdateHashMetricValue(const MetricValue& metric_value, Hasher* hasher) {
   UpdateHashLabels(metric_value.labels(), hasher);
 }
-}  // namespace
 
-string GenerateReportOperationSignature(const Operation& operation) {
-  MD5 hasher;
+template <class Hasher>
+Signature ReportOperationSignature(const Operation& operation) {
+  Hasher hasher;
   hasher.Update(operation.consumer_id());
   hasher.Update(kDelimiter, kDelimiterLength);
   hasher.Update(operation.operation_name());
 
   UpdateHashLabels(operation.labels(), &hasher);
 
-  return hasher.Digest();
+  return Finish(&hasher);
 }
 
-string GenerateReportMetricValueSignature(const MetricValue& metric_value) {
-  MD5 hasher;
+template <class Hasher>
+Signature ReportMetricValueSignature(const MetricValue& metric_value) {
+  Hasher hasher;
 
   UpdateHashMetricValue(metric_value, &hasher);
-  return hasher.Digest();
+  return Finish(&hasher);
 }
 
-string GenerateCheckRequestSignature(const CheckRequest& request) {
-  MD5 hasher;
+template <class Hasher>
+Signature CheckRequestSignature(const CheckRequest& request) {
+  Hasher hasher;
 
   const Operation& operation = request.operation();
   hasher.Update(operation.operation_name());
@@ -83,50 +141,108 @@ string GenerateCheckRequestSignature(const CheckRequest& request) {
   hasher.Update(kDelimiter, kDelimiterLength);
   UpdateHashLabels(operation.labels(), &hasher);
 
-  // keep sorted order of metric_name
-  std::map<std::string, const ::google::protobuf::RepeatedPtrField<
-                            ::google::api::servicecontrol::v1::MetricValue>*>
-      metric_value_set_map;
-  for (const auto& metric_value_set : operation.metric_value_sets()) {
-    metric_value_set_map[metric_value_set.metric_name()] =
-        &metric_value_set.metric_values();
+  // keep sorted order of metric_name. If a metric name appears more than
+  // once, only its last metric value set is hashed. The position is part of
+  // the sort key so that the last one can be found without a stable sort.
+  typedef std::pair<const MetricValueSet*, int> IndexedSet;
+  const int num_sets = operation.metric_value_sets_size();
+  StackArray<IndexedSet> ordered_sets(num_sets);
+  for (int i = 0; i < num_sets; ++i) {
+    ordered_sets[i] = IndexedSet(&operation.metric_value_sets(i), i);
   }
-
-  for(const auto& metric_value_set: metric_value_set_map) {
+  std::sort(ordered_sets.begin(), ordered_sets.end(),
+            [](const IndexedSet& a, const IndexedSet& b) {
+              int c = a.first->metric_name().compare(b.first->metric_name());
+              return c < 0 || (c == 0 && a.second < b.second);
+            });
+
+  for (int i = 0; i < num_sets; ++i) {
+    const MetricValueSet& metric_value_set = *ordered_sets[i].first;
+    if (i + 1 < num_sets && ordered_sets[i + 1].first->metric_name() ==
+                                metric_value_set.metric_name()) {
+      continue;
+    }
     hasher.Update(kDelimiter, kDelimiterLength);
-    hasher.Update(metric_value_set.first);
+    hasher.Update(metric_value_set.metric_name());
 
-    for(const auto& metric_value: *metric_value_set.second) {
+    for (const auto& metric_value : metric_value_set.metric_values()) {
       UpdateHashMetricValue(metric_value, &hasher);
     }
   }
 
   hasher.Update(kDelimiter, kDelimiterLength);
 
-  return hasher.Digest();
+  return Finish(&hasher);
 }
 
-string GenerateAllocateQuotaRequestSignature(
-    const AllocateQuotaRequest& request) {
-  MD5 hasher;
+template <class Hasher>
+Signature AllocateQuotaRequestSignature(const AllocateQuotaRequest& request) {
+  Hasher hasher;
   const QuotaOperation& operation = request.allocate_operation();
   hasher.Update(operation.method_name());
 
   hasher.Update(kDelimiter, kDelimiterLength);
   hasher.Update(operation.consumer_id());
 
-  // order of metric_name can be changed. need to be sorted.
-  std::set<std::string> metric_names;
+  // order of metric_name can be changed. need to be sorted and deduplicated.
+  StackArray<const string*> metric_names(operation.quota_metrics_size());
+  const string** next = metric_names.begin();
   for (const auto& metric_value_set : operation.quota_metrics()) {
-    metric_names.insert(metric_value_set.metric_name());
+    *next++ = &metric_value_set.metric_name();
   }
+  std::sort(metric_names.begin(), metric_names.end(),
+            [](const string* a, const string* b) { return *a < *b; });
 
-  for (const auto& metric_name : metric_names) {
+  const string* previous = nullptr;
+  for (const string* metric_name : metric_names) {
+    if (previous != nullptr && *previous == *metric_name) {
+      continue;
+    }
+    previous = metric_name;
     hasher.Update(kDelimiter, kDelimiterLength);
-    hasher.Update(metric_name);
+    hasher.Update(*metric_name);
   }
-  return hasher.Digest();
+  return Finish(&hasher);
+}
+
+}  // namespace
+
+Signature GenerateReportOperationSignature(const Operation& operation,
+                                           SignatureHashType hash_type) {
+  return hash_type == SignatureHashType::kMurmur3
+             ? ReportOperationSignature<Murmur3>(operation)
+             : ReportOperationSignature<MD5>(operation);
+}
+
+Signature GenerateReportMetricValueSignature(const MetricValue& metric_value,
+                                             SignatureHashType hash_type) {
+  return hash_type == SignatureHashType::kMurmur3
+             ? ReportMetricValueSignature<Murmur3>(metric_value)
+             : ReportMetricValueSignature<MD5>(metric_value);
+}
+
+Signature GenerateCheckRequestSignature(const CheckRequest& request,
+                                        SignatureHashType hash_type) {
+  return hash_type == SignatureHashType::kMurmur3
+             ? CheckRequestSignature<Murmur3>(request)
+             : CheckRequestSignature<MD5>(request);
+}
+
+Signature GenerateAllocateQuotaRequestSignature(
+    const AllocateQuotaRequest& request, SignatureHashType hash_type) {
+  return hash_type == SignatureHashType::kMurmur3
+             ? AllocateQuotaRequestSignature<Murmur3>(request)
+             : AllocateQuotaRequestSignature<MD5>(request);
 }
 
+string Signature::ToString() const {
+  string digest(kSize, '\0');
+  memcpy(&digest[0], &lo_, sizeof(lo_));
+  memcpy(&digest[sizeof(lo_)], &hi_, sizeof(hi_));
+  return digest;
+}
+
+string Signature::DebugString() const { return MD5::DebugString(ToString()); }
+
 }  // namespace service_control_client
 }  // namespace google
@@ -19,7 +19,11 @@ limitations under the License.
 #ifndef GOOGLE_SERVICE_CONTROL_CLIENT_SIGNATURE_H_
 #define GOOGLE_SERVICE_CONTROL_CLIENT_SIGNATURE_H_
 
+#include <stdint.h>
+#include <string.h>
+#include <functional>
 #include <string>
+#include "include/aggregation_options.h"
 #include "google/api/servicecontrol/v1/metric_value.pb.h"
 #include "google/api/servicecontrol/v1/operation.pb.h"
 #include "google/api/servicecontrol/v1/quota_controller.pb.h"
@@ -28,21 +32,73 @@ limitations under the License.
 namespace google {
 namespace service_control_client {
 
+// A 128-bit request signature, used as the key of the aggregation caches.
+//
+// Trivially copyable, so keys are stored inline and never allocate. The
+// signature is already a uniformly distributed digest, so its hash is just
+// its first 64 bits instead of hashing the bytes again.
+class Signature {
+ public:
+  // Size of the signature in bytes.
+  static const int kSize = 16;
+
+  Signature() : lo_(0), hi_(0) {}
+
+  // Creates a signature from kSize bytes of a binary digest.
+  explicit Signature(const unsigned char* digest) {
+    memcpy(&lo_, digest, sizeof(lo_));
+    memcpy(&hi_, digest + sizeof(lo_), sizeof(hi_));
+  }
+
+  // Returns the hash of the signature.
+  size_t hash() const { return static_cast<size_t>(lo_); }
+
+  // Returns the second half of the signature, which is independent of
+  // hash(). Used to pick cache shards without correlating them with the
+  // hash table buckets inside a shard.
+  uint64_t high_bits() const { return hi_; }
+
+  // Returns the kSize bytes binary digest.
+  std::string ToString() const;
+
+  // Returns the digest as a printable hex string. For debugging and unit-test
+  // only.
+  std::string DebugString() const;
+
+  bool operator==(const Signature& other) const {
+    return lo_ == other.lo_ && hi_ == other.hi_;
+  }
+  bool operator!=(const Signature& other) const { return !(*this == other); }
+  // An arbitrary strict order, used to group equal signatures by sorting.
+  bool operator<(const Signature& other) const {
+    return lo_ < other.lo_ || (lo_ == other.lo_ && hi_ < other.hi_);
+  }
+
+ private:
+  uint64_t lo_;
+  uint64_t hi_;
+};
+
 // Generates signature for an operation based on operation name and operation
 // labels. Should be used only for report requests.
 //
 // Operations having the same signature can be aggregated or batched. Assuming
 // all operations belong to the same service.
-std::string GenerateReportOperationSignature(
-    const ::google::api::servicecontrol::v1::Operation& operation);
+//
+// All signature functions take the hash function to use; signatures generated
+// with different hash functions must not be compared with each other.
+Signature GenerateReportOperationSignature(
+    const ::google::api::servicecontrol::v1::Operation& operation,
+    SignatureHashType hash_type = SignatureHashType::kMd5);
 
 // Generates signature for a metric value based on metric value labels, and
 // currency code(For money value only). Should be used only for report requests.
 //
 // metric value with the same metric name and metric value signature can be
 // merged.
-std::string GenerateReportMetricValueSignature(
-    const ::google::api::servicecontrol::v1::MetricValue& metric_value);
+Signature GenerateReportMetricValueSignature(
+    const ::google::api::servicecontrol::v1::MetricValue& metric_value,
+    SignatureHashType hash_type = SignatureHashType::kMd5);
 
 // Generates signature for a check request. Operation name, consumer id,
 // operation labels, metric name, metric value labels, currency code(For money
@@ -51,13 +107,32 @@ std::string GenerateReportMetricValueSignature(
 //
 // Check request having the same signature can be aggregated. Assuming all
 // requests belong to the same service.
-std::string GenerateCheckRequestSignature(
-    const ::google::api::servicecontrol::v1::CheckRequest& request);
+Signature GenerateCheckRequestSignature(
+    const ::google::api::servicecontrol::v1::CheckRequest& request,
+    SignatureHashType hash_type = SignatureHashType::kMd5);
+
+Signature GenerateAllocateQuotaRequestSignature(
+    const ::google::api::servicecontrol::v1::AllocateQuotaRequest& request,
+    SignatureHashType hash_type = SignatureHashType::kMd5);
 
-std::string GenerateAllocateQuotaRequestSignature(
-    const ::google::api::servicecontrol::v1::AllocateQuotaRequest& request);
+// Returns the index of the cache shard a signature belongs to, in the range
+// [0, num_shards). Signatures are digests and already uniformly distributed,
+// so their bits are used directly instead of hashing them again.
+inline size_t GetSignatureShard(const Signature& signature, size_t num_shards) {
+  return num_shards <= 1 ? 0 : signature.high_bits() % num_shards;
+}
 
 }  // namespace service_control_client
 }  // namespace google
 
+namespace std {
+template <>
+struct hash<::google::service_control_client::Signature> {
+  size_t operator()(
+      const ::google::service_control_client::Signature& signature) const {
+    return signature.hash();
+  }
+};
+}  // namespace std
+
 #endif  // GOOGLE_SERVICE_CONTROL_CLIENT_SIGNATURE_H_
@@ -21,6 +21,7 @@ limitations under the License.
 #include "gtest/gtest.h"
 
 using std::string;
+using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
 using ::google::api::servicecontrol::v1::CheckRequest;
 using ::google::api::servicecontrol::v1::MetricValue;
 using ::google::api::servicecontrol::v1::Operation;
@@ -109,7 +110,7 @@ class SignatureUtilTest : public ::testing::Test {
 
 TEST_F(SignatureUtilTest, OperationWithNoLabel) {
   EXPECT_EQ("d056b16b88b914b40cd5a82470bc02a5",
-            MD5::DebugString(GenerateReportOperationSignature(operation_)));
+            GenerateReportOperationSignature(operation_).DebugString());
 }
 
 TEST_F(SignatureUtilTest, OperationWithLabels) {
@@ -117,13 +118,13 @@ TEST_F(SignatureUtilTest, OperationWithLabels) {
   AddOperationLabel(kResourceTypeLabel, "instance", &operation_);
 
   EXPECT_EQ("93bc5c613fc4eabb2a40042f7f73f671",
-            MD5::DebugString(GenerateReportOperationSignature(operation_)));
+            GenerateReportOperationSignature(operation_).DebugString());
 }
 
 TEST_F(SignatureUtilTest, MetricValueWithNoLabel) {
   EXPECT_EQ(
       "d41d8cd98f00b204e9800998ecf8427e",
-      MD5::DebugString(GenerateReportMetricValueSignature(metric_value_)));
+      GenerateReportMetricValueSignature(metric_value_).DebugString());
 }
 
 TEST_F(SignatureUtilTest, MetricValueWithLabels) {
@@ -131,14 +132,125 @@ TEST_F(SignatureUtilTest, MetricValueWithLabels) {
 
   EXPECT_EQ(
       "3f6bc74c0a4be6b6eeaab1faac30a365",
-      MD5::DebugString(GenerateReportMetricValueSignature(metric_value_)));
+      GenerateReportMetricValueSignature(metric_value_).DebugString());
 }
 
 TEST_F(SignatureUtilTest, CheckRequest) {
   CheckRequest request;
   ASSERT_TRUE(TextFormat::ParseFromString(kCheckRequest, &request));
   EXPECT_EQ("4deb431384f1dbb616b59e00db496347",
-            MD5::DebugString(GenerateCheckRequestSignature(request)));
+            GenerateCheckRequestSignature(request).DebugString());
+}
+
+TEST_F(SignatureUtilTest, OperationWithManyLabels) {
+  // More labels than fit in the on-stack sort buffer, added in reverse order.
+  string expected = operation_.consumer_id() + string(1, '\0') +
+                    operation_.operation_name();
+  for (int i = 0; i < 50; ++i) {
+    char key[16];
+    snprintf(key, sizeof(key), "label_%02d", i);
+    expected += string(1, '\0') + key + string(1, '\0') + "value";
+  }
+  for (int i = 49; i >= 0; --i) {
+    char key[16];
+    snprintf(key, sizeof(key), "label_%02d", i);
+    AddOperationLabel(key, "value", &operation_);
+  }
+
+  EXPECT_EQ(MD5()(expected.data(), expected.size()),
+            GenerateReportOperationSignature(operation_).ToString());
+}
+
+TEST_F(SignatureUtilTest, CheckRequestMetricOrder) {
+  CheckRequest request;
+  ASSERT_TRUE(TextFormat::ParseFromString(kCheckRequest, &request));
+  Signature signature = GenerateCheckRequestSignature(request);
+
+  // Adding a metric value set changes the signature, but its position does
+  // not matter.
+  CheckRequest appended = request;
+  auto* metric_value_set =
+      appended.mutable_operation()->add_metric_value_sets();
+  metric_value_set->set_metric_name("chemisttest.googleapis.com/a_metric");
+  metric_value_set->add_metric_values()->set_int64_value(1);
+  CheckRequest prepended = appended;
+  prepended.mutable_operation()->mutable_metric_value_sets()->SwapElements(0,
+                                                                           1);
+
+  EXPECT_NE(signature, GenerateCheckRequestSignature(appended));
+  EXPECT_EQ(GenerateCheckRequestSignature(appended),
+            GenerateCheckRequestSignature(prepended));
+}
+
+TEST_F(SignatureUtilTest, CheckRequestDuplicateMetricName) {
+  CheckRequest request;
+  ASSERT_TRUE(TextFormat::ParseFromString(kCheckRequest, &request));
+
+  // Only the last metric value set of a metric name is used.
+  CheckRequest duplicated = request;
+  auto* metric_value_set =
+      duplicated.mutable_operation()->add_metric_value_sets();
+  *metric_value_set = request.operation().metric_value_sets(0);
+  AddMetricValueLabel(kCustomLabel, "disk",
+                      metric_value_set->mutable_metric_values(0));
+  EXPECT_NE(GenerateCheckRequestSignature(request),
+            GenerateCheckRequestSignature(duplicated));
+
+  duplicated.mutable_operation()->mutable_metric_value_sets()->SwapElements(0,
+                                                                            1);
+  EXPECT_EQ(GenerateCheckRequestSignature(request),
+            GenerateCheckRequestSignature(duplicated));
+}
+
+TEST_F(SignatureUtilTest, AllocateQuotaRequest) {
+  AllocateQuotaRequest request;
+  auto* operation = request.mutable_allocate_operation();
+  operation->set_method_name("methodname");
+  operation->set_consumer_id("project:some-project-id");
+  operation->add_quota_metrics()->set_metric_name("metric_b");
+  operation->add_quota_metrics()->set_metric_name("metric_a");
+  Signature signature = GenerateAllocateQuotaRequestSignature(request);
+
+  string expected = string("methodname") + string(1, '\0') +
+                    "project:some-project-id" + string(1, '\0') + "metric_a" +
+                    string(1, '\0') + "metric_b";
+  EXPECT_EQ(MD5()(expected.data(), expected.size()), signature.ToString());
+
+  // Duplicated metric names are only hashed once.
+  operation->add_quota_metrics()->set_metric_name("metric_b");
+  EXPECT_EQ(signature, GenerateAllocateQuotaRequestSignature(request));
+}
+
+TEST_F(SignatureUtilTest, SignatureHashAndShard) {
+  Signature signature = GenerateReportOperationSignature(operation_);
+  Signature copy = signature;
+  EXPECT_EQ(signature, copy);
+  EXPECT_EQ(std::hash<Signature>()(signature), signature.hash());
+  EXPECT_NE(signature, GenerateReportMetricValueSignature(metric_value_));
+  EXPECT_EQ(0, GetSignatureShard(signature, 1));
+  EXPECT_LT(GetSignatureShard(signature, 7), 7);
+}
+
+TEST_F(SignatureUtilTest, Murmur3OperationWithLabels) {
+  Operation reordered = operation_;
+  AddOperationLabel(kRegionLabel, "us-central1", &operation_);
+  AddOperationLabel(kResourceTypeLabel, "instance", &operation_);
+  AddOperationLabel(kResourceTypeLabel, "instance", &reordered);
+  AddOperationLabel(kRegionLabel, "us-central1", &reordered);
+
+  Signature signature =
+      GenerateReportOperationSignature(operation_, SignatureHashType::kMurmur3);
+  EXPECT_EQ("ea863f49fb704c339bc51b683214f829", signature.DebugString());
+  EXPECT_EQ(signature, GenerateReportOperationSignature(
+                           reordered, SignatureHashType::kMurmur3));
+}
+
+TEST_F(SignatureUtilTest, Murmur3CheckRequest) {
+  CheckRequest request;
+  ASSERT_TRUE(TextFormat::ParseFromString(kCheckRequest, &request));
+  EXPECT_EQ("32d1a4a7bf91305d6c6803dc5ee7ba3c",
+            GenerateCheckRequestSignature(request, SignatureHashType::kMurmur3)
+                .DebugString());
 }
 
 }  // namespace
@@ -41,6 +41,48 @@ class MockServiceControlClient : public ServiceControlClient {
       ::google::api::servicecontrol::v1::CheckResponse* check_response,
       DoneCallback on_check_done, TransportCheckFunc check_transport));
 
+  MOCK_METHOD(void, Check, (
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done));
+
+  MOCK_METHOD(void, Check, (
+      ::google::api::servicecontrol::v1::CheckRequest&& check_request,
+      ::google::api::servicecontrol::v1::CheckResponse* check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport));
+
+  MOCK_METHOD(void, Check, (
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done));
+
+  MOCK_METHOD(::google::protobuf::util::Status, Check, (
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response));
+
+  MOCK_METHOD(void, Check, (
+      const ::google::api::servicecontrol::v1::CheckRequest& check_request,
+      std::shared_ptr<const ::google::api::servicecontrol::v1::CheckResponse>*
+          check_response,
+      DoneCallback on_check_done, TransportCheckFunc check_transport));
+
+  MOCK_METHOD(void, CheckBatch, (
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses,
+      DoneCallback on_check_done));
+
+  MOCK_METHOD(::google::protobuf::util::Status, CheckBatch, (
+      const std::vector<::google::api::servicecontrol::v1::CheckRequest>&
+          check_requests,
+      std::vector<std::shared_ptr<
+          const ::google::api::servicecontrol::v1::CheckResponse>>*
+          check_responses));
+
   MOCK_METHOD(void, Quota, (
       const ::google::api::servicecontrol::v1::AllocateQuotaRequest&
           quota_request,
@@ -59,6 +101,16 @@ class MockServiceControlClient : public ServiceControlClient {
       ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
       DoneCallback on_quota_done, TransportQuotaFunc quota_transport));
 
+  MOCK_METHOD(void, Quota, (
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done));
+
+  MOCK_METHOD(void, Quota, (
+      ::google::api::servicecontrol::v1::AllocateQuotaRequest&& quota_request,
+      ::google::api::servicecontrol::v1::AllocateQuotaResponse* quota_response,
+      DoneCallback on_quota_done, TransportQuotaFunc quota_transport));
+
   MOCK_METHOD(void, Report, (
       const ::google::api::servicecontrol::v1::ReportRequest& report_request,
       ::google::api::servicecontrol::v1::ReportResponse* report_response,
@@ -73,8 +125,20 @@ class MockServiceControlClient : public ServiceControlClient {
       ::google::api::servicecontrol::v1::ReportResponse* report_response,
       DoneCallback on_report_done, TransportReportFunc report_transport));
 
+  MOCK_METHOD(void, ReportBatch, (
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          report_requests,
+      DoneCallback on_report_done));
+
+  MOCK_METHOD(::google::protobuf::util::Status, ReportBatch, (
+      const std::vector<::google::api::servicecontrol::v1::ReportRequest>&
+          report_requests));
+
   MOCK_METHOD(::google::protobuf::util::Status, GetStatistics,(
       Statistics* stat), (const));
+
+  MOCK_METHOD(::google::protobuf::util::Status, GetDetailedStatistics,(
+      DetailedStatistics* stat), (const));
 };
 
 class MockServiceControlClientFactory : public ServiceControlClientFactory {
@@ -131,8 +131,8 @@ bool BucketsApproximatelyEqual(const Distribution& first,
   return true;
 }
 
-void UpdateExponentialBucketCount(double value, Distribution* distribution) {
-  const auto& exponential = distribution->exponential_buckets();
+int ExponentialBucketIndex(double value, const Distribution& distribution) {
+  const auto& exponential = distribution.exponential_buckets();
   int bucket_index = 0;
   if (value >= exponential.scale()) {
     // Should be put into bucket bucket_index, starting from 0.
@@ -142,12 +142,11 @@ void UpdateExponentialBucketCount(double value, Distribution* distribution) {
       bucket_index = exponential.num_finite_buckets() + 1;
     }
   }
-  distribution->set_bucket_counts(
-      bucket_index, distribution->bucket_counts(bucket_index) + 1);
+  return bucket_index;
 }
 
-void UpdateLinearBucketCount(double value, Distribution* distribution) {
-  const auto& linear = distribution->linear_buckets();
+int LinearBucketIndex(double value, const Distribution& distribution) {
+  const auto& linear = distribution.linear_buckets();
   double upper_bound =
       linear.offset() + linear.num_finite_buckets() * linear.width();
   double lower_bound = linear.offset();
@@ -160,13 +159,11 @@ void UpdateLinearBucketCount(double value, Distribution* distribution) {
   } else {
     bucket_index = 1 + static_cast<int>((value - lower_bound) / linear.width());
   }
-
-  distribution->set_bucket_counts(
-      bucket_index, distribution->bucket_counts(bucket_index) + 1);
+  return bucket_index;
 }
 
-void UpdateExplicitBucketCount(double value, Distribution* distribution) {
-  const auto& bounds = distribution->explicit_buckets().bounds();
+int ExplicitBucketIndex(double value, const Distribution& distribution) {
+  const auto& bounds = distribution.explicit_buckets().bounds();
   int bucket_index = 0;
   if (value >= bounds.Get(0)) {
     // -inf <  b0 <  b1 <  b2 <  b3 < +inf     (4 values in "bounds")
@@ -175,8 +172,7 @@ void UpdateExplicitBucketCount(double value, Distribution* distribution) {
     bucket_index = std::distance(
         bounds.begin(), std::upper_bound(bounds.begin(), bounds.end(), value));
   }
-  distribution->set_bucket_counts(
-      bucket_index, distribution->bucket_counts(bucket_index) + 1);
+  return bucket_index;
 }
 
 }  // namespace
@@ -248,25 +244,35 @@ Status DistributionHelper::InitExplicit(const std::vector<double>& bounds,
 }
 
 Status DistributionHelper::AddSample(double value, Distribution* distribution) {
-  switch (distribution->bucket_option_case()) {
+  int bucket_index = BucketIndex(value, *distribution);
+  if (bucket_index < 0) {
+    return Status(StatusCode::kInvalidArgument,
+                  StrCat("Unknown bucket option case: ",
+                         distribution->bucket_option_case()));
+  }
+  UpdateGeneralStatictics(value, distribution);
+  distribution->set_bucket_counts(
+      bucket_index, distribution->bucket_counts(bucket_index) + 1);
+  return OkStatus();
+}
+
+int DistributionHelper::BucketIndex(double value,
+                                    const Distribution& distribution) {
+  switch (distribution.bucket_option_case()) {
     case Distribution::kExponentialBuckets:
-      UpdateGeneralStatictics(value, distribution);
-      UpdateExponentialBucketCount(value, distribution);
-      break;
+      return ExponentialBucketIndex(value, distribution);
     case Distribution::kLinearBuckets:
-      UpdateGeneralStatictics(value, distribution);
-      UpdateLinearBucketCount(value, distribution);
-      break;
+      return LinearBucketIndex(value, distribution);
     case Distribution::kExplicitBuckets:
-      UpdateGeneralStatictics(value, distribution);
-      UpdateExplicitBucketCount(value, distribution);
-      break;
+      return ExplicitBucketIndex(value, distribution);
     default:
-      return Status(StatusCode::kInvalidArgument,
-                    StrCat("Unknown bucket option case: ",
-                           distribution->bucket_option_case()));
+      return -1;
   }
-  return OkStatus();
+}
+
+bool DistributionHelper::BucketOptionsEqual(const Distribution& first,
+                                            const Distribution& second) {
+  return BucketsApproximatelyEqual(first, second);
 }
 
 Status DistributionHelper::Merge(const Distribution& from, Distribution* to) {
@@ -47,6 +47,18 @@ class DistributionHelper final {
       double value,
       ::google::api::servicecontrol::v1::Distribution* distribution);
 
+  // Returns the index in bucket_counts of the bucket the value falls into,
+  // or -1 if the distribution has no bucket options.
+  static int BucketIndex(
+      double value,
+      const ::google::api::servicecontrol::v1::Distribution& distribution);
+
+  // Returns whether the two distributions have approximately the same bucket
+  // options, i.e. whether they can be merged.
+  static bool BucketOptionsEqual(
+      const ::google::api::servicecontrol::v1::Distribution& first,
+      const ::google::api::servicecontrol::v1::Distribution& second);
+
   // Merges the "from" distribution to "to" distribution.
   // No change if the bucket options does not match.
   static ::google::protobuf::util::Status Merge(
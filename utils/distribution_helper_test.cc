@@ -450,6 +450,25 @@ TEST_F(DistributionHelperTest, InitializeDistribution_Explicit) {
                                                       expected));
 }
 
+TEST_F(DistributionHelperTest, BucketIndex) {
+  EXPECT_EQ(0, helper_.BucketIndex(0.0005, exponential_distribution_));
+  EXPECT_EQ(1, helper_.BucketIndex(0.001, exponential_distribution_));
+  EXPECT_EQ(2, helper_.BucketIndex(0.003, exponential_distribution_));
+  EXPECT_EQ(3, helper_.BucketIndex(100, exponential_distribution_));
+
+  EXPECT_EQ(0, helper_.BucketIndex(0, linear_distribution_));
+  EXPECT_EQ(1, helper_.BucketIndex(2, linear_distribution_));
+  EXPECT_EQ(2, helper_.BucketIndex(3, linear_distribution_));
+  EXPECT_EQ(3, helper_.BucketIndex(5, linear_distribution_));
+
+  EXPECT_EQ(0, helper_.BucketIndex(0, explicit_distribution_));
+  EXPECT_EQ(1, helper_.BucketIndex(1, explicit_distribution_));
+  EXPECT_EQ(2, helper_.BucketIndex(4, explicit_distribution_));
+  EXPECT_EQ(3, helper_.BucketIndex(5, explicit_distribution_));
+
+  EXPECT_EQ(-1, helper_.BucketIndex(1, Distribution()));
+}
+
 TEST_F(DistributionHelperTest, AddSample_OneValue_Exponential) {
   Distribution expected;
   ASSERT_TRUE(
@@ -0,0 +1,279 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// An open-addressing hash map storing its entries in one contiguous array.
+//
+// Compared with std::unordered_map, a lookup touches a byte array of control
+// tags and then the matching slot, instead of a bucket array and a separately
+// allocated node. Entries are kept in place with linear probing, and erase
+// shifts the following entries back so no tombstones are left behind.
+//
+// Differences from std::unordered_map:
+// . Insertion and erase invalidate all iterators, pointers and references.
+// . value_type is std::pair<Key, T>. The key must not be modified through an
+//   iterator.
+// . Key and T must be default constructible and movable.
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_FLAT_HASH_MAP_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_FLAT_HASH_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace google {
+namespace service_control_client {
+
+template <class Key, class T, class Hash = std::hash<Key>,
+          class EQ = std::equal_to<Key> >
+class FlatHashMap {
+ public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef std::pair<Key, T> value_type;
+  typedef size_t size_type;
+
+ private:
+  struct Slot {
+    size_t hash;
+    value_type value;
+  };
+
+  template <bool kConst>
+  class Iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename FlatHashMap::value_type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef typename std::conditional<kConst, const FlatHashMap*,
+                                      FlatHashMap*>::type MapPointer;
+    typedef typename std::conditional<kConst, const value_type&,
+                                      value_type&>::type reference;
+    typedef typename std::conditional<kConst, const value_type*,
+                                      value_type*>::type pointer;
+
+    Iterator() : map_(nullptr), index_(0) {}
+    Iterator(MapPointer map, size_t index) : map_(map), index_(index) {
+      SkipEmpty();
+    }
+    // Allows converting an iterator to a const_iterator.
+    Iterator(const Iterator<false>& other)
+        : map_(other.map_), index_(other.index_) {}
+
+    reference operator*() const { return map_->slots_[index_].value; }
+    pointer operator->() const { return &map_->slots_[index_].value; }
+
+    Iterator& operator++() {
+      ++index_;
+      SkipEmpty();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator it = *this;
+      ++*this;
+      return it;
+    }
+
+    friend bool operator==(const Iterator& a, const Iterator& b) {
+      return a.index_ == b.index_;
+    }
+    friend bool operator!=(const Iterator& a, const Iterator& b) {
+      return a.index_ != b.index_;
+    }
+
+   private:
+    friend class FlatHashMap;
+    template <bool>
+    friend class Iterator;
+
+    void SkipEmpty() {
+      while (index_ < map_->ctrl_.size() && map_->ctrl_[index_] == kEmpty) {
+        ++index_;
+      }
+    }
+
+    MapPointer map_;
+    size_t index_;
+  };
+
+ public:
+  typedef Iterator<false> iterator;
+  typedef Iterator<true> const_iterator;
+
+  explicit FlatHashMap(const Hash& hash = Hash(), const EQ& eq = EQ())
+      : size_(0), hash_(hash), eq_(eq) {}
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, ctrl_.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, ctrl_.size()); }
+
+  size_type size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  iterator find(const Key& key) { return iterator(this, FindIndex(key)); }
+  const_iterator find(const Key& key) const {
+    return const_iterator(this, FindIndex(key));
+  }
+
+  // Returns the value mapped to key, inserting a default constructed value if
+  // the key is not present.
+  T& operator[](const Key& key) {
+    size_t index = FindIndex(key);
+    if (index == ctrl_.size()) {
+      index = Insert(key);
+    }
+    return slots_[index].value.second;
+  }
+
+  void erase(iterator it) { EraseIndex(it.index_); }
+
+  size_type erase(const Key& key) {
+    size_t index = FindIndex(key);
+    if (index == ctrl_.size()) {
+      return 0;
+    }
+    EraseIndex(index);
+    return 1;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < ctrl_.size(); ++i) {
+      if (ctrl_[i] != kEmpty) {
+        ctrl_[i] = kEmpty;
+        slots_[i].value = value_type();
+      }
+    }
+    size_ = 0;
+  }
+
+  // Makes room for at least size_hint entries without rehashing.
+  void resize(size_type size_hint) {
+    size_t capacity = kMinCapacity;
+    while (capacity * kMaxLoadNumerator < size_hint * kMaxLoadDenominator) {
+      capacity *= 2;
+    }
+    if (capacity > ctrl_.size()) {
+      Rehash(capacity);
+    }
+  }
+
+ private:
+  static const uint8_t kEmpty = 0;
+  static const size_t kMinCapacity = 16;
+  // The table grows when it would be more than 3/4 full.
+  static const size_t kMaxLoadNumerator = 3;
+  static const size_t kMaxLoadDenominator = 4;
+
+  // Returns the control byte of an occupied slot: the high bit marks the slot
+  // as full, and the low 7 bits are taken from the top of the hash so that
+  // most mismatches are rejected without reading the slot.
+  static uint8_t Tag(size_t hash) {
+    return static_cast<uint8_t>(0x80 | (hash >> (sizeof(size_t) * 8 - 7)));
+  }
+
+  size_t Mask() const { return ctrl_.size() - 1; }
+
+  // Returns the index of the slot holding key, or ctrl_.size() if not found.
+  size_t FindIndex(const Key& key) const {
+    if (size_ == 0) {
+      return ctrl_.size();
+    }
+    const size_t hash = hash_(key);
+    const uint8_t tag = Tag(hash);
+    for (size_t i = hash & Mask();; i = (i + 1) & Mask()) {
+      if (ctrl_[i] == kEmpty) {
+        return ctrl_.size();
+      }
+      if (ctrl_[i] == tag && slots_[i].hash == hash &&
+          eq_(slots_[i].value.first, key)) {
+        return i;
+      }
+    }
+  }
+
+  // Inserts key, which must not be present, and returns its slot index.
+  size_t Insert(const Key& key) {
+    if ((size_ + 1) * kMaxLoadDenominator >
+        ctrl_.size() * kMaxLoadNumerator) {
+      Rehash(ctrl_.empty() ? kMinCapacity : ctrl_.size() * 2);
+    }
+    const size_t hash = hash_(key);
+    size_t i = hash & Mask();
+    while (ctrl_[i] != kEmpty) {
+      i = (i + 1) & Mask();
+    }
+    ctrl_[i] = Tag(hash);
+    slots_[i].hash = hash;
+    slots_[i].value.first = key;
+    ++size_;
+    return i;
+  }
+
+  // Removes the entry at index, moving back the entries that follow it in the
+  // same probe sequence so that lookups never need to skip erased slots.
+  void EraseIndex(size_t index) {
+    size_t hole = index;
+    for (size_t i = (hole + 1) & Mask(); ctrl_[i] != kEmpty;
+         i = (i + 1) & Mask()) {
+      size_t home = slots_[i].hash & Mask();
+      // The entry at i can fill the hole unless its home slot lies cyclically
+      // after the hole, in (hole, i].
+      if (((i - home) & Mask()) >= ((i - hole) & Mask())) {
+        ctrl_[hole] = ctrl_[i];
+        slots_[hole] = std::move(slots_[i]);
+        hole = i;
+      }
+    }
+    ctrl_[hole] = kEmpty;
+    slots_[hole].value = value_type();
+    --size_;
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<uint8_t> old_ctrl(capacity, uint8_t(kEmpty));
+    std::vector<Slot> old_slots(capacity);
+    old_ctrl.swap(ctrl_);
+    old_slots.swap(slots_);
+    for (size_t j = 0; j < old_ctrl.size(); ++j) {
+      if (old_ctrl[j] == kEmpty) {
+        continue;
+      }
+      size_t i = old_slots[j].hash & Mask();
+      while (ctrl_[i] != kEmpty) {
+        i = (i + 1) & Mask();
+      }
+      ctrl_[i] = old_ctrl[j];
+      slots_[i] = std::move(old_slots[j]);
+    }
+  }
+
+  // Control bytes, one per slot. kEmpty or a Tag(). The capacity is always a
+  // power of 2.
+  std::vector<uint8_t> ctrl_;
+  std::vector<Slot> slots_;
+  size_t size_;
+  Hash hash_;
+  EQ eq_;
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_FLAT_HASH_MAP_H_
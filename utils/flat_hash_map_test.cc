@@ -0,0 +1,132 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/flat_hash_map.h"
+
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+// Maps every key to a few hash values to force long probe sequences.
+struct CollidingHash {
+  size_t operator()(int key) const { return key % 3; }
+};
+
+TEST(FlatHashMapTest, InsertFindErase) {
+  FlatHashMap<std::string, int> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.find("a") == map.end());
+
+  map["a"] = 1;
+  map["b"] = 2;
+  EXPECT_EQ(2, map.size());
+  ASSERT_TRUE(map.find("a") != map.end());
+  EXPECT_EQ(1, map.find("a")->second);
+  EXPECT_EQ("b", map.find("b")->first);
+
+  map["a"] = 3;
+  EXPECT_EQ(2, map.size());
+  EXPECT_EQ(3, map["a"]);
+
+  EXPECT_EQ(1, map.erase("a"));
+  EXPECT_EQ(0, map.erase("a"));
+  EXPECT_TRUE(map.find("a") == map.end());
+  map.erase(map.find("b"));
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.begin() == map.end());
+}
+
+TEST(FlatHashMapTest, Iteration) {
+  FlatHashMap<int, int> map;
+  for (int i = 0; i < 100; ++i) {
+    map[i] = i * 2;
+  }
+  int count = 0;
+  int sum = 0;
+  for (FlatHashMap<int, int>::const_iterator it = map.begin(); it != map.end();
+       it++) {
+    EXPECT_EQ(it->first * 2, it->second);
+    sum += it->first;
+    ++count;
+  }
+  EXPECT_EQ(100, count);
+  EXPECT_EQ(99 * 100 / 2, sum);
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.begin() == map.end());
+  map[1] = 1;
+  EXPECT_EQ(1, map.size());
+}
+
+TEST(FlatHashMapTest, Resize) {
+  FlatHashMap<int, int> map;
+  map[1] = 1;
+  map.resize(1000);
+  EXPECT_EQ(1, map.size());
+  EXPECT_EQ(1, map[1]);
+}
+
+template <class Map>
+void RandomOperations(Map* map) {
+  std::unordered_map<int, int> expected;
+  std::mt19937 random(301);
+  std::uniform_int_distribution<int> key_dist(0, 500);
+  for (int i = 0; i < 20000; ++i) {
+    int key = key_dist(random);
+    switch (random() % 3) {
+      case 0:
+        (*map)[key] = i;
+        expected[key] = i;
+        break;
+      case 1:
+        ASSERT_EQ(expected.erase(key), map->erase(key));
+        break;
+      case 2: {
+        auto it = map->find(key);
+        auto expected_it = expected.find(key);
+        ASSERT_EQ(expected_it == expected.end(), it == map->end());
+        if (it != map->end()) {
+          ASSERT_EQ(expected_it->second, it->second);
+        }
+        break;
+      }
+    }
+    ASSERT_EQ(expected.size(), map->size());
+  }
+  for (const auto& entry : *map) {
+    ASSERT_EQ(expected[entry.first], entry.second);
+  }
+}
+
+TEST(FlatHashMapTest, RandomOperations) {
+  FlatHashMap<int, int> map;
+  RandomOperations(&map);
+}
+
+TEST(FlatHashMapTest, RandomOperationsWithCollisions) {
+  FlatHashMap<int, int, CollidingHash> map;
+  RandomOperations(&map);
+}
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
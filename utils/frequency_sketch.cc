@@ -0,0 +1,78 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/frequency_sketch.h"
+
+#include <algorithm>
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+// Seeds spreading the hash differently in each row.
+const uint64_t kSeeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                           0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+
+}  // namespace
+
+FrequencySketch::FrequencySketch(int64_t capacity)
+    : additions_(0), sample_size_(10 * std::max<int64_t>(capacity, 1)) {
+  size_t width = 16;
+  while (width < static_cast<size_t>(capacity)) {
+    width <<= 1;
+  }
+  width_mask_ = width - 1;
+  counters_.assign(kDepth * width / 2, 0);
+}
+
+size_t FrequencySketch::Index(uint64_t hash, int row) const {
+  uint64_t h = (hash + kSeeds[row]) * kSeeds[row];
+  h ^= h >> 32;
+  return row * (width_mask_ + 1) + (h & width_mask_);
+}
+
+void FrequencySketch::Increment(uint64_t hash) {
+  bool added = false;
+  for (int row = 0; row < kDepth; ++row) {
+    size_t index = Index(hash, row);
+    if (Counter(index) < kMaxCount) {
+      counters_[index >> 1] += 1 << ((index & 1) * 4);
+      added = true;
+    }
+  }
+  if (added && ++additions_ >= sample_size_) {
+    Reset();
+  }
+}
+
+int FrequencySketch::Frequency(uint64_t hash) const {
+  int frequency = kMaxCount;
+  for (int row = 0; row < kDepth; ++row) {
+    frequency = std::min(frequency, Counter(Index(hash, row)));
+  }
+  return frequency;
+}
+
+void FrequencySketch::Reset() {
+  // Halves both counters of each byte, dropping the bit shifted from the
+  // high counter into the low one.
+  for (uint8_t& counters : counters_) {
+    counters = (counters >> 1) & 0x77;
+  }
+  additions_ /= 2;
+}
+
+}  // namespace service_control_client
+}  // namespace google
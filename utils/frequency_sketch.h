@@ -0,0 +1,89 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// A frequency sketch for the TinyLFU cache admission policy.
+//
+// It is a count-min sketch of 4 rows of 4-bit counters, packed two per byte,
+// estimating how many times a key was recently used from its hash. When the number of recorded
+// uses reaches 10 times the cache capacity, all counters are halved, so the
+// estimates follow changes in popularity.
+//
+// A cache using it admits a new entry only if it is more popular than the
+// entry it would evict: a scan of keys used once does not flush out the hot
+// entries of a full cache.
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_FREQUENCY_SKETCH_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_FREQUENCY_SKETCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "google_macros.h"
+
+namespace google {
+namespace service_control_client {
+
+// Not thread safe.
+class FrequencySketch {
+ public:
+  // capacity is the maximum number of entries of the cache.
+  explicit FrequencySketch(int64_t capacity);
+
+  // Records a use of the key with the given hash.
+  void Increment(uint64_t hash);
+
+  // Returns the estimated number of recent uses of the key with the given
+  // hash, at most 15.
+  int Frequency(uint64_t hash) const;
+
+  // Returns whether a new entry should be admitted into the full cache, by
+  // evicting the victim entry.
+  bool Admit(uint64_t candidate_hash, uint64_t victim_hash) const {
+    return Frequency(candidate_hash) > Frequency(victim_hash);
+  }
+
+ private:
+  static const int kDepth = 4;
+  static const uint8_t kMaxCount = 15;
+
+  // Returns the index of the counter of the hash in the given row.
+  size_t Index(uint64_t hash, int row) const;
+
+  // Returns the counter at the given index.
+  int Counter(size_t index) const {
+    return (counters_[index >> 1] >> ((index & 1) * 4)) & kMaxCount;
+  }
+
+  // Halves all counters.
+  void Reset();
+
+  // kDepth rows of width_mask_ + 1 counters. The counter at index i is in the
+  // low 4 bits of counters_[i / 2] if i is even, in its high 4 bits otherwise.
+  std::vector<uint8_t> counters_;
+  size_t width_mask_;
+
+  // The number of recorded uses since the last Reset(), halved by Reset(),
+  // and the number triggering a Reset().
+  int64_t additions_;
+  int64_t sample_size_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(FrequencySketch);
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_FREQUENCY_SKETCH_H_
@@ -0,0 +1,61 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/frequency_sketch.h"
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace service_control_client {
+
+TEST(FrequencySketchTest, TestFrequency) {
+  FrequencySketch sketch(100);
+  EXPECT_EQ(sketch.Frequency(1), 0);
+  for (int i = 0; i < 5; ++i) {
+    sketch.Increment(1);
+  }
+  sketch.Increment(2);
+  EXPECT_EQ(sketch.Frequency(1), 5);
+  EXPECT_EQ(sketch.Frequency(2), 1);
+
+  EXPECT_TRUE(sketch.Admit(1, 2));
+  EXPECT_FALSE(sketch.Admit(2, 1));
+  // Ties are not admitted.
+  EXPECT_FALSE(sketch.Admit(2, 2));
+
+  // Counters saturate.
+  for (int i = 0; i < 20; ++i) {
+    sketch.Increment(1);
+  }
+  EXPECT_EQ(sketch.Frequency(1), 15);
+}
+
+TEST(FrequencySketchTest, TestReset) {
+  FrequencySketch sketch(16);
+  for (int i = 0; i < 20; ++i) {
+    sketch.Increment(1);
+  }
+  EXPECT_EQ(sketch.Frequency(1), 15);
+  // At most 160 uses trigger a reset, halving the counters.
+  uint64_t hash = 1000;
+  while (sketch.Frequency(1) == 15) {
+    sketch.Increment(hash++);
+  }
+  EXPECT_LE(hash - 1000, 160);
+  EXPECT_EQ(sketch.Frequency(1), 7);
+}
+
+}  // namespace service_control_client
+}  // namespace google
@@ -0,0 +1,139 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/latency_recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include "utils/distribution_helper.h"
+
+using ::google::api::servicecontrol::v1::Distribution;
+
+namespace google {
+namespace service_control_client {
+
+namespace {
+
+const double kNanosPerMicro = 1000;
+
+}  // namespace
+
+const double LatencyRecorder::kGrowthFactor = 2;
+const double LatencyRecorder::kScale = 1.0 / 64;
+
+LatencyRecorder::Slot::Slot()
+    : count(0),
+      sum(0),
+      sum_of_squares(0),
+      minimum(std::numeric_limits<int64_t>::max()),
+      maximum(0) {
+  for (auto& bucket_count : bucket_counts) {
+    bucket_count.store(0, std::memory_order_relaxed);
+  }
+}
+
+LatencyRecorder::LatencyRecorder()
+    : slots_(new Slot[ShardedCounter::kSlots]) {
+  (void)DistributionHelper::InitExponential(kNumFiniteBuckets, kGrowthFactor,
+                                            kScale, &buckets_);
+}
+
+int64_t LatencyRecorder::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void LatencyRecorder::Record(int64_t latency) {
+  latency = std::max<int64_t>(latency, 0);
+  int bucket_index =
+      DistributionHelper::BucketIndex(latency / kNanosPerMicro, buckets_);
+  // Other threads rarely use the same slot, so the read-modify-writes below
+  // do not contend.
+  Slot& slot = slots_[ShardedCounter::ThreadSlot()];
+  slot.bucket_counts[bucket_index].fetch_add(1, std::memory_order_relaxed);
+  slot.count.fetch_add(1, std::memory_order_relaxed);
+  slot.sum.fetch_add(latency, std::memory_order_relaxed);
+
+  double square = static_cast<double>(latency) * latency;
+  double sum_of_squares = slot.sum_of_squares.load(std::memory_order_relaxed);
+  while (!slot.sum_of_squares.compare_exchange_weak(
+      sum_of_squares, sum_of_squares + square, std::memory_order_relaxed)) {
+  }
+  int64_t minimum = slot.minimum.load(std::memory_order_relaxed);
+  while (latency < minimum &&
+         !slot.minimum.compare_exchange_weak(minimum, latency,
+                                             std::memory_order_relaxed)) {
+  }
+  int64_t maximum = slot.maximum.load(std::memory_order_relaxed);
+  while (latency > maximum &&
+         !slot.maximum.compare_exchange_weak(maximum, latency,
+                                             std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyRecorder::ToDistribution(Distribution* distribution) const {
+  *distribution = buckets_;
+  int64_t count = 0;
+  double sum = 0;
+  double sum_of_squares = 0;
+  int64_t minimum = std::numeric_limits<int64_t>::max();
+  int64_t maximum = 0;
+  for (int i = 0; i < ShardedCounter::kSlots; ++i) {
+    const Slot& slot = slots_[i];
+    int64_t slot_count = slot.count.load(std::memory_order_relaxed);
+    if (slot_count == 0) continue;
+    count += slot_count;
+    sum += slot.sum.load(std::memory_order_relaxed);
+    sum_of_squares += slot.sum_of_squares.load(std::memory_order_relaxed);
+    minimum = std::min(minimum, slot.minimum.load(std::memory_order_relaxed));
+    maximum = std::max(maximum, slot.maximum.load(std::memory_order_relaxed));
+    for (int j = 0; j < distribution->bucket_counts_size(); ++j) {
+      distribution->set_bucket_counts(
+          j, distribution->bucket_counts(j) +
+                 slot.bucket_counts[j].load(std::memory_order_relaxed));
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  // Converts the nanoseconds to microseconds.
+  double mean = sum / count;
+  distribution->set_count(count);
+  distribution->set_mean(mean / kNanosPerMicro);
+  distribution->set_minimum(minimum / kNanosPerMicro);
+  distribution->set_maximum(maximum / kNanosPerMicro);
+  distribution->set_sum_of_squared_deviation(
+      std::max(0.0, sum_of_squares - count * mean * mean) /
+      (kNanosPerMicro * kNanosPerMicro));
+}
+
+MutexLock LockAndRecordWait(Mutex* mutex, LatencyRecorder* recorder) {
+  if (recorder == NULL) {
+    return MutexLock(*mutex);
+  }
+  MutexLock lock(*mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    int64_t start = LatencyRecorder::Now();
+    lock.lock();
+    recorder->RecordSince(start);
+  }
+  return lock;
+}
+
+}  // namespace service_control_client
+}  // namespace google
@@ -0,0 +1,92 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// A latency recorder, keeping a distribution of latencies in microseconds
+// with the exponential buckets of DistributionHelper. Latencies are measured
+// in nanoseconds, so that sub-microsecond cache lookups fall in distinct
+// buckets. Samples are recorded without locks, in per-thread slots like the
+// ones of ShardedCounter, and summed into a Distribution proto on demand.
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_LATENCY_RECORDER_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_LATENCY_RECORDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "google/api/servicecontrol/v1/distribution.pb.h"
+#include "google_macros.h"
+#include "sharded_counter.h"
+#include "thread.h"
+
+namespace google {
+namespace service_control_client {
+
+// Thread safe.
+class LatencyRecorder {
+ public:
+  // The buckets, in microseconds, are powers of 2 from 1/64us (about 16ns),
+  // the last finite one ending at about 71 minutes.
+  static const int kNumFiniteBuckets = 38;
+  static const double kGrowthFactor;
+  static const double kScale;
+
+  LatencyRecorder();
+
+  // Returns a monotonic time in nanoseconds, to measure latencies with.
+  static int64_t Now();
+
+  // Records a latency, in nanoseconds.
+  void Record(int64_t latency);
+
+  // Records the latency from start, as returned by Now(), until now.
+  void RecordSince(int64_t start) { Record(Now() - start); }
+
+  // Sums the recorded latencies into the distribution, in microseconds.
+  // Samples recorded concurrently may be partially copied.
+  void ToDistribution(
+      ::google::api::servicecontrol::v1::Distribution* distribution) const;
+
+ private:
+  // The samples recorded by the threads of one ShardedCounter slot, in
+  // nanoseconds. Padded so that two slots never share a cache line.
+  struct Slot {
+    Slot();
+
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> sum;
+    std::atomic<double> sum_of_squares;
+    std::atomic<int64_t> minimum;
+    std::atomic<int64_t> maximum;
+    std::atomic<int64_t> bucket_counts[kNumFiniteBuckets + 2];
+    char padding[ShardedCounter::kCacheLineSize];
+  };
+
+  // A distribution without samples, holding the bucket options.
+  ::google::api::servicecontrol::v1::Distribution buckets_;
+
+  std::unique_ptr<Slot[]> slots_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(LatencyRecorder);
+};
+
+// Locks the mutex, recording how long it waited for it to recorder unless
+// it is null. Uncontended locks are not timed nor recorded.
+MutexLock LockAndRecordWait(Mutex* mutex, LatencyRecorder* recorder);
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_LATENCY_RECORDER_H_
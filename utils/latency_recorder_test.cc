@@ -0,0 +1,123 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/latency_recorder.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using ::google::api::servicecontrol::v1::Distribution;
+
+namespace google {
+namespace service_control_client {
+
+TEST(LatencyRecorderTest, TestEmpty) {
+  LatencyRecorder recorder;
+  Distribution distribution;
+  recorder.ToDistribution(&distribution);
+  EXPECT_EQ(distribution.count(), 0);
+  EXPECT_EQ(distribution.bucket_counts_size(),
+            LatencyRecorder::kNumFiniteBuckets + 2);
+  EXPECT_EQ(distribution.exponential_buckets().scale(),
+            LatencyRecorder::kScale);
+}
+
+TEST(LatencyRecorderTest, TestRecord) {
+  LatencyRecorder recorder;
+  // Recorded in nanoseconds.
+  recorder.Record(0);
+  recorder.Record(3000);
+  recorder.Record(5000);
+  recorder.Record(1000000);
+
+  // Copied in microseconds.
+  Distribution distribution;
+  recorder.ToDistribution(&distribution);
+  EXPECT_EQ(distribution.count(), 4);
+  EXPECT_DOUBLE_EQ(distribution.mean(), 252);
+  EXPECT_EQ(distribution.minimum(), 0);
+  EXPECT_EQ(distribution.maximum(), 1000);
+  // (0 - 252)^2 + (3 - 252)^2 + (5 - 252)^2 + (1000 - 252)^2
+  EXPECT_DOUBLE_EQ(distribution.sum_of_squared_deviation(), 746018);
+
+  // Under 1/64us, [2us, 4us), [4us, 8us) and [512us, 1024us).
+  EXPECT_EQ(distribution.bucket_counts(0), 1);
+  EXPECT_EQ(distribution.bucket_counts(8), 1);
+  EXPECT_EQ(distribution.bucket_counts(9), 1);
+  EXPECT_EQ(distribution.bucket_counts(16), 1);
+
+  // Sub-microsecond latencies are told apart: 100ns is in [1/16us, 1/8us).
+  recorder.Record(100);
+  recorder.ToDistribution(&distribution);
+  EXPECT_EQ(distribution.bucket_counts(3), 1);
+
+  // Latencies past the last finite bucket go to the overflow bucket.
+  recorder.Record(int64_t(1) << 55);
+  recorder.ToDistribution(&distribution);
+  EXPECT_EQ(distribution.bucket_counts(LatencyRecorder::kNumFiniteBuckets + 1),
+            1);
+}
+
+TEST(LatencyRecorderTest, TestConcurrentRecord) {
+  LatencyRecorder recorder;
+  std::vector<Thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&recorder, i]() {
+      for (int j = 0; j < 1000; ++j) {
+        recorder.Record((i + 1) * 1000);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // The samples of all threads are summed.
+  Distribution distribution;
+  recorder.ToDistribution(&distribution);
+  EXPECT_EQ(distribution.count(), 4000);
+  EXPECT_DOUBLE_EQ(distribution.mean(), 2.5);
+  EXPECT_EQ(distribution.minimum(), 1);
+  EXPECT_EQ(distribution.maximum(), 4);
+  // 1000 * ((1 - 2.5)^2 + (2 - 2.5)^2 + (3 - 2.5)^2 + (4 - 2.5)^2)
+  EXPECT_DOUBLE_EQ(distribution.sum_of_squared_deviation(), 5000);
+}
+
+TEST(LatencyRecorderTest, TestLockAndRecordWait) {
+  LatencyRecorder recorder;
+  Mutex mutex;
+  { MutexLock lock = LockAndRecordWait(&mutex, &recorder); }
+  Distribution distribution;
+  recorder.ToDistribution(&distribution);
+  // Uncontended locks are not recorded.
+  EXPECT_EQ(distribution.count(), 0);
+
+  MutexLock lock(mutex);
+  Thread waiter([&mutex, &recorder]() {
+    MutexLock lock = LockAndRecordWait(&mutex, &recorder);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  lock.unlock();
+  waiter.join();
+  recorder.ToDistribution(&distribution);
+  EXPECT_EQ(distribution.count(), 1);
+  EXPECT_GE(distribution.maximum(), 5000);
+
+  { MutexLock lock = LockAndRecordWait(&mutex, NULL); }
+}
+
+}  // namespace service_control_client
+}  // namespace google
@@ -36,6 +36,14 @@ std::string MD5::Digest() {
   return std::string(reinterpret_cast<char*>(digest_), kDigestLength);
 }
 
+void MD5::Digest(unsigned char* digest) {
+  if (!finalized_) {
+    MD5_Final(digest_, &ctx_);
+    finalized_ = true;
+  }
+  memcpy(digest, digest_, kDigestLength);
+}
+
 std::string MD5::DebugString(const std::string& digest) {
   assert(digest.size() == kDigestLength);
   char buf[kDigestLength * 2 + 1];
@@ -52,6 +52,10 @@ class MD5 {
   // Returns the digest as string.
   std::string Digest();
 
+  // Writes the kDigestLength bytes of the digest to the given buffer. Avoids
+  // the string allocation when the digest is used as a binary key.
+  void Digest(unsigned char* digest);
+
   // A short form of generating MD5 for a string
   std::string operator()(const void* data, size_t size);
 
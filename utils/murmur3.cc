@@ -0,0 +1,162 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "murmur3.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+const uint64_t kC1 = 0x87c37b91114253d5ULL;
+const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t Rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t Fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// Loads 8 bytes as a little-endian integer.
+inline uint64_t Load64(const unsigned char* p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+// Stores an integer as 8 little-endian bytes.
+inline void Store64(uint64_t v, unsigned char* p) {
+  for (int i = 0; i < 8; ++i, v >>= 8) {
+    p[i] = static_cast<unsigned char>(v & 0xff);
+  }
+}
+
+}  // namespace
+
+Murmur3::Murmur3()
+    : h1_(0), h2_(0), length_(0), tail_size_(0), finalized_(false) {}
+
+void Murmur3::ProcessBlock(const unsigned char* block) {
+  uint64_t k1 = Load64(block);
+  uint64_t k2 = Load64(block + 8);
+
+  k1 *= kC1;
+  k1 = Rotl64(k1, 31);
+  k1 *= kC2;
+  h1_ ^= k1;
+
+  h1_ = Rotl64(h1_, 27);
+  h1_ += h2_;
+  h1_ = h1_ * 5 + 0x52dce729;
+
+  k2 *= kC2;
+  k2 = Rotl64(k2, 33);
+  k2 *= kC1;
+  h2_ ^= k2;
+
+  h2_ = Rotl64(h2_, 31);
+  h2_ += h1_;
+  h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+Murmur3& Murmur3::Update(const void* data, size_t size) {
+  // Not update after finalized.
+  assert(!finalized_);
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  length_ += size;
+
+  if (tail_size_ > 0) {
+    size_t n = std::min(size, kBlockLength - tail_size_);
+    memcpy(tail_ + tail_size_, p, n);
+    tail_size_ += n;
+    p += n;
+    size -= n;
+    if (tail_size_ < kBlockLength) {
+      return *this;
+    }
+    ProcessBlock(tail_);
+    tail_size_ = 0;
+  }
+
+  for (; size >= kBlockLength; p += kBlockLength, size -= kBlockLength) {
+    ProcessBlock(p);
+  }
+
+  memcpy(tail_, p, size);
+  tail_size_ = size;
+  return *this;
+}
+
+void Murmur3::Finalize() {
+  if (!finalized_) {
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (size_t i = tail_size_; i > 8; --i) {
+      k2 = (k2 << 8) | tail_[i - 1];
+    }
+    for (size_t i = std::min<size_t>(tail_size_, 8); i > 0; --i) {
+      k1 = (k1 << 8) | tail_[i - 1];
+    }
+    if (tail_size_ > 8) {
+      k2 *= kC2;
+      k2 = Rotl64(k2, 33);
+      k2 *= kC1;
+      h2_ ^= k2;
+    }
+    if (tail_size_ > 0) {
+      k1 *= kC1;
+      k1 = Rotl64(k1, 31);
+      k1 *= kC2;
+      h1_ ^= k1;
+    }
+
+    h1_ ^= length_;
+    h2_ ^= length_;
+    h1_ += h2_;
+    h2_ += h1_;
+    h1_ = Fmix64(h1_);
+    h2_ = Fmix64(h2_);
+    h1_ += h2_;
+    h2_ += h1_;
+    finalized_ = true;
+  }
+}
+
+std::string Murmur3::Digest() {
+  char digest[kDigestLength];
+  Digest(reinterpret_cast<unsigned char*>(digest));
+  return std::string(digest, kDigestLength);
+}
+
+void Murmur3::Digest(unsigned char* digest) {
+  Finalize();
+  Store64(h1_, digest);
+  Store64(h2_, digest + 8);
+}
+
+std::string Murmur3::operator()(const void* data, size_t size) {
+  return Update(data, size).Digest();
+}
+
+}  // namespace service_control_client
+}  // namespace google
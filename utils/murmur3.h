@@ -0,0 +1,85 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_MURMUR3_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_MURMUR3_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace google {
+namespace service_control_client {
+
+// A streaming implementation of the 128-bit MurmurHash3 (x64 variant).
+// It is not cryptographic, but is well distributed and several times faster
+// than MD5, which makes it suitable for cache keys. Has the same interface as
+// the MD5 class so either can be used to generate signatures.
+class Murmur3 {
+ public:
+  Murmur3();
+
+  // Updates the context with data.
+  Murmur3& Update(const void* data, size_t size);
+
+  // A helper function for const char*
+  Murmur3& Update(const char* str) { return Update(str, strlen(str)); }
+
+  // A helper function for const string
+  Murmur3& Update(const std::string& str) {
+    return Update(str.data(), str.size());
+  }
+
+  // A helper function for int
+  Murmur3& Update(int d) { return Update(&d, sizeof(d)); }
+
+  // The digest is always 128 bits = 16 bytes
+  static const int kDigestLength = 16;
+
+  // Returns the digest as string. Same byte order as the reference
+  // MurmurHash3_x64_128 output.
+  std::string Digest();
+
+  // Writes the kDigestLength bytes of the digest to the given buffer.
+  void Digest(unsigned char* digest);
+
+  // A short form of generating the digest for a string
+  std::string operator()(const void* data, size_t size);
+
+ private:
+  static const int kBlockLength = 16;
+
+  // Mixes one 16-byte block into the state.
+  void ProcessBlock(const unsigned char* block);
+
+  // Mixes the remaining bytes and the length into the state, once.
+  void Finalize();
+
+  // The hash state.
+  uint64_t h1_;
+  uint64_t h2_;
+  // Total number of bytes hashed.
+  uint64_t length_;
+  // Bytes not yet forming a full block.
+  unsigned char tail_[kBlockLength];
+  size_t tail_size_;
+  // A flag to indicate if the digest is finalized or not.
+  bool finalized_;
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_MURMUR3_H_
@@ -0,0 +1,67 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "murmur3.h"
+#include "gtest/gtest.h"
+#include "md5.h"
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+TEST(Murmur3Test, TestReferenceDigest) {
+  // Expected values are from the reference MurmurHash3_x64_128 with seed 0.
+  ASSERT_EQ("00000000000000000000000000000000",
+            MD5::DebugString(Murmur3()("", 0)));
+  ASSERT_EQ("029bbd41b3a7d8cb191dae486a901e5b",
+            MD5::DebugString(Murmur3()("hello", 5)));
+  static const char data[] = "Test Data";
+  ASSERT_EQ("12b4bcdefa12758e0d0f6f754e1eefa1",
+            MD5::DebugString(Murmur3()(data, sizeof(data))));
+  static const char fox[] = "The quick brown fox jumps over the lazy dog";
+  ASSERT_EQ("6c1b07bc7bbc4be347939ac4a93c437a",
+            MD5::DebugString(Murmur3()(fox, strlen(fox))));
+}
+
+TEST(Murmur3Test, TestStreamingUpdates) {
+  static const char fox[] = "The quick brown fox jumps over the lazy dog";
+  const std::string expected = Murmur3()(fox, strlen(fox));
+  // Splitting the input at any point must not change the digest.
+  for (size_t i = 0; i <= strlen(fox); ++i) {
+    Murmur3 hasher;
+    hasher.Update(fox, i);
+    hasher.Update(fox + i, strlen(fox) - i);
+    ASSERT_EQ(expected, hasher.Digest()) << "split at " << i;
+  }
+  Murmur3 hasher;
+  for (size_t i = 0; i < strlen(fox); ++i) {
+    hasher.Update(fox + i, 1);
+  }
+  ASSERT_EQ(expected, hasher.Digest());
+}
+
+TEST(Murmur3Test, TestDigestEqual) {
+  static const char data1[] = "Test Data1";
+  static const char data2[] = "Test Data2";
+  auto d1 = Murmur3()(data1, sizeof(data1));
+  auto d11 = Murmur3()(data1, sizeof(data1));
+  auto d2 = Murmur3()(data2, sizeof(data2));
+  ASSERT_EQ(d11, d1);
+  ASSERT_NE(d1, d2);
+}
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
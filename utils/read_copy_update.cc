@@ -0,0 +1,71 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/read_copy_update.h"
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+// Returns the reader counter stripe of the calling thread. Threads are
+// assigned stripes round robin on first use.
+int GetThreadStripe(int num_stripes) {
+  static std::atomic<int> next_stripe(0);
+  thread_local int stripe = next_stripe.fetch_add(1);
+  return stripe % num_stripes;
+}
+
+}  // namespace
+
+ReadCopyUpdate::ReadCopyUpdate() : epoch_(0) {
+  for (auto& epoch_readers : readers_) {
+    for (auto& counter : epoch_readers) {
+      counter.value.store(0);
+    }
+  }
+}
+
+ReadCopyUpdate::ReadSection::ReadSection(ReadCopyUpdate* rcu) {
+  // All operations are sequentially consistent: if the reader reads the old
+  // epoch but is counted only after the writer has checked its counter, the
+  // writer has already published the new data, so the reader loads it.
+  int epoch = rcu->epoch_.load();
+  counter_ = &rcu->readers_[epoch][GetThreadStripe(kNumStripes)].value;
+  counter_->fetch_add(1);
+}
+
+ReadCopyUpdate::ReadSection::~ReadSection() { counter_->fetch_sub(1); }
+
+void ReadCopyUpdate::WaitForReaders(int epoch) {
+  for (const auto& counter : readers_[epoch]) {
+    while (counter.value.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ReadCopyUpdate::Synchronize() {
+  MutexLock lock(writer_mutex_);
+  // A reader may have read the epoch before the previous Synchronize() flipped
+  // it, and only be counted in it now. Flipping twice waits for both epochs.
+  for (int phase = 0; phase < 2; ++phase) {
+    int epoch = epoch_.load();
+    epoch_.store(1 - epoch);
+    WaitForReaders(epoch);
+  }
+}
+
+}  // namespace service_control_client
+}  // namespace google
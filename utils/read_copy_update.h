@@ -0,0 +1,86 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_READ_COPY_UPDATE_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_READ_COPY_UPDATE_H_
+
+#include <stdint.h>
+#include <atomic>
+
+#include "utils/google_macros.h"
+#include "utils/thread.h"
+
+namespace google {
+namespace service_control_client {
+
+// A minimal read-copy-update (RCU) synchronizer for read-mostly data.
+//
+// Readers access the shared data inside a ReadSection, which never blocks and
+// takes no lock. Writers never modify data a reader may see: they publish a
+// new copy with an atomic store, then call Synchronize(), which waits until
+// every reader that may still see the old copy has left its ReadSection, so
+// the old copy can be freed.
+//
+// The number of active readers is kept per epoch, in counters striped by
+// thread so that readers on different cores rarely write the same cache line.
+// Synchronize() flips the epoch twice and waits for the readers of each
+// previous epoch, the same scheme as userspace RCU.
+//
+// Thread safe. ReadSections must be short and must not call Synchronize().
+class ReadCopyUpdate {
+ public:
+  ReadCopyUpdate();
+
+  // Marks the calling thread as reading until destroyed.
+  class ReadSection {
+   public:
+    explicit ReadSection(ReadCopyUpdate* rcu);
+    ~ReadSection();
+
+   private:
+    std::atomic<int64_t>* counter_;
+
+    GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReadSection);
+  };
+
+  // Waits until all ReadSections started before this call have ended.
+  void Synchronize();
+
+ private:
+  static const int kNumStripes = 16;
+
+  // A reader counter padded to its own cache line.
+  struct Counter {
+    std::atomic<int64_t> value;
+    char padding[64 - sizeof(std::atomic<int64_t>)];
+  };
+
+  // Waits until no reader is counted in the given epoch.
+  void WaitForReaders(int epoch);
+
+  // The epoch new readers are counted in, 0 or 1.
+  std::atomic<int> epoch_;
+  // Active readers, per epoch and stripe.
+  Counter readers_[2][kNumStripes];
+  // Serializes Synchronize() calls.
+  Mutex writer_mutex_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReadCopyUpdate);
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_READ_COPY_UPDATE_H_
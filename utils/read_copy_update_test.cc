@@ -0,0 +1,99 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/read_copy_update.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace service_control_client {
+namespace {
+
+TEST(ReadCopyUpdateTest, SynchronizeWithoutReaders) {
+  ReadCopyUpdate rcu;
+  rcu.Synchronize();
+  { ReadCopyUpdate::ReadSection section(&rcu); }
+  rcu.Synchronize();
+}
+
+TEST(ReadCopyUpdateTest, SynchronizeWaitsForReaders) {
+  ReadCopyUpdate rcu;
+  std::atomic<bool> in_section(false);
+  std::atomic<bool> leave(false);
+  std::atomic<bool> synchronized(false);
+
+  std::thread reader([&]() {
+    ReadCopyUpdate::ReadSection section(&rcu);
+    in_section = true;
+    while (!leave) {
+      std::this_thread::yield();
+    }
+    // The writer must still be waiting.
+    EXPECT_FALSE(synchronized);
+  });
+  while (!in_section) {
+    std::this_thread::yield();
+  }
+  std::thread writer([&]() {
+    rcu.Synchronize();
+    synchronized = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_FALSE(synchronized);
+  leave = true;
+  reader.join();
+  writer.join();
+  EXPECT_TRUE(synchronized);
+}
+
+// Readers must never see a value freed by a writer.
+TEST(ReadCopyUpdateTest, ConcurrentReplace) {
+  ReadCopyUpdate rcu;
+  std::atomic<int*> value(new int(0));
+  std::atomic<bool> done(false);
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      int last = 0;
+      while (!done) {
+        ReadCopyUpdate::ReadSection section(&rcu);
+        int current = *value.load();
+        // The writer poisons freed values with -1 before deleting them.
+        ASSERT_GE(current, last);
+        last = current;
+      }
+    });
+  }
+  for (int i = 1; i <= 2000; ++i) {
+    int* old_value = value.exchange(new int(i));
+    rcu.Synchronize();
+    *old_value = -1;
+    delete old_value;
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  delete value.load();
+}
+
+}  // namespace
+}  // namespace service_control_client
+}  // namespace google
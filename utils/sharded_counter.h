@@ -0,0 +1,88 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// A counter for statistics incremented by many threads.
+//
+// A single atomic counter bumped by every thread makes its cache line bounce
+// between cores on each increment. Instead, each thread adds to one of
+// kSlots slots, each on its own cache line, and the slots are only summed
+// when the counter is read.
+
+#ifndef GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_SHARDED_COUNTER_H_
+#define GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_SHARDED_COUNTER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "google_macros.h"
+
+namespace google {
+namespace service_control_client {
+
+// Thread safe.
+class ShardedCounter {
+ public:
+  // Threads are assigned slots in turn, so up to kSlots threads never share
+  // a slot.
+  static const int kSlots = 32;
+  static const size_t kCacheLineSize = 64;
+
+  ShardedCounter() {
+    for (Slot& slot : slots_) {
+      slot.value.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Increment() { Add(1); }
+
+  void Add(int64_t value) {
+    slots_[ThreadSlot()].value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  // Returns the sum of all the slots. Concurrent increments may be missed.
+  int64_t Value() const {
+    int64_t value = 0;
+    for (const Slot& slot : slots_) {
+      value += slot.value.load(std::memory_order_relaxed);
+    }
+    return value;
+  }
+
+  // Returns the slot of the calling thread, in [0, kSlots). Also used by
+  // other statistics kept per slot.
+  static int ThreadSlot() {
+    static std::atomic<int> next_slot(0);
+    static thread_local int slot =
+        next_slot.fetch_add(1, std::memory_order_relaxed) % kSlots;
+    return slot;
+  }
+
+ private:
+  // Padded so that the values of two slots are never on the same cache line.
+  struct Slot {
+    std::atomic<int64_t> value;
+    char padding[kCacheLineSize - sizeof(std::atomic<int64_t>)];
+  };
+
+  Slot slots_[kSlots];
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ShardedCounter);
+};
+
+}  // namespace service_control_client
+}  // namespace google
+
+#endif  // GOOGLE_SERVICE_CONTROL_CLIENT_UTILS_SHARDED_COUNTER_H_
@@ -0,0 +1,55 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "utils/sharded_counter.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "utils/thread.h"
+
+namespace google {
+namespace service_control_client {
+
+TEST(ShardedCounterTest, TestAdd) {
+  ShardedCounter counter;
+  EXPECT_EQ(counter.Value(), 0);
+  counter.Increment();
+  counter.Add(5);
+  EXPECT_EQ(counter.Value(), 6);
+  counter.Add(-2);
+  EXPECT_EQ(counter.Value(), 4);
+}
+
+TEST(ShardedCounterTest, TestConcurrentAdd) {
+  ShardedCounter counter;
+  // More threads than slots, so some of them share a slot.
+  const int kThreads = ShardedCounter::kSlots + 8;
+  std::vector<Thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&counter]() {
+      for (int j = 0; j < 1000; ++j) {
+        counter.Increment();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(counter.Value(), kThreads * 1000);
+}
+
+}  // namespace service_control_client
+}  // namespace google
@@ -30,9 +30,20 @@ template <typename T>
 struct SimpleLRUHash : public std::hash<T> {};
 }  // namespace internal
 
+template <typename Key, typename Value>
+struct SimpleLRUCacheElem;
+
+template <class Key, class T, class Hash, class EQ>
+class FlatHashMap;
+
+// MapType is the hash table mapping keys to cache elements. The default is a
+// std::unordered_map; SimpleLRUCacheFlatMap selects an open-addressing table
+// whose elements are allocated from a slab.
 template <typename Key, typename Value,
           typename H = internal::SimpleLRUHash<Key>,
-          typename EQ = std::equal_to<Key> >
+          typename EQ = std::equal_to<Key>,
+          typename MapType =
+              std::unordered_map<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ> >
 class SimpleLRUCache;
 
 // Deleter is a functor that defines how to delete a Value*. That is, it
@@ -41,9 +52,20 @@ class SimpleLRUCache;
 // See example in the associated unittest.
 template <typename Key, typename Value, typename Deleter,
           typename H = internal::SimpleLRUHash<Key>,
-          typename EQ = std::equal_to<Key> >
+          typename EQ = std::equal_to<Key>,
+          typename MapType =
+              std::unordered_map<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ> >
 class SimpleLRUCacheWithDeleter;
 
+// The open-addressing MapType for SimpleLRUCache and
+// SimpleLRUCacheWithDeleter, e.g.
+//   SimpleLRUCache<Key, Value, H, EQ, SimpleLRUCacheFlatMap<Key, Value, H, EQ>>
+template <typename Key, typename Value,
+          typename H = internal::SimpleLRUHash<Key>,
+          typename EQ = std::equal_to<Key> >
+using SimpleLRUCacheFlatMap =
+    FlatHashMap<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ>;
+
 }  // namespace service_control_client
 }  // namespace google
 
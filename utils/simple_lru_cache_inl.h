@@ -47,14 +47,19 @@ limitations under the License.
 
 #include <stddef.h>
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "flat_hash_map.h"
 #include "google_macros.h"
 #include "simple_lru_cache.h"
 
@@ -192,6 +197,81 @@ struct SimpleLRUCacheElem {
 template <typename Key, typename Value>
 const int64_t SimpleLRUCacheElem<Key, Value>::kNeverUsed;
 
+// Allocates each cache element with new and delete.
+template <class Elem>
+class SimpleLRUCacheHeapAllocator {
+ public:
+  template <class... Args>
+  Elem* New(Args&&... args) {
+    return new Elem(std::forward<Args>(args)...);
+  }
+  void Delete(Elem* e) { delete e; }
+};
+
+// Allocates cache elements from blocks of contiguous slots, so elements
+// inserted together are close in memory and an insertion does not need a heap
+// allocation once the cache has reached its steady size. Freed slots are
+// reused; blocks are only released when the allocator is destroyed.
+template <class Elem>
+class SimpleLRUCacheSlabAllocator {
+ public:
+  SimpleLRUCacheSlabAllocator()
+      : free_list_(nullptr), next_block_size_(kMinBlockSize) {}
+
+  template <class... Args>
+  Elem* New(Args&&... args) {
+    if (free_list_ == nullptr) AllocateBlock();
+    Slot* slot = free_list_;
+    free_list_ = slot->next;
+    return new (&slot->storage) Elem(std::forward<Args>(args)...);
+  }
+
+  void Delete(Elem* e) {
+    e->~Elem();
+    Slot* slot = reinterpret_cast<Slot*>(e);
+    slot->next = free_list_;
+    free_list_ = slot;
+  }
+
+ private:
+  static const size_t kMinBlockSize = 16;
+  static const size_t kMaxBlockSize = 1024;
+
+  union Slot {
+    Slot* next;
+    typename std::aligned_storage<sizeof(Elem), alignof(Elem)>::type storage;
+  };
+
+  void AllocateBlock() {
+    Slot* block = new Slot[next_block_size_];
+    blocks_.emplace_back(block);
+    for (size_t i = 0; i < next_block_size_; ++i) {
+      block[i].next = free_list_;
+      free_list_ = &block[i];
+    }
+    next_block_size_ = next_block_size_ * 2 < kMaxBlockSize
+                           ? next_block_size_ * 2
+                           : kMaxBlockSize;
+  }
+
+  Slot* free_list_;
+  size_t next_block_size_;
+  std::vector<std::unique_ptr<Slot[]>> blocks_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(SimpleLRUCacheSlabAllocator);
+};
+
+// Selects how the elements of a cache using the given MapType are allocated.
+template <class MapType, class Elem>
+struct SimpleLRUCacheElemAllocator {
+  typedef SimpleLRUCacheHeapAllocator<Elem> type;
+};
+
+template <class Key, class Elem, class H, class EQ>
+struct SimpleLRUCacheElemAllocator<FlatHashMap<Key, Elem*, H, EQ>, Elem> {
+  typedef SimpleLRUCacheSlabAllocator<Elem> type;
+};
+
 // A simple class passed into various cache methods to change the
 // behavior for that single call.
 class SimpleLRUCacheOptions {
@@ -369,9 +449,20 @@ class SimpleLRUCacheBase {
   }
   void InsertPinned(const Key& k, Value* value, size_t units);
 
+  // If inserting an entry of "units" units would make the cache overfull,
+  // sets "*k" to the key of the first entry evicted to make room and returns
+  // true. Lets the caller apply an admission policy before "Insert".
+  bool EvictionCandidate(size_t units, Key* k) const;
+
   // Change the reported size of an object.
   void UpdateSize(const Key& k, const Value* value, size_t units);
 
+  // Marks the entry for "k" as used now, as a "Lookup" followed by a
+  // "Release" would, but without removing expired entries first. Useful to
+  // apply uses recorded elsewhere in a batch. Returns false if "k" is not in
+  // the cache. Does nothing in age-based mode.
+  bool Touch(const Key& k);
+
   // return true iff <k, value> pair is still in use
   // (i.e., either in the table or the deferred list)
   // Note, if (value == nullptr), only key is used for matching
@@ -431,6 +522,12 @@ class SimpleLRUCacheBase {
   // Return maximum size of cache
   int64_t MaxSize() const { return max_units_; }
 
+  // Return the number of entries discarded to meet the size limit, and the
+  // number of entries discarded once idle or too old, since the cache was
+  // created.
+  int64_t Evictions() const { return evictions_; }
+  int64_t Expirations() const { return expirations_; }
+
   // Return the age (in microseconds) of the least recently used element in
   // the cache.  If the cache is empty, zero (0) is returned.
   int64_t AgeOfLRUItemInMicroseconds() const;
@@ -528,6 +625,8 @@ class SimpleLRUCacheBase {
   typedef typename DeferredTable::const_iterator DeferredTableConstIterator;
 
   Table table_;  // Main table
+  // Allocates the elements in "table_" and "defer_".
+  typename SimpleLRUCacheElemAllocator<MapType, Elem>::type elem_allocator_;
   // Pinned entries awaiting to be released before they can be discarded.
   // This is a key -> list mapping (multiple deferred entries for the same key)
   // The machinery used to maintain main LRU list is reused here, though this
@@ -539,6 +638,8 @@ class SimpleLRUCacheBase {
   Elem head_;             // Dummy head of LRU list (next is mru elem)
   int64_t max_idle_;      // Maximum number of idle cycles
   bool lru_;              // LRU or age-based eviction?
+  int64_t evictions_;     // Entries discarded by GarbageCollect()
+  int64_t expirations_;   // Entries discarded by DiscardIdle()
 
   // Representation invariants:
   // . LRU list is circular doubly-linked list
@@ -550,7 +651,7 @@ class SimpleLRUCacheBase {
     assert(e->pin == 0);
     units_ -= e->units;
     RemoveElement(e->key, e->value);
-    delete e;
+    elem_allocator_.Delete(e);
   }
 
   // Count the number and total size of the elements in the deferred table.
@@ -588,6 +689,8 @@ SimpleLRUCacheBase<Key, Value, MapType, EQ>::SimpleLRUCacheBase(
   head_.prev = &head_;
   max_idle_ = -1;  // Stands for "no expiration"
   lru_ = true;     // default to LRU, not age-based
+  evictions_ = 0;
+  expirations_ = 0;
 }
 
 template <class Key, class Value, class MapType, class EQ>
@@ -756,7 +859,7 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::InsertPinned(const Key& k,
   Remove(k);
 
   // Make new element
-  Elem* e = new Elem(k, value, 1, units, SimpleCycleTimer::Now());
+  Elem* e = elem_allocator_.New(k, value, 1, units, SimpleCycleTimer::Now());
 
   // Adjust table, total units fields.
   units_ += units;
@@ -878,12 +981,27 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::GarbageCollect() {
       assert(iter->second == e);
       table_.erase(iter);
       e->Unlink();
+      ++evictions_;
       Discard(e);
     }
     e = prev;
   }
 }
 
+template <class Key, class Value, class MapType, class EQ>
+bool SimpleLRUCacheBase<Key, Value, MapType, EQ>::EvictionCandidate(
+    size_t units, Key* k) const {
+  if (units_ + static_cast<int64_t>(units) <= max_units_) return false;
+  // Pinned entries are skipped by GarbageCollect().
+  for (const Elem* e = head_.prev; e != &head_; e = e->prev) {
+    if (e->pin == 0) {
+      *k = e->key;
+      return true;
+    }
+  }
+  return false;
+}
+
 // Not using cycle. Instead using second from time()
 static const int kAcceptableClockSynchronizationDriftCycles = 1;
 
@@ -923,6 +1041,7 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::DiscardIdle(
     // There are no pinned elements on the list in the LRU mode, and in the
     // age-based mode we push them out of the main table regardless of pinning.
     assert(e->pin == 0 || !lru_);
+    ++expirations_;
     Remove(e->key);
     e = prev;
   }
@@ -977,6 +1096,20 @@ int64_t SimpleLRUCacheBase<Key, Value, MapType, EQ>::GetLastUseTime(
   return e->last_use_;
 }
 
+template <class Key, class Value, class MapType, class EQ>
+bool SimpleLRUCacheBase<Key, Value, MapType, EQ>::Touch(const Key& k) {
+  TableIterator iter = table_.find(k);
+  if (iter == table_.end()) return false;
+  Elem* e = iter->second;
+  // Pinned entries are off the LRU list; their use is recorded on Release.
+  if (lru_ && e->pin == 0) {
+    e->last_use_ = SimpleCycleTimer::Now();
+    e->Unlink();
+    e->Link(&head_);
+  }
+  return true;
+}
+
 template <class Key, class Value, class MapType, class EQ>
 int64_t SimpleLRUCacheBase<Key, Value, MapType, EQ>::GetInsertionTime(
     const Key& k) const {
@@ -1041,17 +1174,12 @@ auto SimpleLRUCacheConstIterator<MapType, Key, Value>::operator++()
   return *this;
 }
 
-template <class Key, class Value, class H, class EQ>
+template <class Key, class Value, class H, class EQ, class MapType>
 class SimpleLRUCache
-    : public SimpleLRUCacheBase<
-          Key, Value,
-          std::unordered_map<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ>, EQ> {
+    : public SimpleLRUCacheBase<Key, Value, MapType, EQ> {
  public:
   explicit SimpleLRUCache(int64_t total_units)
-      : SimpleLRUCacheBase<
-            Key, Value,
-            std::unordered_map<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ>,
-            EQ>(total_units) {}
+      : SimpleLRUCacheBase<Key, Value, MapType, EQ>(total_units) {}
 
  protected:
   virtual void RemoveElement(const Key& k, Value* value) { delete value; }
@@ -1060,14 +1188,11 @@ class SimpleLRUCache
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(SimpleLRUCache);
 };
 
-template <class Key, class Value, class Deleter, class H, class EQ>
+template <class Key, class Value, class Deleter, class H, class EQ,
+          class MapType>
 class SimpleLRUCacheWithDeleter
-    : public SimpleLRUCacheBase<
-          Key, Value,
-          std::unordered_map<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ>, EQ> {
-  typedef std::unordered_map<Key, SimpleLRUCacheElem<Key, Value>*, H, EQ>
-      HashMap;
-  typedef SimpleLRUCacheBase<Key, Value, HashMap, EQ> Base;
+    : public SimpleLRUCacheBase<Key, Value, MapType, EQ> {
+  typedef SimpleLRUCacheBase<Key, Value, MapType, EQ> Base;
 
  public:
   explicit SimpleLRUCacheWithDeleter(int64_t total_units)
@@ -59,6 +59,18 @@ void TickClock() {
 
 }  // namespace
 
+struct TestValue;
+
+// The test is built once for each MapType backend of SimpleLRUCache.
+#ifdef SIMPLE_LRU_CACHE_TEST_FLAT_MAP
+typedef SimpleLRUCache<int, TestValue, internal::SimpleLRUHash<int>,
+                       std::equal_to<int>,
+                       SimpleLRUCacheFlatMap<int, TestValue>>
+    TestCacheBase;
+#else
+typedef SimpleLRUCache<int, TestValue> TestCacheBase;
+#endif
+
 // Value type
 struct TestValue {
   int label;  // Index into "in_cache"
@@ -66,15 +78,15 @@ struct TestValue {
 
  protected:
   // Make sure that TestCache can delete TestValue when declared as friend.
-  friend class SimpleLRUCache<int, TestValue>;
+  friend TestCacheBase;
   friend class TestCache;
   ~TestValue() {}
 };
 
-class TestCache : public SimpleLRUCache<int, TestValue> {
+class TestCache : public TestCacheBase {
  public:
   explicit TestCache(int64_t size, bool check_in_cache = true)
-      : SimpleLRUCache<int, TestValue>(size), check_in_cache_(check_in_cache) {}
+      : TestCacheBase(size), check_in_cache_(check_in_cache) {}
 
  protected:
   virtual void RemoveElement(const int& key, TestValue* v) {
@@ -455,6 +467,47 @@ TEST_F(SimpleLRUCacheTest, Pinning) {
   }
 }
 
+TEST_F(SimpleLRUCacheTest, EvictionCandidate) {
+  cache_.reset(new TestCache(2));
+  int key = -1;
+  EXPECT_FALSE(cache_->EvictionCandidate(1, &key));
+  for (int i = 0; i < 2; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+  EXPECT_FALSE(cache_->EvictionCandidate(0, &key));
+  EXPECT_TRUE(cache_->EvictionCandidate(1, &key));
+  EXPECT_EQ(key, 0);
+
+  // Pinned entries are not evicted.
+  TestValue* v = cache_->Lookup(0);
+  ASSERT_TRUE(v != nullptr);
+  EXPECT_TRUE(cache_->EvictionCandidate(1, &key));
+  EXPECT_EQ(key, 1);
+  cache_->Release(0, v);
+}
+
+TEST_F(SimpleLRUCacheTest, EvictionsAndExpirations) {
+  cache_.reset(new TestCache(2));
+  for (int i = 0; i < 4; i++) {
+    in_cache[i] = true;
+    cache_->Insert(i, new TestValue(i), 1);
+  }
+  EXPECT_EQ(cache_->Evictions(), 2);
+  EXPECT_EQ(cache_->Expirations(), 0);
+
+  // Removed entries are neither evicted nor expired.
+  cache_->Remove(3);
+  EXPECT_EQ(cache_->Evictions(), 2);
+
+  cache_->SetAgeBasedEviction(0.01);  // 10 milliseconds
+  usleep(20 * 1000);
+  cache_->RemoveExpiredEntries();
+  EXPECT_EQ(cache_->Entries(), 0);
+  EXPECT_EQ(cache_->Evictions(), 2);
+  EXPECT_EQ(cache_->Expirations(), 1);
+}
+
 TEST_F(SimpleLRUCacheTest, Remove) {
   cache_.reset(new TestCache(kCacheSize));
   for (int i = 0; i < kElems; i++) {
@@ -1000,6 +1053,34 @@ TEST_F(SimpleLRUCacheTest, GetLastUseTime) {
   ASSERT_EQ(cache_->GetLastUseTime(2), -1);
 }
 
+TEST_F(SimpleLRUCacheTest, Touch) {
+  cache_.reset(new TestCache(2));
+  ASSERT_FALSE(cache_->Touch(1));
+
+  in_cache[1] = true;
+  cache_->Insert(1, new TestValue(1), 1);
+  in_cache[2] = true;
+  cache_->Insert(2, new TestValue(2), 1);
+
+  // Touching 1 updates its last use and makes 2 the LRU entry.
+  TickClock();
+  ASSERT_TRUE(cache_->Touch(1));
+  ASSERT_GT(cache_->GetLastUseTime(1), cache_->GetLastUseTime(2));
+  in_cache[3] = true;
+  cache_->Insert(3, new TestValue(3), 1);
+  ASSERT_TRUE(in_cache[1]);
+  ASSERT_FALSE(in_cache[2]);
+
+  // Touching an expired entry does not remove other expired entries.
+  cache_->SetMaxIdleSeconds(0.001);
+  usleep(2000);
+  ASSERT_TRUE(cache_->Touch(1));
+  ASSERT_TRUE(in_cache[3]);
+  cache_->RemoveExpiredEntries();
+  ASSERT_TRUE(in_cache[1]);
+  ASSERT_FALSE(in_cache[3]);
+}
+
 TEST_F(SimpleLRUCacheTest, GetInsertionTime) {
   cache_.reset(new TestCache(kElems));
   int64_t now, last;